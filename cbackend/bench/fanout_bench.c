@@ -0,0 +1,194 @@
+// Fanout microbenchmark: one broadcast frame written to N loopback TCP
+// clients, either with one send() per client or as one batch of io_uring
+// SEND operations submitted with a single io_uring_enter().
+//
+// Build and run with `make bench`.
+#include "wsuring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define FRAME_LEN 512    // Typical compressed sensor tick
+#define ROUNDS 2000
+#define WARMUP_ROUNDS 100
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Open n connected loopback pairs: senders[i] is the server side, the
+// bench writes to it; receivers[i] is drained between rounds.
+static int open_pairs(int n, int *senders, int *receivers)
+{
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(lfd, 1024) < 0 || getsockname(lfd, (struct sockaddr *)&addr, &alen) < 0)
+    {
+        perror("listen socket");
+        return -1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        receivers[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (receivers[i] < 0 || connect(receivers[i], (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("connect()");
+            return -1;
+        }
+        senders[i] = accept(lfd, NULL, NULL);
+        if (senders[i] < 0)
+        {
+            perror("accept()");
+            return -1;
+        }
+        int one = 1;
+        setsockopt(senders[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(senders[i], F_SETFL, O_NONBLOCK);
+        fcntl(receivers[i], F_SETFL, O_NONBLOCK);
+    }
+    close(lfd);
+    return 0;
+}
+
+static void close_pairs(int n, int *senders, int *receivers)
+{
+    for (int i = 0; i < n; i++)
+    {
+        close(senders[i]);
+        close(receivers[i]);
+    }
+}
+
+// Empty every receiver so the next round never hits a full socket buffer.
+static void drain(int n, int *receivers)
+{
+    char buf[65536];
+    for (int i = 0; i < n; i++)
+        while (recv(receivers[i], buf, sizeof(buf), 0) > 0)
+            ;
+}
+
+static double bench_send(int n, int *senders, int *receivers, const uint8_t *frame,
+                         unsigned long long *syscalls)
+{
+    uint64_t total = 0;
+    for (int round = 0; round < WARMUP_ROUNDS + ROUNDS; round++)
+    {
+        uint64_t start = now_ns();
+        for (int i = 0; i < n; i++)
+            if (send(senders[i], frame, FRAME_LEN, MSG_DONTWAIT | MSG_NOSIGNAL) != FRAME_LEN)
+                fprintf(stderr, "short send() to client %d\n", i);
+        if (round >= WARMUP_ROUNDS)
+            total += now_ns() - start;
+        drain(n, receivers);
+    }
+    *syscalls = (unsigned long long)n * ROUNDS;
+    return (double)total / ROUNDS / 1000.0;
+}
+
+static double bench_uring(ws_uring *ring, int n, int *senders, int *receivers,
+                          const uint8_t *frame, unsigned long long *syscalls)
+{
+    uint64_t total = 0;
+    unsigned long long enters = 0;
+    for (int round = 0; round < WARMUP_ROUNDS + ROUNDS; round++)
+    {
+        unsigned long long before = ring->enters;
+        uint64_t start = now_ns();
+        for (int i = 0; i < n; i++)
+        {
+            if (ws_uring_prep_send(ring, senders[i], frame, FRAME_LEN,
+                                   MSG_DONTWAIT | MSG_NOSIGNAL, NULL) < 0)
+            {
+                ws_uring_submit_wait(ring);
+                ws_uring_prep_send(ring, senders[i], frame, FRAME_LEN,
+                                   MSG_DONTWAIT | MSG_NOSIGNAL, NULL);
+            }
+            // Reap as we go so a batch larger than the ring keeps flowing.
+            void *data;
+            int res;
+            while (ws_uring_next_cqe(ring, &data, &res))
+                if (res != FRAME_LEN)
+                    fprintf(stderr, "short io_uring send: %d\n", res);
+        }
+        if (ws_uring_submit_wait(ring) < 0)
+            perror("io_uring_enter()");
+        void *data;
+        int res;
+        while (ws_uring_next_cqe(ring, &data, &res))
+            if (res != FRAME_LEN)
+                fprintf(stderr, "short io_uring send: %d\n", res);
+        if (round >= WARMUP_ROUNDS)
+        {
+            total += now_ns() - start;
+            enters += ring->enters - before;
+        }
+        drain(n, receivers);
+    }
+    *syscalls = enters;
+    return (double)total / ROUNDS / 1000.0;
+}
+
+int main(void)
+{
+    static const int sizes[] = {10, 100, 1000};
+    uint8_t frame[FRAME_LEN];
+    memset(frame, 'x', sizeof(frame));
+
+    // Each client takes two descriptors.
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < 4096)
+    {
+        rl.rlim_cur = rl.rlim_max < 4096 ? rl.rlim_max : 4096;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    ws_uring ring;
+    if (ws_uring_init(&ring, 1024) < 0)
+    {
+        perror("io_uring_setup()");
+        return 1;
+    }
+
+    printf("%-8s %-8s %14s %16s\n", "clients", "backend", "us/fanout", "syscalls/fanout");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        int n = sizes[s];
+        int *senders = calloc(n, sizeof(int));
+        int *receivers = calloc(n, sizeof(int));
+        if (!senders || !receivers || open_pairs(n, senders, receivers) < 0)
+        {
+            fprintf(stderr, "could not open %d client pairs\n", n);
+            return 1;
+        }
+        unsigned long long calls;
+        double us = bench_send(n, senders, receivers, frame, &calls);
+        printf("%-8d %-8s %14.1f %16.1f\n", n, "send", us, (double)calls / ROUNDS);
+        us = bench_uring(&ring, n, senders, receivers, frame, &calls);
+        printf("%-8d %-8s %14.1f %16.1f\n", n, "uring", us, (double)calls / ROUNDS);
+        close_pairs(n, senders, receivers);
+        free(senders);
+        free(receivers);
+    }
+    ws_uring_free(&ring);
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Unmask microbenchmark: the old byte-at-a-time loop (key[i % 4]) against
+// ws_mask_payload(), over payload sizes from a ping to a video keyframe.
+// The buffer starts one byte past an 8-byte boundary so the unaligned head
+// and tail are part of every run.
+//
+// Build and run with `make bench`.
+#include "websocket.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define BYTES_PER_SIZE (1ull << 31) // Work per payload size, so each takes ~0.1-1 s
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// The loop ws_parse_frame() used before
+__attribute__((noinline)) static void mask_bytewise(uint8_t *data, size_t len, const uint8_t key[4])
+{
+    for (size_t i = 0; i < len; i++)
+        data[i] ^= key[i % 4];
+}
+
+static double run(void (*fn)(uint8_t *, size_t, const uint8_t *), uint8_t *buf, size_t len,
+                  const uint8_t key[4])
+{
+    size_t rounds = BYTES_PER_SIZE / len;
+    uint64_t start = now_ns();
+    for (size_t r = 0; r < rounds; r++)
+        fn(buf, len, key);
+    uint64_t elapsed = now_ns() - start;
+    return (double)rounds * len / elapsed; // bytes per ns == GB/s
+}
+
+int main(void)
+{
+    static const size_t sizes[] = {10, 125, 1024, 16384, 262144, 2097152};
+    const uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+    uint8_t *raw = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1] + 16);
+    uint8_t *ref = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    if (!raw || !ref)
+    {
+        perror("malloc()");
+        return 1;
+    }
+    uint8_t *buf = raw + 1;
+
+    printf("%-10s %14s %14s %8s\n", "bytes", "bytewise GB/s", "word GB/s", "speedup");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        size_t len = sizes[s];
+        for (size_t i = 0; i < len; i++)
+            buf[i] = ref[i] = (uint8_t)(i * 131 + 7);
+
+        // Both must produce the same bytes
+        mask_bytewise(ref, len, key);
+        ws_mask_payload(buf, len, key);
+        if (memcmp(ref, buf, len) != 0)
+        {
+            fprintf(stderr, "ws_mask_payload() differs from the reference at %zu bytes\n", len);
+            return 1;
+        }
+
+        double before = run(mask_bytewise, buf, len, key);
+        double after = run(ws_mask_payload, buf, len, key);
+        printf("%-10zu %14.2f %14.2f %7.1fx\n", len, before, after, after / before);
+    }
+    free(raw);
+    free(ref);
+    return 0;
+}
@@ -0,0 +1,321 @@
+// Protocol microbenchmark for simple_ws, the library shared with
+// rtsp2ws-master: frame parsing, frame creation and unmasking from 16 B to
+// 2 MB, the upgrade handshake with real browser requests, and the SHA-1 and
+// base64 steps of the accept key.
+//
+// Each case runs WARMUP_SAMPLES untimed batches and then SAMPLES timed
+// ones; a batch is enough calls to cover BATCH_BYTES (at least one).
+// ns/op is the mean over all samples, p50/p99 are per-sample means, and
+// GB/s is input bytes over the mean. The process is pinned to one CPU
+// so that runs are comparable.
+//
+// Build and run with `make bench`.
+#define _GNU_SOURCE // sched_setaffinity
+#include "websocket.h"
+#include "wshandshake.h"
+#include "sha1.h"
+#include "base64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#define SAMPLES 1000
+#define WARMUP_SAMPLES 100
+#define BATCH_BYTES 65536   // Work per timed batch for sized cases
+#define FIXED_BATCH 64      // Calls per batch for handshake, SHA-1, base64
+#define MAX_PAYLOAD 2097152 // A large video keyframe
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct
+{
+    const char *name;
+    size_t bytes;                   // Input per call, 0 if not meaningful
+    size_t batch;                   // Calls per timed sample
+    void (*prepare)(void *ctx);     // Untimed, before every batch; may be NULL
+    void (*op)(void *ctx, size_t i); // One call; i counts within the batch
+    void *ctx;
+} bench_case;
+
+static void run(const bench_case *c)
+{
+    static double samples[SAMPLES];
+    double total = 0;
+    for (int s = -WARMUP_SAMPLES; s < SAMPLES; s++)
+    {
+        if (c->prepare)
+            c->prepare(c->ctx);
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < c->batch; i++)
+            c->op(c->ctx, i);
+        double per_op = (double)(now_ns() - start) / c->batch;
+        if (s >= 0)
+        {
+            samples[s] = per_op;
+            total += per_op;
+        }
+    }
+    double mean = total / SAMPLES;
+    qsort(samples, SAMPLES, sizeof(samples[0]), cmp_double);
+    printf("%-18s %9zu %11.1f %11.1f %11.1f", c->name, c->bytes, mean,
+           samples[SAMPLES / 2], samples[SAMPLES * 99 / 100]);
+    if (c->bytes)
+        printf(" %9.2f\n", c->bytes / mean); // bytes per ns == GB/s
+    else
+        printf(" %9s\n", "-");
+}
+
+static size_t batch_for(size_t bytes)
+{
+    return bytes >= BATCH_BYTES ? 1 : BATCH_BYTES / bytes;
+}
+
+/*-------------------- Frames --------------------*/
+typedef struct
+{
+    uint8_t *frame;   // Masked client frame for parsing
+    size_t frame_len;
+    uint8_t *payload; // Source for creation and unmasking
+    size_t len;
+    uint8_t *out;
+} frame_ctx;
+
+static const uint8_t mask_key[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+// Parsing unmasks in place, so repeated calls alternate between masked and
+// plain payloads; the cost is the same either way.
+static void op_parse(void *data, size_t i)
+{
+    frame_ctx *f = data;
+    ws_frame frame;
+    (void)i;
+    ws_parse_frame(&frame, f->frame, f->frame_len);
+}
+
+static void op_create(void *data, size_t i)
+{
+    frame_ctx *f = data;
+    ws_frame frame = {.type = WS_BINARY_FRAME, .payload = f->payload, .payload_length = f->len};
+    size_t out_len;
+    (void)i;
+    ws_create_frame(&frame, f->out, &out_len);
+}
+
+static void op_unmask(void *data, size_t i)
+{
+    frame_ctx *f = data;
+    (void)i;
+    ws_mask_payload(f->payload, f->len, mask_key);
+}
+
+static int frame_ctx_init(frame_ctx *f, size_t len)
+{
+    f->len = len;
+    f->payload = malloc(len);
+    f->frame = malloc(WS_MAX_HEADER_LEN + len);
+    f->out = malloc(WS_MAX_HEADER_LEN + len);
+    if (!f->payload || !f->frame || !f->out)
+        return -1;
+    for (size_t i = 0; i < len; i++)
+        f->payload[i] = (uint8_t)(i * 131 + 7);
+    ws_frame frame = {.type = WS_BINARY_FRAME, .payload = f->payload, .payload_length = len};
+    ws_create_masked_frame(&frame, mask_key, f->frame, &f->frame_len);
+
+    ws_frame check;
+    memset(&check, 0, sizeof(check));
+    ws_parse_frame(&check, f->frame, f->frame_len);
+    if (check.type != WS_BINARY_FRAME || check.payload_length != len ||
+        memcmp(check.payload, f->payload, len) != 0)
+    {
+        fprintf(stderr, "ws_parse_frame() did not round-trip %zu bytes\n", len);
+        return -1;
+    }
+    return 0;
+}
+
+static void frame_ctx_free(frame_ctx *f)
+{
+    free(f->payload);
+    free(f->frame);
+    free(f->out);
+}
+
+/*-------------------- Handshake --------------------*/
+static const char chrome_request[] =
+    "GET /?backfill=30 HTTP/1.1\r\n"
+    "Host: 192.168.88.243:8001\r\n"
+    "Connection: Upgrade\r\n"
+    "Pragma: no-cache\r\n"
+    "Cache-Control: no-cache\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/126.0.0.0 Safari/537.36\r\n"
+    "Upgrade: websocket\r\n"
+    "Origin: http://192.168.88.243:3000\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n"
+    "\r\n";
+
+static const char firefox_request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: 192.168.88.243:8001\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:127.0) Gecko/20100101 Firefox/127.0\r\n"
+    "Accept: */*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "Origin: http://192.168.88.243:3000\r\n"
+    "Sec-WebSocket-Extensions: permessage-deflate\r\n"
+    "Sec-WebSocket-Key: x3JJHMbDL1EzLkh9GBhXDw==\r\n"
+    "Connection: keep-alive, Upgrade\r\n"
+    "Pragma: no-cache\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Upgrade: websocket\r\n"
+    "\r\n";
+
+#define HANDSHAKE_BUF 4096
+
+typedef struct
+{
+    const char *request;
+    size_t len;
+    uint8_t bufs[FIXED_BATCH][HANDSHAKE_BUF]; // The response overwrites the request
+} handshake_ctx;
+
+static void prepare_handshake(void *data)
+{
+    handshake_ctx *h = data;
+    for (int i = 0; i < FIXED_BATCH; i++)
+        memcpy(h->bufs[i], h->request, h->len);
+}
+
+static void op_handshake(void *data, size_t i)
+{
+    handshake_ctx *h = data;
+    http_header header;
+    memset(&header, 0, sizeof(header));
+    header.extensions = WS_EXT_DEFLATE;
+    size_t scanned = 0;
+    size_t out_len = HANDSHAKE_BUF;
+    ws_handshake(&header, &scanned, h->bufs[i], h->len, &out_len);
+}
+
+static int handshake_check(handshake_ctx *h)
+{
+    prepare_handshake(h);
+    http_header header;
+    memset(&header, 0, sizeof(header));
+    header.extensions = WS_EXT_DEFLATE;
+    size_t scanned = 0;
+    size_t out_len = HANDSHAKE_BUF;
+    ws_handshake(&header, &scanned, h->bufs[0], h->len, &out_len);
+    if (header.type != WS_OPENING_FRAME || memcmp(h->bufs[0], "HTTP/1.1 101", 12) != 0)
+    {
+        fprintf(stderr, "ws_handshake() rejected a browser request\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*-------------------- Accept key --------------------*/
+typedef struct
+{
+    char key_magic[64]; // Sec-WebSocket-Key followed by the RFC 6455 GUID
+    int key_magic_len;
+    uint8_t hash[SHA1HashSize];
+    char encoded[32];
+} accept_ctx;
+
+static void op_sha1(void *data, size_t i)
+{
+    accept_ctx *a = data;
+    (void)i;
+    SHA1(a->hash, a->key_magic, a->key_magic_len);
+}
+
+static void op_base64(void *data, size_t i)
+{
+    accept_ctx *a = data;
+    size_t out_len = sizeof(a->encoded);
+    (void)i;
+    base64_encode(a->hash, SHA1HashSize, a->encoded, &out_len);
+}
+
+int main(void)
+{
+    static const size_t sizes[] = {16, 125, 1024, 16384, 262144, MAX_PAYLOAD};
+    const size_t nsizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(0, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+        perror("sched_setaffinity() (results may be noisier)");
+
+    printf("%-18s %9s %11s %11s %11s %9s\n", "case", "bytes", "ns/op", "p50 ns", "p99 ns", "GB/s");
+
+    static const struct
+    {
+        const char *name;
+        void (*op)(void *, size_t);
+    } frame_ops[] = {
+        {"ws_parse_frame", op_parse},
+        {"ws_create_frame", op_create},
+        {"ws_mask_payload", op_unmask},
+    };
+    for (size_t o = 0; o < sizeof(frame_ops) / sizeof(frame_ops[0]); o++)
+    {
+        for (size_t s = 0; s < nsizes; s++)
+        {
+            frame_ctx f;
+            memset(&f, 0, sizeof(f));
+            if (frame_ctx_init(&f, sizes[s]) < 0)
+            {
+                frame_ctx_free(&f);
+                return 1;
+            }
+            bench_case c = {frame_ops[o].name, sizes[s], batch_for(sizes[s]), NULL, frame_ops[o].op, &f};
+            run(&c);
+            frame_ctx_free(&f);
+        }
+    }
+
+    static handshake_ctx chrome, firefox;
+    chrome.request = chrome_request;
+    chrome.len = sizeof(chrome_request) - 1;
+    firefox.request = firefox_request;
+    firefox.len = sizeof(firefox_request) - 1;
+    if (handshake_check(&chrome) < 0 || handshake_check(&firefox) < 0)
+        return 1;
+    bench_case chrome_case = {"handshake/chrome", chrome.len, FIXED_BATCH, prepare_handshake, op_handshake, &chrome};
+    bench_case firefox_case = {"handshake/firefox", firefox.len, FIXED_BATCH, prepare_handshake, op_handshake, &firefox};
+    run(&chrome_case);
+    run(&firefox_case);
+
+    accept_ctx a;
+    memset(&a, 0, sizeof(a));
+    a.key_magic_len = snprintf(a.key_magic, sizeof(a.key_magic), "%s%s",
+                               "dGhlIHNhbXBsZSBub25jZQ==", WS_MAGIC);
+    bench_case sha1_case = {"SHA1", (size_t)a.key_magic_len, FIXED_BATCH, NULL, op_sha1, &a};
+    bench_case base64_case = {"base64_encode", SHA1HashSize, FIXED_BATCH, NULL, op_base64, &a};
+    run(&sha1_case);
+    run(&base64_case);
+    return 0;
+}
@@ -0,0 +1,352 @@
+// TLS termination benchmark: a stream of video-sized frames delivered to a
+// TLS client over loopback along three paths.
+//
+//   ktls   ground_station terminating TLS itself through wstls: OpenSSL
+//          runs the handshake, the kernel encrypts, frames go out with
+//          plain send() exactly as the fanout paths write them
+//   ssl    the same process encrypting in userspace with SSL_write()
+//   proxy  the nginx deployment: frames go out in plaintext to a proxy
+//          thread that recv()s them and SSL_write()s them to the client
+//
+// The client decrypts with SSL_read() in every case. Times run from the
+// first frame to the client having read the last byte; CPU is user+system
+// time of the whole process (server, proxy and client) per MB delivered.
+// The ktls rows are skipped when the kernel has no "tls" ULP.
+//
+// Build and run with `make bench`.
+#include "wstls.h" // Not websocket.h: its SHA1() clashes with OpenSSL's
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+
+#define STREAM_BYTES (256u * 1024 * 1024) // Delivered per case
+#define WARMUP_BYTES (16u * 1024 * 1024)
+#define PROXY_BUF 16384 // nginx proxy_buffer_size default on 64-bit is 8k-16k
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t cpu_ns(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ((uint64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ull +
+           ((uint64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ull;
+}
+
+// One connected loopback pair of blocking sockets.
+static int open_pair(int *server, int *client)
+{
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    *server = *client = -1;
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0 ||
+        getsockname(lfd, (struct sockaddr *)&addr, &alen) < 0)
+    {
+        perror("listen()");
+        if (lfd >= 0)
+            close(lfd);
+        return -1;
+    }
+    *client = socket(AF_INET, SOCK_STREAM, 0);
+    if (*client < 0 || connect(*client, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        (*server = accept(lfd, NULL, NULL)) < 0)
+    {
+        perror("connect()");
+        if (*client >= 0)
+            close(*client);
+        close(lfd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(*server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    close(lfd);
+    return 0;
+}
+
+/*-------------------- Certificate --------------------*/
+// A throwaway self-signed P-256 certificate, written to temporary PEM files
+// so that the ktls case goes through ws_tls_server_ctx() unchanged.
+static char cert_path[] = "/tmp/tls_bench_cert_XXXXXX";
+static char key_path[] = "/tmp/tls_bench_key_XXXXXX";
+
+static int write_pem(char *path, EVP_PKEY *pkey, X509 *x509)
+{
+    int fd = mkstemp(path);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f)
+    {
+        perror("mkstemp()");
+        return -1;
+    }
+    int ok = x509 ? PEM_write_X509(f, x509) : PEM_write_PrivateKey(f, pkey, NULL, NULL, 0, NULL, NULL);
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+static int make_certificate(void)
+{
+    EVP_PKEY *pkey = EVP_EC_gen("P-256");
+    X509 *x509 = X509_new();
+    int ret = -1;
+    if (pkey && x509)
+    {
+        ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+        X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+        X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+        X509_set_pubkey(x509, pkey);
+        X509_NAME *name = X509_get_subject_name(x509);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+        X509_set_issuer_name(x509, name);
+        if (X509_sign(x509, pkey, EVP_sha256()) > 0 &&
+            write_pem(cert_path, NULL, x509) == 0 && write_pem(key_path, pkey, NULL) == 0)
+            ret = 0;
+    }
+    if (ret < 0)
+        fprintf(stderr, "Could not create a test certificate\n");
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+    return ret;
+}
+
+/*-------------------- TLS endpoints --------------------*/
+// Userspace server context with the same suites as wstls, minus kTLS.
+static SSL_CTX *userspace_server_ctx(void)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+        return NULL;
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_num_tickets(ctx, 0);
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_path) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key_path, SSL_FILETYPE_PEM) != 1)
+    {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static SSL_CTX *client_ctx;
+
+typedef struct
+{
+    int fd;
+    size_t expect; // Bytes to read before returning
+    int ok;
+} client_arg;
+
+// Browser stand-in: handshake, then decrypt until everything has arrived.
+static void *client_thread(void *data)
+{
+    client_arg *c = data;
+    static __thread uint8_t buf[65536];
+    SSL *ssl = SSL_new(client_ctx);
+    SSL_set_fd(ssl, c->fd);
+    if (SSL_connect(ssl) == 1)
+    {
+        size_t got = 0;
+        while (got < c->expect)
+        {
+            int n = SSL_read(ssl, buf, sizeof(buf));
+            if (n <= 0)
+                break;
+            got += (size_t)n;
+        }
+        c->ok = got == c->expect;
+    }
+    SSL_free(ssl);
+    return NULL;
+}
+
+typedef struct
+{
+    SSL_CTX *ctx;
+    int tls_fd;      // Towards the client
+    int upstream_fd; // Plaintext from the server
+    int ok;
+} proxy_arg;
+
+// nginx stand-in: terminate TLS for the client and relay the upstream
+// plaintext through a fixed buffer, one SSL_write() per recv().
+static void *proxy_thread(void *data)
+{
+    proxy_arg *p = data;
+    uint8_t buf[PROXY_BUF];
+    SSL *ssl = SSL_new(p->ctx);
+    SSL_set_fd(ssl, p->tls_fd);
+    if (SSL_accept(ssl) == 1)
+    {
+        p->ok = 1;
+        ssize_t n;
+        while ((n = recv(p->upstream_fd, buf, sizeof(buf), 0)) > 0)
+        {
+            if (SSL_write(ssl, buf, (int)n) != n)
+            {
+                p->ok = 0;
+                break;
+            }
+        }
+    }
+    SSL_free(ssl);
+    return NULL;
+}
+
+/*-------------------- Cases --------------------*/
+typedef enum
+{
+    PATH_KTLS,
+    PATH_SSL,
+    PATH_PROXY
+} bench_path;
+
+static const char *path_names[] = {"ktls", "ssl", "proxy"};
+
+static struct ssl_ctx_st *ktls_ctx;
+static SSL_CTX *ssl_ctx;
+
+// Streams total bytes of frame_len-byte frames down one path and prints a
+// row unless quiet (warm-up). Returns -1 if the path failed.
+static int run(bench_path path, const uint8_t *frame, size_t frame_len, size_t total, int quiet)
+{
+    size_t frames = total / frame_len;
+    int srv, cli, up_w = -1, up_r = -1;
+    if (open_pair(&srv, &cli) < 0)
+        return -1;
+    if (path == PATH_PROXY && open_pair(&up_w, &up_r) < 0)
+        return -1;
+
+    client_arg c = {cli, frames * frame_len, 0};
+    proxy_arg p = {ssl_ctx, srv, up_r, 0};
+    pthread_t client_tid, proxy_tid;
+    pthread_create(&client_tid, NULL, client_thread, &c);
+
+    ws_tls tls = {NULL, WS_TLS_NONE};
+    SSL *ssl = NULL;
+    int ok = 1;
+    if (path == PATH_KTLS)
+        ok = ws_tls_accept(&tls, ktls_ctx, srv) == 0 && ws_tls_handshake(&tls) == 1;
+    else if (path == PATH_SSL)
+    {
+        ssl = SSL_new(ssl_ctx);
+        SSL_set_fd(ssl, srv);
+        ok = SSL_accept(ssl) == 1;
+    }
+    else
+        pthread_create(&proxy_tid, NULL, proxy_thread, &p);
+
+    uint64_t start = now_ns(), cpu_start = cpu_ns();
+    for (size_t i = 0; ok && i < frames; i++)
+    {
+        if (path == PATH_SSL)
+            ok = SSL_write(ssl, frame, (int)frame_len) == (int)frame_len;
+        else
+            ok = send(path == PATH_PROXY ? up_w : srv, frame, frame_len, MSG_NOSIGNAL) == (ssize_t)frame_len;
+    }
+    if (path == PATH_PROXY)
+    {
+        shutdown(up_w, SHUT_WR);
+        pthread_join(proxy_tid, NULL);
+        ok = ok && p.ok;
+    }
+    else if (!ok)
+    {
+        shutdown(srv, SHUT_RDWR); // Unblock the client
+    }
+    pthread_join(client_tid, NULL);
+    uint64_t elapsed = now_ns() - start, cpu = cpu_ns() - cpu_start;
+    ok = ok && c.ok;
+
+    ws_tls_close(&tls);
+    SSL_free(ssl);
+    close(srv);
+    close(cli);
+    if (up_w >= 0)
+    {
+        close(up_w);
+        close(up_r);
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "%s: stream of %zu-byte frames failed\n", path_names[path], frame_len);
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    if (!quiet)
+    {
+        double mb = (double)(frames * frame_len) / (1024 * 1024);
+        printf("%-6s %9zu %11.1f %9.2f %11.1f\n", path_names[path], frame_len,
+               (double)elapsed / frames, mb / (elapsed / 1e9) / 1024, cpu / 1e6 / mb);
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const size_t sizes[] = {1024, 16384, 65536, 262144}; // Sensor tick to keyframe
+    if (make_certificate() < 0)
+        return 1;
+
+    client_ctx = SSL_CTX_new(TLS_client_method());
+    ssl_ctx = userspace_server_ctx();
+    if (!client_ctx || !ssl_ctx)
+    {
+        ERR_print_errors_fp(stderr);
+        return 1;
+    }
+    SSL_CTX_set_verify(client_ctx, SSL_VERIFY_NONE, NULL);
+
+    ktls_ctx = ws_tls_server_ctx(cert_path, key_path);
+    if (!ktls_ctx)
+        printf("kTLS unavailable, skipping the ktls rows\n");
+
+    printf("%-6s %9s %11s %9s %11s\n", "path", "frame", "ns/frame", "GB/s", "cpu ms/MB");
+    int ret = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && ret == 0; s++)
+    {
+        uint8_t *frame = malloc(sizes[s]);
+        if (!frame)
+            return 1;
+        memset(frame, 0xa5, sizes[s]);
+        for (int path = PATH_KTLS; path <= PATH_PROXY && ret == 0; path++)
+        {
+            if (path == PATH_KTLS && !ktls_ctx)
+                continue;
+            if (run(path, frame, sizes[s], WARMUP_BYTES, 1) < 0 ||
+                run(path, frame, sizes[s], STREAM_BYTES, 0) < 0)
+                ret = 1;
+        }
+        free(frame);
+    }
+
+    ws_tls_ctx_free(ktls_ctx);
+    SSL_CTX_free(ssl_ctx);
+    SSL_CTX_free(client_ctx);
+    unlink(cert_path);
+    unlink(key_path);
+    return ret;
+}
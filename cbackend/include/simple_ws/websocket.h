@@ -8,6 +8,7 @@ extern "C"
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include "base64.h"
 #include "sha1.h"
@@ -15,6 +16,7 @@ extern "C"
 #define WS_VERSION 13
 #define WS_WEBSOCK "websocket"
 #define WS_MAGIC "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_MAX_HEADER_LEN 14 /* 2 + 8 extended length + 4 mask */
 
 /* WebSocket Frame Types */
 typedef enum
@@ -54,7 +56,11 @@ typedef struct
 
 /* WebSocket Functions */
 void ws_parse_frame(ws_frame *frame, uint8_t *data, size_t len);
+size_t ws_frame_header(wsFrameType type, int rsv1, size_t payload_len, uint8_t *out);
+ssize_t ws_send_frame(int fd, wsFrameType type, const void *payload, size_t len, int flags);
 void ws_create_frame(ws_frame *frame, uint8_t *out_data, size_t *out_len);
+void ws_create_masked_frame(ws_frame *frame, const uint8_t key[4], uint8_t *out_data, size_t *out_len);
+void ws_mask_payload(uint8_t *data, size_t len, const uint8_t key[4]);
 void ws_create_closing_frame(uint8_t *out_data, size_t *out_len);
 void ws_create_text_frame(const char *text, uint8_t *out_data, size_t *out_len);
 void ws_create_binary_frame(const uint8_t *data, size_t datalen, uint8_t *out_data, size_t *out_len);
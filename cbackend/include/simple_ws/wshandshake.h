@@ -15,6 +15,10 @@ extern "C"
 #define WS_HDR_HST "Host"
 #define WS_HDR_UPG "Upgrade"
 #define WS_HDR_CON "Connection"
+#define WS_HDR_EXT "Sec-WebSocket-Extensions"
+
+/* Extension bits for http_header.extensions */
+#define WS_EXT_DEFLATE 0x01 // RFC 7692 permessage-deflate, no context takeover
 
 typedef struct
 {
@@ -24,10 +28,12 @@ typedef struct
     uint8_t version;   // WebSocket version
     uint8_t upgrade;   // Upgrade header flag
     uint8_t websocket; // WebSocket flag
+    uint8_t extensions; // In: extensions the server accepts, out: negotiated
     wsFrameType type;  // Frame type
 } http_header;
 
-int ws_handshake(http_header *header, uint8_t *in_buf, size_t in_len, size_t *out_len);
+size_t ws_http_request_end(const uint8_t *buf, size_t len, size_t *scanned);
+int ws_handshake(http_header *header, size_t *scanned, uint8_t *in_buf, size_t in_len, size_t *out_len);
 
 #ifdef __cplusplus
 }
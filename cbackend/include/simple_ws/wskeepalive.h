@@ -0,0 +1,53 @@
+#ifndef __WS_KEEPALIVE_H
+#define __WS_KEEPALIVE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Ping/pong keepalive for one connection. Each ping carries its send time,
+ * so the matching pong yields the round-trip time without extra state. */
+
+#define WS_PING_FRAME_LEN 10 /* 2-byte header + 8-byte timestamp */
+#define WS_RTT_BUCKETS 25    /* Power-of-two microsecond buckets, up to ~16 s */
+
+typedef struct
+{
+    uint64_t ping_sent_us; /* Send time of the unanswered ping, 0 if none */
+    uint32_t missed;       /* Consecutive pings that went unanswered */
+    uint32_t rtt_us;       /* Last measured round trip, 0 until the first pong */
+} ws_keepalive;
+
+/* Round-trip times from many connections; recording is lock-free. */
+typedef struct
+{
+    uint64_t buckets[WS_RTT_BUCKETS]; /* Bucket i: RTT < 2^i us */
+    uint64_t max_us;
+} ws_rtt_hist;
+
+typedef struct
+{
+    uint64_t samples;
+    uint64_t p50_us; /* Upper bounds of the buckets holding the percentiles */
+    uint64_t p90_us;
+    uint64_t p99_us;
+    uint64_t max_us;
+} ws_rtt_summary;
+
+void ws_keepalive_reset(ws_keepalive *k);
+int ws_keepalive_ping(ws_keepalive *k, uint64_t now_us, unsigned max_missed,
+                      uint8_t out[WS_PING_FRAME_LEN]);
+int64_t ws_keepalive_pong(ws_keepalive *k, const uint8_t *payload, size_t len, uint64_t now_us);
+
+void ws_rtt_record(ws_rtt_hist *h, uint64_t rtt_us);
+void ws_rtt_take(ws_rtt_hist *h, ws_rtt_summary *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WS_KEEPALIVE_H */
@@ -0,0 +1,70 @@
+#ifndef __WS_QUEUE_H
+#define __WS_QUEUE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define WS_QUEUE_IOV_MAX 64
+
+/* ws_msg flags, for queues that shed load by dropping whole messages */
+#define WS_MSG_FRAME 0x01      /* Video frame; may be skipped, unlike control frames */
+#define WS_MSG_KEYFRAME 0x02   /* Decoding can (re)start here */
+#define WS_MSG_DISPOSABLE 0x04 /* No other frame references it */
+
+/* Reference counted, fully encoded WebSocket message. One message is shared
+ * by every client queue it is pushed to and freed with the last reference.
+ * A message from ws_msg_wrap() holds only the frame header and points at a
+ * payload owned elsewhere (e.g. a refcounted AVPacket), which is released
+ * together with the message, so large payloads are never copied. */
+typedef struct ws_msg
+{
+    int refs;               /* Atomic reference count */
+    size_t len;             /* Encoded frame length */
+    uint8_t *data;          /* Encoded frame (header + payload), or only the header */
+    const uint8_t *payload; /* External payload after the header, NULL if inline */
+    size_t payload_len;
+    void (*release)(void *owner); /* Frees the external payload */
+    void *owner;
+    uint8_t flags;          /* WS_MSG_* */
+} ws_msg;
+
+/* Per-client outbound queue: a ring of message references plus the number
+ * of bytes of the head message already written to the socket. */
+typedef struct
+{
+    ws_msg **ring;
+    uint32_t cap;        /* Ring capacity, a power of two */
+    uint32_t head;
+    uint32_t count;      /* Messages queued */
+    size_t head_off;     /* Bytes of the head message already sent */
+    size_t bytes;        /* Bytes still to send */
+    uint64_t sent_msgs;  /* Messages fully written */
+    uint64_t sent_bytes; /* Bytes written */
+} ws_queue;
+
+ws_msg *ws_msg_new(size_t len);
+ws_msg *ws_msg_wrap(const uint8_t *header, size_t header_len, const uint8_t *payload,
+                    size_t payload_len, void (*release)(void *owner), void *owner);
+int ws_msg_iov(const ws_msg *msg, size_t off, struct iovec iov[2]);
+ws_msg *ws_msg_ref(ws_msg *msg);
+void ws_msg_unref(ws_msg *msg);
+
+int ws_queue_init(ws_queue *q, uint32_t cap);
+void ws_queue_free(ws_queue *q);
+int ws_queue_push(ws_queue *q, ws_msg *msg);
+uint32_t ws_queue_trim(ws_queue *q);
+uint32_t ws_queue_drop(ws_queue *q, uint8_t flags);
+void ws_queue_consume(ws_queue *q, size_t written);
+int ws_queue_flush(ws_queue *q, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WS_QUEUE_H */
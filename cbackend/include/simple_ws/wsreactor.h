@@ -0,0 +1,84 @@
+#ifndef __WS_REACTOR_H
+#define __WS_REACTOR_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/epoll.h> /* EPOLL* event flags for ws_reactor_add() */
+
+/* Single-threaded epoll event loop shared by the servers. Every registered
+ * fd carries a ws_handler in epoll_event.data.ptr, never a bare fd, so one
+ * dispatch path serves sockets, timers, signals and wakeups alike. */
+
+typedef void (*ws_io_fn)(void *data, uint32_t events);
+typedef void (*ws_timer_fn)(void *data, uint64_t expirations);
+typedef void (*ws_signal_fn)(void *data, int signo);
+typedef void (*ws_wake_fn)(void *data);
+
+/* What to call when a registered fd is ready. Must stay at the same
+ * address while registered; embed it in the object that owns the fd. */
+typedef struct
+{
+    ws_io_fn fn;
+    void *data;
+} ws_handler;
+
+typedef struct
+{
+    int epoll_fd;
+    int wake_fd;         /* eventfd behind ws_reactor_wake() and ws_reactor_stop() */
+    ws_handler wake;
+    ws_wake_fn on_wake;  /* Called on the loop thread after a wakeup, may be NULL */
+    void *wake_data;
+    int stop;            /* Set by ws_reactor_stop(), read atomically */
+} ws_reactor;
+
+/* timerfd-backed timer; first_ms after start (0 to leave it disarmed),
+ * then every interval_ms (0 for one-shot). */
+typedef struct
+{
+    int fd;              /* -1 when not running */
+    ws_handler h;
+    ws_timer_fn fn;
+    void *data;
+} ws_timer;
+
+/* signalfd for a set of signals, which are blocked in the calling thread.
+ * Start it before creating threads so they inherit the mask. */
+typedef struct
+{
+    int fd;
+    ws_handler h;
+    ws_signal_fn fn;
+    void *data;
+} ws_signals;
+
+int ws_reactor_init(ws_reactor *r, ws_wake_fn on_wake, void *data);
+void ws_reactor_free(ws_reactor *r);
+int ws_reactor_add(ws_reactor *r, int fd, uint32_t events, ws_handler *h);
+int ws_reactor_mod(ws_reactor *r, int fd, uint32_t events, ws_handler *h);
+void ws_reactor_del(ws_reactor *r, int fd);
+int ws_reactor_poll(ws_reactor *r, int timeout_ms);
+int ws_reactor_run(ws_reactor *r);
+void ws_reactor_wake(ws_reactor *r);
+void ws_reactor_stop(ws_reactor *r);
+int ws_reactor_stopped(ws_reactor *r);
+
+int ws_timer_start(ws_reactor *r, ws_timer *t, unsigned first_ms, unsigned interval_ms,
+                   ws_timer_fn fn, void *data);
+int ws_timer_set(ws_timer *t, unsigned first_ms, unsigned interval_ms);
+void ws_timer_stop(ws_reactor *r, ws_timer *t);
+
+int ws_signals_start(ws_reactor *r, ws_signals *s, const sigset_t *mask,
+                     ws_signal_fn fn, void *data);
+void ws_signals_stop(ws_reactor *r, ws_signals *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WS_REACTOR_H */
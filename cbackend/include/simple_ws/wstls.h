@@ -0,0 +1,46 @@
+#ifndef __WS_TLS_H
+#define __WS_TLS_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* In-process TLS termination with kernel TLS offload. OpenSSL runs the
+ * handshake; afterwards the session keys are handed to the kernel
+ * (SSL_OP_ENABLE_KTLS), so every plain send()/writev()/sendmsg() on the
+ * socket is encrypted by the kernel and the fanout paths stay unchanged.
+ * Connections whose transmit side could not be offloaded are refused, and
+ * ws_tls_server_ctx() fails up front when the kernel has no "tls" ULP.
+ * Reads go through SSL_read(), which uses kTLS receive when OpenSSL set it
+ * up; clients only send the upgrade request and control frames. */
+
+struct ssl_st;
+struct ssl_ctx_st;
+
+#define WS_TLS_NONE 0      /* Plain TCP */
+#define WS_TLS_HANDSHAKE 1 /* TLS handshake in progress */
+#define WS_TLS_OPEN 2      /* Handshake done, kTLS transmit active */
+
+typedef struct
+{
+    struct ssl_st *ssl;
+    uint8_t state;
+} ws_tls;
+
+struct ssl_ctx_st *ws_tls_server_ctx(const char *cert_file, const char *key_file);
+void ws_tls_ctx_free(struct ssl_ctx_st *ctx);
+int ws_tls_accept(ws_tls *t, struct ssl_ctx_st *ctx, int fd);
+int ws_tls_handshake(ws_tls *t);
+ssize_t ws_tls_recv(ws_tls *t, int fd, void *buf, size_t len);
+void ws_tls_close(ws_tls *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WS_TLS_H */
@@ -0,0 +1,51 @@
+#ifndef __WS_URING_H
+#define __WS_URING_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+
+struct msghdr;
+
+/* Minimal io_uring submission/completion ring for batched socket sends,
+ * driven through the raw syscalls so it needs no liburing. Only built when
+ * WS_IO_URING is defined; callers keep their plain send path as fallback
+ * for kernels where io_uring_setup() fails. */
+typedef struct
+{
+    int fd;              /* Ring fd, -1 when not set up */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;       /* Same mapping as sq_ring with IORING_FEAT_SINGLE_MMAP */
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned pending;    /* Prepared, not yet submitted */
+    unsigned inflight;   /* Submitted, completion not yet reaped */
+    unsigned long long enters; /* io_uring_enter() calls made */
+} ws_uring;
+
+int ws_uring_init(ws_uring *r, unsigned entries);
+void ws_uring_free(ws_uring *r);
+int ws_uring_prep_send(ws_uring *r, int fd, const void *buf, size_t len, int flags, void *data);
+int ws_uring_prep_sendmsg(ws_uring *r, int fd, const struct msghdr *msg, int flags, void *data);
+int ws_uring_submit_wait(ws_uring *r);
+int ws_uring_next_cqe(ws_uring *r, void **data, int *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WS_URING_H */
@@ -0,0 +1,82 @@
+#ifndef __WS_VIDEO_H
+#define __WS_VIDEO_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wsqueue.h"
+
+/* Video relay on top of ws_queue: WS_MSG_* flags for Annex B frames, a
+ * camera's GOP cache for viewers that join mid-stream, and the lag policy
+ * that makes a slow viewer lose whole frames rather than parts of one.
+ * Codecs are passed as ws_codec, so this does not depend on FFmpeg. */
+
+#define WS_GOP_CACHE_FRAMES 150              /* Frames kept from the last keyframe on */
+#define WS_GOP_CACHE_BYTES (4 * 1024 * 1024) /* Longer GOPs are not cached */
+
+typedef enum
+{
+    WS_CODEC_OTHER, /* Frames are never marked disposable from their NAL headers */
+    WS_CODEC_H264,
+    WS_CODEC_HEVC
+} ws_codec;
+
+/* What a new viewer gets from the GOP cache */
+typedef enum
+{
+    WS_GOP_BURST_ALL, /* "all": the keyframe and every frame since */
+    WS_GOP_BURST_REF, /* "ref": skip non-reference frames, to reach live sooner */
+    WS_GOP_BURST_OFF  /* "off": wait for the next keyframe */
+} ws_gop_burst;
+
+/* A camera's codec configuration and its last keyframe with the frames
+ * after it. The GOP is empty until a keyframe arrives, and again after a
+ * GOP outgrows the cache. */
+typedef struct
+{
+    ws_msg *config;
+    ws_msg *gop[WS_GOP_CACHE_FRAMES];
+    int gop_count;
+    size_t gop_bytes;
+} ws_gop_cache;
+
+/* Where a viewer starts losing frames */
+typedef struct
+{
+    uint32_t disposable_frames; /* Queued frames at which non-reference frames are dropped */
+    uint32_t skip_frames;       /* Queued frames at which it skips to the next keyframe */
+    size_t high_bytes;          /* Queued bytes that also trigger a skip */
+} ws_lag_limits;
+
+/* A viewer's lag state, next to its queue */
+typedef struct
+{
+    uint64_t dropped;  /* Frames skipped */
+    uint64_t join_end; /* Queue's sent_msgs once the join burst is out */
+    uint32_t skips;    /* Times it skipped to a keyframe */
+    uint32_t peak_lag; /* Most frames queued at once */
+    bool skipping;     /* Fell too far behind, waiting for a keyframe */
+} ws_viewer;
+
+uint8_t ws_frame_flags(ws_codec codec, bool keyframe, bool disposable, const uint8_t *data,
+                       size_t size);
+int ws_gop_burst_parse(const char *name);
+
+void ws_gop_cache_add(ws_gop_cache *c, ws_msg *msg);
+void ws_gop_cache_free(ws_gop_cache *c);
+
+void ws_viewer_reset(ws_viewer *v);
+int ws_viewer_join(ws_viewer *v, ws_queue *q, const ws_gop_cache *c, ws_gop_burst burst);
+int ws_viewer_queue(ws_viewer *v, ws_queue *q, ws_msg *msg, const ws_lag_limits *limits, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WS_VIDEO_H */
@@ -0,0 +1,58 @@
+#ifndef __WS_WHEEL_H
+#define __WS_WHEEL_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+#include "wsreactor.h"
+
+/* Hierarchical timing wheel for per-connection deadlines (handshake
+ * timeouts, keepalives, idle eviction). Deadlines are intrusive list nodes
+ * embedded in their owner, so scheduling, rescheduling and cancelling are
+ * O(1) and never allocate. One timerfd on the owning ws_reactor ticks the
+ * wheel, and only while something is scheduled. */
+
+#define WS_WHEEL_BITS 6
+#define WS_WHEEL_SLOTS (1 << WS_WHEEL_BITS)
+#define WS_WHEEL_LEVELS 4 /* Range: 64^4 ticks */
+
+typedef void (*ws_deadline_fn)(void *data);
+
+typedef struct ws_deadline
+{
+    struct ws_deadline *next;
+    struct ws_deadline **pprev; /* NULL when not scheduled */
+    uint64_t expires;           /* Wheel tick it fires on */
+    ws_deadline_fn fn;
+    void *data;
+} ws_deadline;
+
+typedef struct
+{
+    ws_timer tick;
+    unsigned tick_ms;
+    uint64_t now;     /* Ticks elapsed while armed */
+    unsigned count;   /* Deadlines scheduled */
+    ws_deadline *slots[WS_WHEEL_LEVELS][WS_WHEEL_SLOTS];
+} ws_wheel;
+
+int ws_wheel_init(ws_wheel *w, ws_reactor *loop, unsigned tick_ms);
+void ws_wheel_free(ws_wheel *w, ws_reactor *loop);
+void ws_deadline_init(ws_deadline *d, ws_deadline_fn fn, void *data);
+void ws_wheel_schedule(ws_wheel *w, ws_deadline *d, unsigned delay_ms);
+void ws_wheel_cancel(ws_wheel *w, ws_deadline *d);
+
+static inline int ws_deadline_pending(const ws_deadline *d)
+{
+    return d->pprev != 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WS_WHEEL_H */
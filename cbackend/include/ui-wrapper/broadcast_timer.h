@@ -0,0 +1,20 @@
+#ifndef BROADCAST_TIMER_H
+#define BROADCAST_TIMER_H
+
+#include <stdint.h>
+#include "wsreactor.h"
+
+/* Jitter statistics for the broadcast tick, reset after every report */
+typedef struct
+{
+    uint64_t ticks;         // Ticks handled since the last report
+    uint64_t missed;        // Expirations coalesced into a single wakeup
+    uint64_t jitter_sum_us; // Sum of |actual interval - period|
+    uint64_t jitter_max_us; // Worst |actual interval - period|
+    uint64_t last_tick_ns;  // CLOCK_MONOTONIC of the previous tick
+} broadcast_stats_t;
+
+int broadcast_timer_init(ws_reactor *loop, int period_ms);
+void broadcast_timer_close(ws_reactor *loop);
+
+#endif // BROADCAST_TIMER_H
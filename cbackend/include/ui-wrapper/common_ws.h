@@ -19,12 +19,22 @@
 
 #include "wshandshake.h" // Custom WebSocket handshake functions
 #include "websocket.h"   // Custom WebSocket frame functions
+#include "wsqueue.h"     // Shared outbound message queues
+#include "wsreactor.h"   // Event loop with typed handlers
+#include "wswheel.h"     // Per-connection deadlines
+#include "wskeepalive.h" // Ping/pong round trips
+#include "wsdecoder.h"   // Streaming frame decoder
+#include "wstls.h"       // In-process TLS with kernel offload
+#include "wsvideo.h"     // GOP cache and viewer lag policy
+#include "wslog.h"       // Asynchronous leveled logging
 #include "cJSON.h"       // JSON parsing library
 #include "hiredis.h"     // Redis connectivity
 
 #define BUFFER_SIZE 4096
 #define SENSOR_BUFFER_MAX 100000
-#define MAX_CLIENTS 1024
+#define CLIENT_SLAB_CHUNK 64 // Client slots added per table growth step
+#define SENSOR_TABLE_MAX 4096 // Distinct channels kept in the latest-value table
+#define HANDSHAKE_POOL_MAX 64  // Idle handshake buffers kept for reuse
 
  /* Sensor data structure and buffer */
  typedef struct
@@ -39,27 +49,74 @@
  {
      int fd;
      bool handshake_done;
-     uint8_t buffer[BUFFER_SIZE];
+     bool deflate; // permessage-deflate negotiated
+     uint8_t *buffer;         // Pooled BUFFER_SIZE bytes, only until the handshake is done
      size_t buffer_len;
+     size_t handshake_scanned; // Bytes already searched for the end of the request
+     ws_queue outq;           // Outbound broadcast queue
+     bool degraded;           // Over the high-water mark: keyframes only
+     bool keyframe_sent;      // Recovery keyframe queued while degraded
+     uint64_t stalled_since;  // CLOCK_MONOTONIC ms when it became degraded
+     uint64_t dropped;        // Broadcasts skipped for this client
+     uint32_t degrade_count;  // Times it crossed the high-water mark
+     size_t peak_queued;      // Largest outbound backlog seen, in bytes
+     ws_viewer viewer;        // Video: lag state for outq
+     int camera;              // Video: the camera it watches, once upgraded
+     int slot;                // Slot index in the table's slab
+     int active_index;        // Position in the table's active array
+     ws_handler io;           // Reactor registration; data points back here
+     void *server;            // Reactor that owns the slot, for its handlers
+     ws_deadline deadline;    // Handshake timeout, then the keepalive ping
+     ws_keepalive keepalive;  // Outstanding ping and last round trip
+     ws_decoder *decoder;     // Inbound frames, allocated once the handshake is done
+     ws_tls tls;              // TLS session, WS_TLS_NONE for plain TCP
  } client_t;
- 
-extern pthread_mutex_t g_clients_mutex;
 
-extern client_t g_clients[MAX_CLIENTS];
-extern int epoll_fd;
+ /* Client slots with O(1) allocation and release: a stack of free slot
+  * indices plus a dense array of the clients in use, so that accept and
+  * broadcast cost scales with live clients rather than capacity.
+  * Slots live in a slab of CLIENT_SLAB_CHUNK-sized chunks added on demand
+  * up to the soft limit. Chunks are never moved or freed while the table
+  * is in use, so client pointers stay valid as epoll_event.data.ptr. */
+ typedef struct
+ {
+     client_t **chunks;  // Slot i is chunks[i / CLIENT_SLAB_CHUNK][i % CLIENT_SLAB_CHUNK]
+     int chunk_count;
+     int capacity;       // Slots allocated so far
+     int limit;          // Soft limit on clients in use
+     int *free_slots;    // Stack of unused slot indices
+     int free_count;
+     client_t **active;  // Clients in use; removal swaps in the last one
+     int active_count;
+ } client_table_t;
+ 
 extern int g_remote_fd;
 extern int g_server_fd;
 extern redisContext *redis_ctx;
+extern struct ssl_ctx_st *g_tls_ctx;
 
 extern sensor_data_t sensor_buffer[SENSOR_BUFFER_MAX];
 extern sensor_data_t latest_sensor_buffer[SENSOR_BUFFER_MAX];
 extern int latest_sensor_buffer_count;
 extern int sensor_buffer_count;
-extern uint64_t last_broadcast_time;
 
-void remove_from_epoll(int fd);
+/* Latest value of every channel seen so far, in first-seen order */
+extern sensor_data_t sensor_table[SENSOR_TABLE_MAX];
+extern int sensor_table_count;
+extern uint64_t sensor_table_version;
+
 void set_nonblocking(int fd);
 int init_frontend_server(int port);
-void handle_sigint(int sig);
+void sensor_table_update(const sensor_data_t *sd);
+int client_table_init(client_table_t *t, int limit);
+void client_table_free(client_table_t *t);
+client_t *client_table_alloc(client_table_t *t, int fd);
+void client_table_release(client_table_t *t, client_t *client);
+void send_busy_response(int fd);
+uint64_t monotonic_ms(void);
+uint64_t monotonic_us(void);
+uint8_t *handshake_buffer_get(void);
+void handshake_buffer_put(uint8_t *buf);
+int client_handshake_finished(client_t *client, ws_message_fn on_message, ws_reply_fn reply);
 
 #endif // COMMON_WS_H
\ No newline at end of file
@@ -5,4 +5,96 @@
 #define REMOTE_WS_PORT 8081
 #define FRONTEND_PORT 8001
 
+// Wait between attempts to reach the remote sensor server, and how long one
+// connect may take before it counts as failed
+#define REMOTE_RETRY_MS 1000
+#define REMOTE_CONNECT_TIMEOUT_MS 3000
+
+// Frontend broadcast tick, independent of the remote feed rate
+#define BROADCAST_PERIOD_MS 100
+#define BROADCAST_STATS_INTERVAL_MS 10000
+
+// New clients may ask for up to BACKFILL_SECONDS of history ("/?backfill=N"),
+// sampled from the latest-value table every BACKFILL_INTERVAL_MS.
+#define BACKFILL_SECONDS 60
+#define BACKFILL_INTERVAL_MS 1000
+
+// Per-client outbound high-water marks. A client over either mark only gets
+// keyframe snapshots until it drains, and is dropped if it stays stalled.
+#define CLIENT_QUEUE_HIGH_MSGS 64
+#define CLIENT_QUEUE_HIGH_BYTES (1024 * 1024)
+#define CLIENT_STALL_TIMEOUT_MS 10000
+// Caps kernel buffering so a stalled client shows up in its outbound queue
+#define CLIENT_SOCKET_SNDBUF (256 * 1024)
+// Video frames queued per viewer. Queues hold references to frames shared
+// with the streaming thread, so this bounds latency rather than memory.
+#define VIDEO_QUEUE_MSGS 256
+// A viewer this many frames behind stops getting non-reference frames...
+#define VIDEO_LAG_DISPOSABLE_FRAMES 15
+// ...and at this many, or this much queued, skips to the next keyframe.
+#define VIDEO_LAG_SKIP_FRAMES 60
+#define VIDEO_QUEUE_HIGH_BYTES (8 * 1024 * 1024)
+// New video viewers start from the last keyframe and the frames since, if
+// the GOP fits in the cache. WS_GOP_BURST_REF leaves non-reference frames
+// out of that burst to reach live sooner; WS_GOP_BURST_OFF waits for the
+// next keyframe instead. WS_GOP_BURST=all|ref|off in the environment
+// overrides it at startup, as for rtsp2ws_server.
+#define VIDEO_GOP_BURST WS_GOP_BURST_ALL
+
+// Video viewers connect to VIDEO_PORT and pick a camera by path. Cameras are
+// read at startup from VIDEO_CAMERA_FILE, one "<path> <rtsp_url>" per line,
+// so each can be turned on or off without a rebuild; WS_VIDEO_CAMERAS in the
+// environment names another file. Without the file video stays off.
+#define VIDEO_PORT 8002
+#define VIDEO_CAMERA_FILE "cameras.conf"
+#define VIDEO_MAX_CAMERAS 8
+#define VIDEO_PATH_MAX 128 // Matches http_header.uri
+#define VIDEO_URL_MAX 512
+
+// Frontend I/O threads, each with its own SO_REUSEPORT listener and clients;
+// 0 starts one per online CPU. The ingest thread encodes every broadcast once.
+#define FRONTEND_THREADS 0
+
+// Soft limits on connected clients. Connections beyond them get a
+// 503 with Retry-After (seconds) instead of a handshake.
+#define FRONTEND_CLIENT_LIMIT 8192
+#define VIDEO_CLIENT_LIMIT 1024
+#define CLIENT_RETRY_AFTER_S "5"
+
+// Pending-connection queue for the listening sockets (the kernel caps it at
+// net.core.somaxconn), and how many to accept per wakeup so a reconnect
+// storm cannot starve the sensor feed and broadcast timer.
+#define LISTEN_BACKLOG 1024
+#define ACCEPT_BATCH_MAX 64
+
+// Per-connection deadlines run on a timing wheel per I/O thread that ticks
+// every TIMER_WHEEL_TICK_MS while anything is scheduled. Connections that
+// have not completed the WebSocket handshake in time are closed.
+#define TIMER_WHEEL_TICK_MS 100
+#define HANDSHAKE_TIMEOUT_MS 5000
+
+// Upgraded clients are pinged every KEEPALIVE_INTERVAL_MS and dropped after
+// KEEPALIVE_MAX_MISSED pings in a row go unanswered. Pong round trips are
+// reported with the broadcast statistics.
+#define KEEPALIVE_INTERVAL_MS 15000
+#define KEEPALIVE_MAX_MISSED 2
+
+// Largest reassembled WebSocket message accepted from a browser client and
+// from the remote sensor server; bigger ones are refused with close 1009.
+#define CLIENT_MAX_MESSAGE 4096
+#define REMOTE_MAX_MESSAGE (1024 * 1024)
+
+// PEM certificate chain and key for terminating TLS in-process instead of
+// behind nginx; WS_TLS_CERT and WS_TLS_KEY in the environment override them.
+// With both set, handshakes hand the session keys to the kernel (kTLS) and
+// the server refuses to start if the kernel cannot take them. Empty keeps
+// plain TCP.
+#define TLS_CERT_FILE ""
+#define TLS_KEY_FILE ""
+
+// Log records at or above LOG_LEVEL are written by a background thread.
+// WS_LOG_LEVEL=debug|info|warn|error|off in the environment overrides it at
+// startup; build with LOG_LEVEL=... to compile lower levels out entirely.
+#define LOG_LEVEL WS_LOG_INFO
+
 #endif // CONFIG_H
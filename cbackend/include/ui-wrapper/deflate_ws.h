@@ -0,0 +1,15 @@
+#ifndef DEFLATE_WS_H
+#define DEFLATE_WS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Payloads smaller than this are not worth compressing
+#define WS_DEFLATE_MIN_SIZE 64
+#define WS_DEFLATE_LEVEL 6
+
+int ws_deflate_init(void);
+const uint8_t *ws_deflate_message(const uint8_t *data, size_t len, size_t *out_len);
+void ws_deflate_free(void);
+
+#endif // DEFLATE_WS_H
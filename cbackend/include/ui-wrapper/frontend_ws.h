@@ -6,8 +6,8 @@
 
 
 
-void handle_new_client();
-void close_client(client_t *client);
+int frontend_start(int port, int threads);
+void frontend_stop(void);
 void broadcast_sensor_data();
-void handle_client_read(client_t *client);
+void frontend_report_keepalive(void);
 #endif // FRONTEND_WS_H
\ No newline at end of file
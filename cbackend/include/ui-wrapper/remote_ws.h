@@ -8,6 +8,8 @@
 
 int connect_remote_ws(const char *ip, int port);
 void handle_remote_ws_read();
+int remote_ws_start(ws_reactor *loop);
+void remote_ws_stop(void);
 void set_sensor_warning(sensor_data_t *sd);
 
 // New additions
@@ -5,13 +5,11 @@
 extern "C" {
 #endif
 
-// Initialize the video streaming module with the RTSP URL.
-int rtsp_video_init(const char *rtsp_url);
+// Start a thread streaming rtsp_url to the clients of video camera
+// `camera`. The URL must stay valid until rtsp_video_stop().
+int rtsp_video_start(int camera, const char *rtsp_url);
 
-// Start the video streaming thread.
-int rtsp_video_start(void);
-
-// Stop the video streaming thread and clean up resources.
+// Stop and join every streaming thread. Blocking reads are interrupted.
 void rtsp_video_stop(void);
 
 #ifdef __cplusplus
@@ -3,11 +3,9 @@
 
 #include "common_ws.h"
 
-extern client_t *g_video_clients;
-extern pthread_mutex_t g_video_clients_mutex;
-
-int init_video_server(int port);
-void video_epoll_loop(void);
-void handle_new_video_client(void);
+int video_start(int port, const char *camera_file, ws_gop_burst gop_burst);
+void video_stop(void);
+void video_broadcast(int camera, ws_msg *msg);
+void video_report_stats(void);
 
 #endif // VIDEO_WS_H
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "websocket.h"
 
@@ -12,39 +14,116 @@
 #define HTONS(v) (v)
 #endif
 
-/* Function to create a WebSocket frame */
-void ws_create_frame(ws_frame *frame, uint8_t *out_data, size_t *out_len)
+/* 32 bytes of payload per step; GCC lowers this to AVX2 or SSE2 registers */
+typedef uint64_t ws_mask_vec __attribute__((vector_size(32)));
+
+/* XORs len bytes with the 4-byte masking key, as if the key started at
+ * data[0]. Bytes are handled one at a time only up to the first 8-byte
+ * boundary and after the last whole word; in between the key, rotated to
+ * that boundary, is broadcast across 64-bit and 256-bit words. Masking and
+ * unmasking are the same operation. */
+void ws_mask_payload(uint8_t *data, size_t len, const uint8_t key[4])
 {
-    assert(frame->type);
+    size_t i = 0;
+    size_t head = (size_t)(-(uintptr_t)data & 7);
+    if (len < head + 8)
+        head = len; /* Too short for a whole aligned word */
+    for (; i < head; i++)
+        data[i] ^= key[i & 3];
+
+    if (len - i >= 8)
+    {
+        uint8_t rotated[8];
+        for (int k = 0; k < 8; k++)
+            rotated[k] = key[(i + k) & 3];
+        uint64_t key64;
+        memcpy(&key64, rotated, sizeof(key64));
+
+        ws_mask_vec keyv = {key64, key64, key64, key64};
+        for (; len - i >= sizeof(ws_mask_vec); i += sizeof(ws_mask_vec))
+        {
+            ws_mask_vec v;
+            memcpy(&v, data + i, sizeof(v));
+            v ^= keyv;
+            memcpy(data + i, &v, sizeof(v));
+        }
+        for (; len - i >= 8; i += 8)
+        {
+            uint64_t w;
+            memcpy(&w, data + i, sizeof(w));
+            w ^= key64;
+            memcpy(data + i, &w, sizeof(w));
+        }
+    }
 
-    out_data[0] = 0x80 | frame->type;
+    for (; i < len; i++)
+        data[i] ^= key[i & 3];
+}
+
+/* Writes the 2, 4 or 10 byte header of an unmasked frame carrying
+ * payload_len bytes to out (WS_MAX_HEADER_LEN bytes always suffice) and
+ * returns its length. The payload stays where it is, so callers can
+ * writev() both or queue them as separate buffers. */
+size_t ws_frame_header(wsFrameType type, int rsv1, size_t payload_len, uint8_t *out)
+{
+    assert(type);
+
+    out[0] = 0x80 | (rsv1 ? 0x40 : 0) | type;
 
-    if (frame->payload_length <= 0x7D)
+    if (payload_len <= 0x7D)
     {
-        out_data[1] = frame->payload_length;
-        *out_len = 2;
+        out[1] = payload_len;
+        return 2;
     }
-    else if (frame->payload_length <= 0xFFFF)
+    if (payload_len <= 0xFFFF)
     {
-        out_data[1] = 0x7E;
-        out_data[2] = (frame->payload_length >> 8) & 0xFF;
-        out_data[3] = frame->payload_length & 0xFF;
-        *out_len = 4;
+        out[1] = 0x7E;
+        out[2] = (payload_len >> 8) & 0xFF;
+        out[3] = payload_len & 0xFF;
+        return 4;
     }
-    else
+    out[1] = 0x7F;
+    for (int i = 0; i < 8; i++)
     {
-        out_data[1] = 0x7F;
-        for (int i = 0; i < 8; i++)
-        {
-            out_data[2 + i] = (frame->payload_length >> (56 - i * 8)) & 0xFF;
-        }
-        *out_len = 10;
+        out[2 + i] = ((uint64_t)payload_len >> (56 - i * 8)) & 0xFF;
     }
+    return 10;
+}
 
+/* Sends header and payload with one sendmsg() and no copy of the payload.
+ * Returns the bytes sent, which may be short on a non-blocking socket. */
+ssize_t ws_send_frame(int fd, wsFrameType type, const void *payload, size_t len, int flags)
+{
+    uint8_t header[WS_MAX_HEADER_LEN];
+    struct iovec iov[2] = {
+        {.iov_base = header, .iov_len = ws_frame_header(type, 0, len, header)},
+        {.iov_base = (void *)payload, .iov_len = len},
+    };
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = len ? 2 : 1};
+    return sendmsg(fd, &msg, flags);
+}
+
+/* Function to create a WebSocket frame */
+void ws_create_frame(ws_frame *frame, uint8_t *out_data, size_t *out_len)
+{
+    *out_len = ws_frame_header(frame->type, frame->rsv1, frame->payload_length, out_data);
     memcpy(&out_data[*out_len], frame->payload, frame->payload_length);
     *out_len += frame->payload_length;
 }
 
+/* Creates a client-to-server frame, masked with key as RFC 6455 requires.
+ * The key must be unpredictable, i.e. fresh random bytes for every frame. */
+void ws_create_masked_frame(ws_frame *frame, const uint8_t key[4], uint8_t *out_data, size_t *out_len)
+{
+    size_t header_len = ws_frame_header(frame->type, frame->rsv1, frame->payload_length, out_data);
+    out_data[1] |= 0x80;
+    memcpy(&out_data[header_len], key, MASK_LEN);
+    header_len += MASK_LEN;
+    memcpy(&out_data[header_len], frame->payload, frame->payload_length);
+    ws_mask_payload(&out_data[header_len], frame->payload_length, key);
+    *out_len = header_len + frame->payload_length;
+}
+
 /* Parses the opcode and assigns frame type */
 static wsFrameType ws_parse_opcode(ws_frame *frame)
 {
@@ -74,6 +153,9 @@ void ws_parse_frame(ws_frame *frame, uint8_t *data, size_t len)
     }
 
     frame->fin = (data[0] & 0x80) != 0;
+    frame->rsv1 = (data[0] & 0x40) != 0;
+    frame->rsv2 = (data[0] & 0x20) != 0;
+    frame->rsv3 = (data[0] & 0x10) != 0;
     frame->opcode = data[0] & 0x0F;
 
     if (ws_parse_opcode(frame) == WS_ERROR_FRAME)
@@ -87,11 +169,21 @@ void ws_parse_frame(ws_frame *frame, uint8_t *data, size_t len)
 
     if (payloadLength == 0x7E)
     {
+        if (len < 4)
+        {
+            frame->type = WS_INCOMPLETE_FRAME;
+            return;
+        }
         payloadLength = (data[2] << 8) | data[3];
         headerSize += 2;
     }
     else if (payloadLength == 0x7F)
     {
+        if (len < 10)
+        {
+            frame->type = WS_INCOMPLETE_FRAME;
+            return;
+        }
         payloadLength = 0;
         for (int i = 0; i < 8; i++)
         {
@@ -105,7 +197,7 @@ void ws_parse_frame(ws_frame *frame, uint8_t *data, size_t len)
         headerSize += MASK_LEN;
     }
 
-    if (payloadLength + headerSize > len)
+    if (headerSize > len || payloadLength > len - headerSize)
     {
         frame->type = WS_INCOMPLETE_FRAME;
         return;
@@ -118,11 +210,7 @@ void ws_parse_frame(ws_frame *frame, uint8_t *data, size_t len)
     {
         uint8_t maskingKey[MASK_LEN];
         memcpy(maskingKey, &data[headerSize - MASK_LEN], MASK_LEN);
-
-        for (size_t i = 0; i < frame->payload_length; i++)
-        {
-            frame->payload[i] ^= maskingKey[i % MASK_LEN];
-        }
+        ws_mask_payload(frame->payload, frame->payload_length, maskingKey);
     }
 }
 
@@ -0,0 +1,70 @@
+#include "broadcast_timer.h"
+#include "common_ws.h"
+#include "frontend_ws.h" // for broadcast_sensor_data()
+#include "video_ws.h"    // for video_report_stats()
+
+#include <inttypes.h>
+
+static ws_timer timer = {.fd = -1};
+static uint64_t period_ns = 0;
+static broadcast_stats_t stats;
+static uint64_t last_report_ns = 0;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Print and reset the jitter statistics once per BROADCAST_STATS_INTERVAL_MS.
+static void report_stats(uint64_t now) {
+    if (now - last_report_ns < (uint64_t)BROADCAST_STATS_INTERVAL_MS * 1000000ULL)
+        return;
+    if (stats.ticks > 0) {
+        ws_log_info("Broadcast tick: %" PRIu64 " ticks, %" PRIu64 " missed, jitter avg %" PRIu64
+                    " us, max %" PRIu64 " us",
+                    stats.ticks, stats.missed, stats.jitter_sum_us / stats.ticks, stats.jitter_max_us);
+    }
+    frontend_report_keepalive();
+    video_report_stats();
+    uint64_t last_tick = stats.last_tick_ns;
+    memset(&stats, 0, sizeof(stats));
+    stats.last_tick_ns = last_tick;
+    last_report_ns = now;
+}
+
+// One broadcast tick; expirations > 1 means the loop fell behind.
+static void handle_broadcast_tick(void *data, uint64_t expirations) {
+    (void)data;
+    uint64_t now = monotonic_ns();
+    if (stats.last_tick_ns != 0) {
+        uint64_t interval = now - stats.last_tick_ns;
+        uint64_t expected = period_ns * expirations;
+        uint64_t jitter_us = (interval > expected ? interval - expected : expected - interval) / 1000;
+        stats.jitter_sum_us += jitter_us;
+        if (jitter_us > stats.jitter_max_us)
+            stats.jitter_max_us = jitter_us;
+    }
+    stats.last_tick_ns = now;
+    stats.ticks++;
+    stats.missed += expirations - 1;
+
+    broadcast_sensor_data();
+    report_stats(now);
+}
+
+// Start the periodic timer on loop that drives broadcast_sensor_data().
+int broadcast_timer_init(ws_reactor *loop, int period_ms) {
+    if (period_ms <= 0) {
+        ws_log_error("Invalid broadcast period %d ms", period_ms);
+        return -1;
+    }
+    period_ns = (uint64_t)period_ms * 1000000ULL;
+    memset(&stats, 0, sizeof(stats));
+    last_report_ns = monotonic_ns();
+    return ws_timer_start(loop, &timer, period_ms, period_ms, handle_broadcast_tick, NULL);
+}
+
+void broadcast_timer_close(ws_reactor *loop) {
+    ws_timer_stop(loop, &timer);
+}
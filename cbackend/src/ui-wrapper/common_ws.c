@@ -1,16 +1,10 @@
 #include "common_ws.h"
-#include "frontend_ws.h"  // for g_clients[]
+#include "frontend_ws.h"  // for frontend_stop(), config.h
 #include "remote_ws.h"    // for SENSOR_BUFFER_MAX, etc.
 
 #include "websocket.h"    // ws_create_closing_frame
-#include "hiredis.h"      // redisFree
+#include "hiredis.h"      // redisContext
 
-/* Epoll file descriptor */
-int epoll_fd = -1;
-
-pthread_mutex_t g_clients_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-client_t g_clients[MAX_CLIENTS];
 /* Global file descriptors */
 int g_server_fd = -1; // Frontend WebSocket server (listening) socket
 int g_remote_fd = -1; // Remote WebSocket connection (sensor data)
@@ -18,12 +12,29 @@ int g_remote_fd = -1; // Remote WebSocket connection (sensor data)
 /* Redis connection context */
 redisContext *redis_ctx = NULL;
 
+/* Server TLS context, NULL when clients connect over plain TCP */
+struct ssl_ctx_st *g_tls_ctx = NULL;
+
 
 sensor_data_t sensor_buffer[SENSOR_BUFFER_MAX];
 sensor_data_t latest_sensor_buffer[SENSOR_BUFFER_MAX];
 int latest_sensor_buffer_count = 0;
 int sensor_buffer_count = 0;
 
+sensor_data_t sensor_table[SENSOR_TABLE_MAX];
+int sensor_table_count = 0;
+uint64_t sensor_table_version = 0;
+
+/* Open-addressing index into sensor_table, keyed by channel name.
+ * Slots hold table index + 1 so that 0 means empty. */
+#define SENSOR_INDEX_SIZE (SENSOR_TABLE_MAX * 2)
+static uint32_t sensor_index[SENSOR_INDEX_SIZE];
+
+/* Idle handshake buffers. Shared by the frontend and video servers,
+ * which accept on different threads. */
+static uint8_t *handshake_pool[HANDSHAKE_POOL_MAX];
+static int handshake_pool_count = 0;
+static pthread_mutex_t handshake_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
  
  /*-------------------- Utility Functions --------------------*/
  // Set a file descriptor to non-blocking mode.
@@ -35,26 +46,232 @@ void set_nonblocking(int fd)
      fcntl(fd, F_SETFL, flags | O_NONBLOCK);
  }
  
- // Remove a file descriptor from the epoll instance.
-void remove_from_epoll(int fd)
+ // Milliseconds on CLOCK_MONOTONIC, for timeouts and stall detection.
+uint64_t monotonic_ms(void)
  {
-     epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+     struct timespec ts;
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
  }
- 
+
+ // Microseconds on CLOCK_MONOTONIC, for round-trip times.
+uint64_t monotonic_us(void)
+ {
+     struct timespec ts;
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+ }
+
+ /*-------------------- Latest-Value Table --------------------*/
+ static uint32_t sensor_name_hash(const char *name)
+ {
+     uint32_t h = 2166136261u; // FNV-1a
+     while (*name)
+     {
+         h ^= (uint8_t)*name++;
+         h *= 16777619u;
+     }
+     return h;
+ }
+
+ // Record a reading as the latest value of its channel.
+void sensor_table_update(const sensor_data_t *sd)
+ {
+     uint32_t slot = sensor_name_hash(sd->name) & (SENSOR_INDEX_SIZE - 1);
+     while (sensor_index[slot] != 0)
+     {
+         sensor_data_t *entry = &sensor_table[sensor_index[slot] - 1];
+         if (strcmp(entry->name, sd->name) == 0)
+         {
+             *entry = *sd;
+             sensor_table_version++;
+             return;
+         }
+         slot = (slot + 1) & (SENSOR_INDEX_SIZE - 1);
+     }
+     if (sensor_table_count >= SENSOR_TABLE_MAX)
+         return; // Table full: new channels are only broadcast as deltas
+     sensor_table[sensor_table_count] = *sd;
+     sensor_index[slot] = ++sensor_table_count;
+     sensor_table_version++;
+ }
+
+ /*-------------------- Handshake Buffers --------------------*/
+ // Take a BUFFER_SIZE handshake buffer, reusing an idle one if possible.
+uint8_t *handshake_buffer_get(void)
+ {
+     uint8_t *buf = NULL;
+     pthread_mutex_lock(&handshake_pool_mutex);
+     if (handshake_pool_count > 0)
+         buf = handshake_pool[--handshake_pool_count];
+     pthread_mutex_unlock(&handshake_pool_mutex);
+     if (!buf)
+         buf = malloc(BUFFER_SIZE);
+     return buf;
+ }
+
+ // Return a handshake buffer; beyond HANDSHAKE_POOL_MAX idle ones it is freed.
+void handshake_buffer_put(uint8_t *buf)
+ {
+     if (!buf)
+         return;
+     pthread_mutex_lock(&handshake_pool_mutex);
+     if (handshake_pool_count < HANDSHAKE_POOL_MAX)
+     {
+         handshake_pool[handshake_pool_count++] = buf;
+         buf = NULL;
+     }
+     pthread_mutex_unlock(&handshake_pool_mutex);
+     free(buf);
+ }
+
+ // Mark the handshake complete, hand its buffer back to the pool and set
+ // up the frame decoder. The decoder's reassembly and control-frame state
+ // is kept out of the slot so the broadcast walk stays compact. Returns -1
+ // if it cannot be allocated; the caller closes the client.
+int client_handshake_finished(client_t *client, ws_message_fn on_message, ws_reply_fn reply)
+ {
+     client->decoder = malloc(sizeof(ws_decoder));
+     if (!client->decoder)
+         return -1;
+     ws_decoder_init(client->decoder, WS_DECODER_SERVER, CLIENT_MAX_MESSAGE, on_message, reply, client);
+     client->handshake_done = true;
+     handshake_buffer_put(client->buffer);
+     client->buffer = NULL;
+     client->buffer_len = 0;
+     client->handshake_scanned = 0;
+     return 0;
+ }
+
+ /*-------------------- Client Table --------------------*/
+ // Set up an empty table admitting at most limit clients at once.
+int client_table_init(client_table_t *t, int limit)
+ {
+     memset(t, 0, sizeof(*t));
+     if (limit <= 0)
+         return -1;
+     t->limit = limit;
+     return 0;
+ }
+
+void client_table_free(client_table_t *t)
+ {
+     for (int i = 0; i < t->chunk_count; i++)
+         free(t->chunks[i]);
+     free(t->chunks);
+     free(t->free_slots);
+     free(t->active);
+     memset(t, 0, sizeof(*t));
+ }
+
+ // Add one chunk of free slots. Returns -1 if out of memory.
+static int client_table_grow(client_table_t *t)
+ {
+     int capacity = t->capacity + CLIENT_SLAB_CHUNK;
+     client_t **chunks = realloc(t->chunks, sizeof(client_t *) * (t->chunk_count + 1));
+     if (!chunks)
+         return -1;
+     t->chunks = chunks;
+     int *free_slots = realloc(t->free_slots, sizeof(int) * capacity);
+     if (!free_slots)
+         return -1;
+     t->free_slots = free_slots;
+     client_t **active = realloc(t->active, sizeof(client_t *) * capacity);
+     if (!active)
+         return -1;
+     t->active = active;
+     client_t *chunk = calloc(CLIENT_SLAB_CHUNK, sizeof(client_t));
+     if (!chunk)
+         return -1;
+     t->chunks[t->chunk_count++] = chunk;
+     // Pop order starts at the lowest new slot.
+     for (int i = CLIENT_SLAB_CHUNK - 1; i >= 0; i--)
+     {
+         chunk[i].fd = -1;
+         chunk[i].slot = t->capacity + i;
+         chunk[i].active_index = -1;
+         t->free_slots[t->free_count++] = t->capacity + i;
+     }
+     t->capacity = capacity;
+     return 0;
+ }
+
+ // Claim a free slot for fd, with a handshake buffer attached. Returns
+ // NULL at the soft limit or when memory for the slot or buffer runs out.
+client_t *client_table_alloc(client_table_t *t, int fd)
+ {
+     if (t->active_count >= t->limit)
+         return NULL;
+     if (t->free_count == 0 && client_table_grow(t) < 0)
+         return NULL;
+     uint8_t *buf = handshake_buffer_get();
+     if (!buf)
+         return NULL;
+     int slot = t->free_slots[--t->free_count];
+     client_t *client = &t->chunks[slot / CLIENT_SLAB_CHUNK][slot % CLIENT_SLAB_CHUNK];
+     client->fd = fd;
+     client->handshake_done = false;
+     client->buffer = buf;
+     client->buffer_len = 0;
+     client->handshake_scanned = 0;
+     client->active_index = t->active_count;
+     t->active[t->active_count++] = client;
+     return client;
+ }
+
+ // Return a client's slot. The last active client takes its place, so
+ // callers walking t->active while releasing must iterate backwards.
+void client_table_release(client_table_t *t, client_t *client)
+ {
+     int idx = client->active_index;
+     if (idx < 0)
+         return;
+     client_t *last = t->active[--t->active_count];
+     t->active[idx] = last;
+     last->active_index = idx;
+     client->active_index = -1;
+     client->fd = -1;
+     if (client->decoder)
+     {
+         ws_decoder_free(client->decoder);
+         free(client->decoder);
+         client->decoder = NULL;
+     }
+     handshake_buffer_put(client->buffer);
+     client->buffer = NULL;
+     client->buffer_len = 0;
+     client->handshake_scanned = 0;
+     t->free_slots[t->free_count++] = client->slot;
+ }
+
+ // Admission control: tell a client over the limit to retry later, then
+ // the caller closes it. Best effort on a fresh non-blocking socket.
+void send_busy_response(int fd)
+ {
+     static const char busy[] =
+         "HTTP/1.1 503 Service Unavailable\r\n"
+         "Retry-After: " CLIENT_RETRY_AFTER_S "\r\n"
+         "Content-Length: 0\r\n"
+         "Connection: close\r\n\r\n";
+     send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+ }
+
  /*-------------------- Socket Initialization --------------------*/
- // Initialize the frontend server socket.
+ // Initialize a frontend server socket. SO_REUSEPORT lets every frontend
+ // reactor bind its own listener to the same port.
  int init_frontend_server(int port)
  {
      int fd = socket(AF_INET, SOCK_STREAM, 0);
      if (fd < 0)
      {
-         perror("socket()");
+         ws_log_perror("socket()");
          return -1;
      }
      int opt = 1;
-     if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+     if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+         setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
      {
-         perror("setsockopt()");
+         ws_log_perror("setsockopt()");
          close(fd);
          return -1;
      }
@@ -65,43 +282,16 @@ void remove_from_epoll(int fd)
      addr.sin_port = htons(port);
      if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
      {
-         perror("bind()");
+         ws_log_perror("bind()");
          close(fd);
          return -1;
      }
-     if (listen(fd, MAX_CLIENTS) < 0)
+     if (listen(fd, LISTEN_BACKLOG) < 0)
      {
-         perror("listen()");
+         ws_log_perror("listen()");
          close(fd);
          return -1;
      }
      set_nonblocking(fd);
      return fd;
  }
-
- /*-------------------- Signal Handling & Shutdown --------------------*/
- void handle_sigint(int sig)
- {
-     (void)sig;
-     printf("SIGINT received, shutting down...\n");
-     uint8_t close_buf[BUFFER_SIZE];
-     size_t close_size = sizeof(close_buf);
-     ws_create_closing_frame(close_buf, &close_size);
-     pthread_mutex_lock(&g_clients_mutex);
-     for (int i = 0; i < MAX_CLIENTS; i++)
-     {
-         if (g_clients[i].fd != -1)
-         {
-             send(g_clients[i].fd, close_buf, close_size, 0);
-             close(g_clients[i].fd);
-         }
-     }
-     pthread_mutex_unlock(&g_clients_mutex);
-     if (g_server_fd != -1)
-         close(g_server_fd);
-     if (g_remote_fd != -1)
-         close(g_remote_fd);
-     if (redis_ctx)
-         redisFree(redis_ctx);
-     exit(0);
- }
\ No newline at end of file
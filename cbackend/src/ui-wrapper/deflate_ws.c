@@ -0,0 +1,76 @@
+#include "deflate_ws.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "wslog.h"
+
+// permessage-deflate (RFC 7692) with no context takeover: every message is
+// compressed from a fresh window, so one compressed payload can be sent to
+// every client that negotiated the extension.
+
+static z_stream g_zs;
+static int g_zs_ready = 0;
+static uint8_t *g_out = NULL;
+static size_t g_out_cap = 0;
+
+int ws_deflate_init(void) {
+    if (g_zs_ready)
+        return 0;
+    memset(&g_zs, 0, sizeof(g_zs));
+    // Negative window bits produce a raw deflate stream without zlib header.
+    if (deflateInit2(&g_zs, WS_DEFLATE_LEVEL, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        ws_log_error("deflateInit2() failed");
+        return -1;
+    }
+    g_zs_ready = 1;
+    return 0;
+}
+
+// Compress one message payload. The result lives in a buffer owned by this
+// module and stays valid until the next call. Returns NULL on failure.
+const uint8_t *ws_deflate_message(const uint8_t *data, size_t len, size_t *out_len) {
+    if (!g_zs_ready && ws_deflate_init() < 0)
+        return NULL;
+
+    size_t need = deflateBound(&g_zs, len) + 8;
+    if (need > g_out_cap) {
+        uint8_t *p = realloc(g_out, need);
+        if (!p) {
+            ws_log_perror("realloc() deflate buffer");
+            return NULL;
+        }
+        g_out = p;
+        g_out_cap = need;
+    }
+
+    deflateReset(&g_zs);
+    g_zs.next_in = (Bytef *)data;
+    g_zs.avail_in = len;
+    g_zs.next_out = g_out;
+    g_zs.avail_out = g_out_cap;
+    if (deflate(&g_zs, Z_SYNC_FLUSH) != Z_OK || g_zs.avail_in != 0) {
+        ws_log_error("deflate() failed");
+        return NULL;
+    }
+
+    // A sync flush ends with an empty stored block (00 00 ff ff) that the
+    // receiver appends back before inflating.
+    size_t n = g_out_cap - g_zs.avail_out;
+    if (n >= 4 && memcmp(g_out + n - 4, "\x00\x00\xff\xff", 4) == 0)
+        n -= 4;
+    *out_len = n;
+    return g_out;
+}
+
+void ws_deflate_free(void) {
+    if (g_zs_ready) {
+        deflateEnd(&g_zs);
+        g_zs_ready = 0;
+    }
+    free(g_out);
+    g_out = NULL;
+    g_out_cap = 0;
+}
@@ -1,4 +1,4 @@
-
+#define _GNU_SOURCE // accept4
 #include "frontend_ws.h"
 #include "common_ws.h"
 #include "remote_ws.h"   // for sensor_buffer, warnings
@@ -6,85 +6,177 @@
 #include "wshandshake.h"
 #include "websocket.h"
 #include "cJSON.h"
+#include "deflate_ws.h"
+#include "wsuring.h"
+
+#include <inttypes.h>
+
+ /*-------------------- Broadcast Batches --------------------*/
+ // Everything one broadcast tick produces, encoded once by the ingest thread
+ // and shared by every reactor. Index 0 is the plain frame, index 1 the
+ // permessage-deflate frame (NULL when nobody negotiated it or it did not
+ // compress).
+ typedef struct
+ {
+     int refs;            // Atomic, one per reactor inbox holding it
+     ws_msg *delta[2];    // Rows received since the previous tick
+     ws_msg *keyframe[2]; // Latest-value table as of this tick, or NULL
+ } broadcast_batch_t;
+
+ /*-------------------- Reactors --------------------*/
+ // A frontend I/O thread with its own SO_REUSEPORT listener, epoll instance
+ // and clients. The ingest thread is the only producer of its inbox, the
+ // reactor the only consumer, so the handoff needs no lock.
+ #define REACTOR_INBOX_SIZE 64 // Power of two
+ #define REACTOR_URING_ENTRIES 256 // Sends submitted per io_uring_enter()
+
+ typedef struct
+ {
+     pthread_t thread;
+     int id;
+     ws_reactor loop;            // Woken by the ingest thread for new batches
+     int listen_fd;
+     ws_handler listener;
+     ws_wheel wheel;             // Client deadlines
+     client_table_t clients;     // Only touched by this reactor's thread
+     broadcast_batch_t *inbox[REACTOR_INBOX_SIZE];
+     unsigned inbox_head;        // Next batch to consume, reactor-owned
+     unsigned inbox_tail;        // Next slot to fill, ingest-owned
+     bool inbox_overrun;         // A batch was dropped because the inbox was full
+     broadcast_batch_t *last;    // Most recently consumed batch
+ #ifdef WS_IO_URING
+     ws_uring uring;             // Fanout sends; fd -1 falls back to sendmsg()
+     bool fanout;                // In a broadcast pass: sends go to the ring
+ #endif
+ } frontend_reactor_t;
+
+ static frontend_reactor_t *reactors = NULL;
+ static int reactor_count = 0;
+ static int deflate_clients = 0; // Handshaken clients using permessage-deflate
+ static ws_rtt_hist client_rtt;   // Pong round trips from every reactor
+ static uint64_t keepalive_reaped = 0; // Clients dropped for missing pongs
 
+ static void batch_unref(broadcast_batch_t *batch)
+ {
+     if (!batch || __atomic_sub_fetch(&batch->refs, 1, __ATOMIC_ACQ_REL) != 0)
+         return;
+     for (int i = 0; i < 2; i++)
+     {
+         ws_msg_unref(batch->delta[i]);
+         ws_msg_unref(batch->keyframe[i]);
+     }
+     free(batch);
+ }
+
+ // Pick the encoding a client negotiated.
+ static ws_msg *msg_for_client(ws_msg *const msgs[2], const client_t *client)
+ {
+     return client->deflate && msgs[1] ? msgs[1] : msgs[0];
+ }
 
+ static void on_client_ready(void *data, uint32_t events);
+ static void on_handshake_timeout(void *data);
+ static void on_keepalive(void *data);
 
  /*-------------------- Frontend Client Handling --------------------*/
- // Accept a new frontend client connection.
-void handle_new_client()
+ // Give an accepted (non-blocking) socket a client slot and register it.
+static void add_client(frontend_reactor_t *r, int client_fd)
  {
-     struct sockaddr_in client_addr;
-     socklen_t addr_len = sizeof(client_addr);
-     int client_fd = accept(g_server_fd, (struct sockaddr *)&client_addr, &addr_len);
-     if (client_fd < 0)
+     int sndbuf = CLIENT_SOCKET_SNDBUF;
+     setsockopt(client_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+     // Take a free slot for the new client.
+     client_t *client = client_table_alloc(&r->clients, client_fd);
+     if (!client)
      {
-         if (errno != EAGAIN && errno != EWOULDBLOCK)
-             perror("accept()");
+         ws_log_warn("Client limit reached, rejecting connection.");
+         send_busy_response(client_fd);
+         close(client_fd);
          return;
      }
-     set_nonblocking(client_fd);
-     // Find a free slot for the new client.
-     pthread_mutex_lock(&g_clients_mutex);
-     for (int i = 0; i < MAX_CLIENTS; i++)
+     client->deflate = false;
+     client->server = r;
+     if (ws_tls_accept(&client->tls, g_tls_ctx, client_fd) < 0)
      {
-         if (g_clients[i].fd == -1)
+         close(client_fd);
+         client_table_release(&r->clients, client);
+         return;
+     }
+     client->io.fn = on_client_ready;
+     client->io.data = client;
+     if (ws_reactor_add(&r->loop, client_fd, EPOLLIN | EPOLLOUT | EPOLLET, &client->io) < 0)
+     {
+         ws_tls_close(&client->tls);
+         close(client_fd);
+         client_table_release(&r->clients, client);
+     }
+     else
+     {
+         ws_deadline_init(&client->deadline, on_handshake_timeout, client);
+         ws_wheel_schedule(&r->wheel, &client->deadline, HANDSHAKE_TIMEOUT_MS);
+         ws_log_info("New frontend client connected. FD = %d (reactor %d)", client_fd, r->id);
+     }
+ }
+
+ // Accept pending frontend connections until the backlog is drained or
+ // ACCEPT_BATCH_MAX is reached. The listening socket is level-triggered,
+ // so anything left over is picked up on the next loop iteration.
+static void handle_new_client(frontend_reactor_t *r)
+ {
+     for (int n = 0; n < ACCEPT_BATCH_MAX; n++)
+     {
+         int client_fd = accept4(r->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+         if (client_fd < 0)
          {
-             g_clients[i].fd = client_fd;
-             g_clients[i].handshake_done = false;
-             g_clients[i].buffer_len = 0;
-             // add_to_epoll(client_fd, EPOLLIN | EPOLLET, &g_clients[i]);
-             struct epoll_event ev;
-             ev.events = EPOLLIN | EPOLLET;
-             ev.data.ptr = &g_clients[i];
-             if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0)
-             {
-                 perror("epoll_ctl(): new client");
-                 close(client_fd);
-                 g_clients[i].fd = -1;
-             }
-             else
-             {
-                 printf("New frontend client connected. FD = %d\n", client_fd);
-             }
-             pthread_mutex_unlock(&g_clients_mutex);
+             if (errno == EINTR || errno == ECONNABORTED)
+                 continue;
+             if (errno != EAGAIN && errno != EWOULDBLOCK)
+                 ws_log_perror("accept4()");
              return;
          }
+         add_client(r, client_fd);
      }
-     pthread_mutex_unlock(&g_clients_mutex);
-     printf("Max clients reached, rejecting connection.\n");
-     close(client_fd);
  }
- 
+
  // Close a frontend client connection.
- void close_client(client_t *client)
+ static void close_client(frontend_reactor_t *r, client_t *client)
  {
      if (client->fd != -1)
      {
-         remove_from_epoll(client->fd);
+         if (client->handshake_done)
+         {
+             ws_log_info("Client FD %d stats: %llu msgs sent, %llu dropped, degraded %u times, "
+                         "peak queue %zu bytes, rtt %u us",
+                         client->fd, (unsigned long long)client->outq.sent_msgs,
+                         (unsigned long long)client->dropped, client->degrade_count,
+                         client->peak_queued, client->keepalive.rtt_us);
+             if (client->deflate)
+                 __atomic_sub_fetch(&deflate_clients, 1, __ATOMIC_RELAXED);
+         }
+         // Closing the fd also removes it from the reactor's epoll set.
+         ws_wheel_cancel(&r->wheel, &client->deadline);
+         ws_tls_close(&client->tls);
          close(client->fd);
-         client->fd = -1;
+         ws_queue_free(&client->outq);
+         client_table_release(&r->clients, client);
          client->handshake_done = false;
-         client->buffer_len = 0;
+         client->deflate = false;
+         client->degraded = false;
+         client->keyframe_sent = false;
+         client->dropped = 0;
+         client->degrade_count = 0;
+         client->peak_queued = 0;
      }
  }
- 
+
  // Send a text message (as a WebSocket frame) to a specific frontend client.
  static void ws_send_text(int fd, const char *msg)
  {
-     uint8_t out_buf[BUFFER_SIZE];
-     size_t out_size = sizeof(out_buf);
-     ws_frame frame;
-     memset(&frame, 0, sizeof(frame));
-     frame.type = WS_TEXT_FRAME;
-     frame.payload = (uint8_t *)msg;
-     frame.payload_length = strlen(msg);
-     ws_create_frame(&frame, out_buf, &out_size);
-     if (send(fd, out_buf, out_size, 0) < 0)
+     if (ws_send_frame(fd, WS_TEXT_FRAME, msg, strlen(msg), MSG_NOSIGNAL) < 0)
      {
-         perror("send() ws_send_text");
+         ws_log_perror("send() ws_send_text");
      }
  }
- 
+
 //  // Broadcast a text message to all connected (and handshaken) frontend clients.
 //  static void broadcast_text(const char *msg)
 //  {
@@ -100,95 +192,777 @@ void handle_new_client()
 
 
 
- // Broadcast the buffered sensor data to all connected frontend clients
- // and then clear the sensor buffer.
- void broadcast_sensor_data()
+ /*-------------------- Broadcast Encoding --------------------*/
+ // One JSON payload, encoded lazily as a plain and a compressed frame.
+ // Only the ingest thread encodes; reactors get the frames in batches.
+ typedef struct
+ {
+     char *json;
+     size_t json_len;
+     ws_msg *plain;
+     ws_msg *deflated;
+     bool deflate_tried;
+ } encoded_msg_t;
+
+ // Latest-value snapshot sent to new clients and to clients recovering
+ // from a stall.
+ static encoded_msg_t keyframe;
+ static uint64_t keyframe_version = 0;
+
+ // Backfill history: one keyframe every BACKFILL_INTERVAL_MS, oldest first
+ // starting at backfill_head. Sampled by the ingest thread and read by the
+ // reactors at handshake, under backfill_mutex.
+ #define BACKFILL_SLOTS (BACKFILL_SECONDS * 1000 / BACKFILL_INTERVAL_MS)
+ static ws_msg *backfill[BACKFILL_SLOTS][2];
+ static uint64_t backfill_time[BACKFILL_SLOTS];
+ static int backfill_head = 0;
+ static int backfill_count = 0;
+ static uint64_t backfill_last_sample = 0;
+ static uint64_t backfill_last_version = 0;
+ static pthread_mutex_t backfill_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+ static char *encode_sensor_json(const sensor_data_t *rows, int count)
  {
-     if (latest_sensor_buffer_count == 0)
-         return;
      cJSON *json_array = cJSON_CreateArray();
-     for (int i = 0; i < latest_sensor_buffer_count; i++)
+     for (int i = 0; i < count; i++)
      {
          cJSON *item = cJSON_CreateObject();
-         cJSON_AddStringToObject(item, "name", latest_sensor_buffer[i].name);
-         cJSON_AddNumberToObject(item, "value", latest_sensor_buffer[i].value);
-         cJSON_AddNumberToObject(item, "timestamp", latest_sensor_buffer[i].timestamp);
-         cJSON_AddNumberToObject(item, "warning", latest_sensor_buffer[i].warning);
+         cJSON_AddStringToObject(item, "name", rows[i].name);
+         cJSON_AddNumberToObject(item, "value", rows[i].value);
+         cJSON_AddNumberToObject(item, "timestamp", rows[i].timestamp);
+         cJSON_AddNumberToObject(item, "warning", rows[i].warning);
          cJSON_AddItemToArray(json_array, item);
      }
      char *json_str = cJSON_PrintUnformatted(json_array);
      cJSON_Delete(json_array);
- 
+     return json_str;
+ }
+
+ static ws_msg *make_text_msg(const uint8_t *payload, size_t len, bool compressed)
+ {
+     ws_msg *msg = ws_msg_new(WS_MAX_HEADER_LEN + len);
+     if (!msg)
+     {
+         ws_log_perror("malloc() broadcast frame");
+         return NULL;
+     }
+     msg->len = ws_frame_header(WS_TEXT_FRAME, compressed, len, msg->data);
+     memcpy(msg->data + msg->len, payload, len);
+     msg->len += len;
+     return msg;
+ }
+
+ static void encoded_msg_reset(encoded_msg_t *e, char *json)
+ {
+     free(e->json);
+     ws_msg_unref(e->plain);
+     ws_msg_unref(e->deflated);
+     memset(e, 0, sizeof(*e));
+     if (json)
+     {
+         e->json = json;
+         e->json_len = strlen(json);
+         e->deflate_tried = e->json_len < WS_DEFLATE_MIN_SIZE;
+     }
+ }
+
+ // Fill out[0] with the plain frame and, if wanted, out[1] with the
+ // compressed one, encoding each at most once. Takes a reference on both.
+ static void encoded_msg_get(encoded_msg_t *e, bool want_deflate, ws_msg *out[2])
+ {
+     if (want_deflate && !e->deflate_tried)
+     {
+         e->deflate_tried = true;
+         size_t zlen;
+         const uint8_t *z = ws_deflate_message((const uint8_t *)e->json, e->json_len, &zlen);
+         if (z)
+             e->deflated = make_text_msg(z, zlen, true);
+     }
+     if (!e->plain)
+         e->plain = make_text_msg((const uint8_t *)e->json, e->json_len, false);
+     out[0] = e->plain ? ws_msg_ref(e->plain) : NULL;
+     out[1] = want_deflate && e->deflated ? ws_msg_ref(e->deflated) : NULL;
+ }
+
+ // Snapshot of the whole latest-value table, re-encoded only when it changed.
+ static encoded_msg_t *current_keyframe(void)
+ {
+     if (sensor_table_count == 0)
+         return NULL;
+     if (!keyframe.json || keyframe_version != sensor_table_version)
+     {
+         encoded_msg_reset(&keyframe, encode_sensor_json(sensor_table, sensor_table_count));
+         keyframe_version = sensor_table_version;
+     }
+     return keyframe.json ? &keyframe : NULL;
+ }
+
+ // Keep a reduced-resolution history of the keyframes for backfill.
+ static void backfill_sample(uint64_t now, ws_msg *const kf[2])
+ {
+     if (BACKFILL_SLOTS == 0 || !kf[0] || now - backfill_last_sample < BACKFILL_INTERVAL_MS ||
+         backfill_last_version == sensor_table_version)
+         return;
+
+     pthread_mutex_lock(&backfill_mutex);
+     int slot = (backfill_head + backfill_count) % BACKFILL_SLOTS;
+     if (backfill_count == BACKFILL_SLOTS)
+         backfill_head = (backfill_head + 1) % BACKFILL_SLOTS;
+     else
+         backfill_count++;
+     for (int i = 0; i < 2; i++)
+     {
+         ws_msg_unref(backfill[slot][i]);
+         backfill[slot][i] = kf[i] ? ws_msg_ref(kf[i]) : NULL;
+     }
+     backfill_time[slot] = now;
+     pthread_mutex_unlock(&backfill_mutex);
+     backfill_last_sample = now;
+     backfill_last_version = sensor_table_version;
+ }
+
+ // Requested backfill window from the handshake URI, e.g. "/?backfill=30".
+ static int backfill_seconds_requested(const char *uri)
+ {
+     const char *q = strchr(uri, '?');
+     const char *p = q ? strstr(q, "backfill=") : NULL;
+     if (!p || (p[-1] != '?' && p[-1] != '&'))
+         return 0;
+     int seconds = atoi(p + strlen("backfill="));
+     if (seconds < 0)
+         return 0;
+     return seconds > BACKFILL_SECONDS ? BACKFILL_SECONDS : seconds;
+ }
+
+ /*-------------------- Outbound Queues --------------------*/
+ #ifdef WS_IO_URING
+ // Submit the sends queued during a broadcast pass in one io_uring_enter()
+ // and apply the results. Only clients already walked in the pass can be
+ // closed here, so callers iterating backwards are unaffected.
+ static void reactor_flush_sends(frontend_reactor_t *r)
+ {
+     if (r->uring.pending == 0)
+         return;
+     if (ws_uring_submit_wait(&r->uring) < 0)
+         ws_log_perror("io_uring_enter() frontend fanout");
+     void *data;
+     int res;
+     while (ws_uring_next_cqe(&r->uring, &data, &res))
+     {
+         client_t *client = data;
+         if (res > 0)
+         {
+             ws_queue_consume(&client->outq, (size_t)res);
+         }
+         else if (res != -EAGAIN && res != -EINTR)
+         {
+             errno = -res;
+             ws_log_perror("send() frontend client");
+             close_client(r, client);
+         }
+         // On a short or would-block send the rest goes out on EPOLLOUT.
+     }
+ }
+ #endif
+
+ // Queue a message for a client and write out as much as the socket takes.
+ static void client_send_msg(frontend_reactor_t *r, client_t *client, ws_msg *msg)
+ {
+     if (!msg || ws_queue_push(&client->outq, msg) < 0)
+     {
+         client->dropped++;
+         return;
+     }
+     if (client->outq.bytes > client->peak_queued)
+         client->peak_queued = client->outq.bytes;
+ #ifdef WS_IO_URING
+     // During a broadcast, batch the send with every other client's. A
+     // client that already had a backlog is waiting for EPOLLOUT anyway.
+     if (r->fanout && r->uring.fd >= 0)
+     {
+         if (client->outq.count > 1)
+             return;
+         // A full ring is flushed first; this client has nothing in it yet.
+         if (ws_uring_prep_send(&r->uring, client->fd, msg->data, msg->len,
+                                MSG_DONTWAIT | MSG_NOSIGNAL, client) == 0)
+             return;
+         reactor_flush_sends(r);
+         if (ws_uring_prep_send(&r->uring, client->fd, msg->data, msg->len,
+                                MSG_DONTWAIT | MSG_NOSIGNAL, client) == 0)
+             return;
+     }
+ #endif
+     if (ws_queue_flush(&client->outq, client->fd) < 0)
+     {
+         ws_log_perror("send() frontend client");
+         close_client(r, client);
+     }
+ }
+
+ // Bring a freshly handshaken client up to date in one burst: the requested
+ // backfill, oldest first, then the keyframe of the last batch this reactor
+ // consumed, so the deltas that follow line up with it.
+ static void send_initial_state(frontend_reactor_t *r, client_t *client, int backfill_seconds)
+ {
+     uint64_t now = monotonic_ms();
+     uint64_t window = (uint64_t)backfill_seconds * 1000;
+     uint64_t since = now > window ? now - window : 0;
+     size_t budget = CLIENT_QUEUE_HIGH_BYTES / 2;
+     uint32_t slots = CLIENT_QUEUE_HIGH_MSGS / 2;
+     ws_msg *history[CLIENT_QUEUE_HIGH_MSGS / 2];
+     int n = 0;
+
+     // Walk back from the newest sample while it fits the window and budget.
+     pthread_mutex_lock(&backfill_mutex);
+     for (int i = backfill_count; backfill_seconds > 0 && i > 0 && slots > 0; i--)
+     {
+         int slot = (backfill_head + i - 1) % BACKFILL_SLOTS;
+         if (backfill_time[slot] < since)
+             break;
+         ws_msg *msg = msg_for_client(backfill[slot], client);
+         if (!msg || msg->len > budget)
+             break;
+         budget -= msg->len;
+         slots--;
+         history[n++] = ws_msg_ref(msg);
+     }
+     pthread_mutex_unlock(&backfill_mutex);
+
+     while (n > 0)
+     {
+         ws_msg *msg = history[--n];
+         if (client->fd != -1)
+             client_send_msg(r, client, msg);
+         ws_msg_unref(msg);
+     }
+     if (r->last && r->last->keyframe[0] && client->fd != -1)
+         client_send_msg(r, client, msg_for_client(r->last->keyframe, client));
+ }
+
+ // Step a degraded client towards recovery once its queue has drained:
+ // first queue a keyframe, then resume deltas after it went out.
+ static void client_try_recover(frontend_reactor_t *r, client_t *client)
+ {
+     if (!client->degraded || client->outq.count > 0)
+         return;
+     if (client->keyframe_sent)
+     {
+         client->degraded = false;
+         client->keyframe_sent = false;
+         ws_log_info("Client FD %d caught up, resuming live updates", client->fd);
+         return;
+     }
+     if (r->last && r->last->keyframe[0])
+     {
+         client->keyframe_sent = true;
+         client_send_msg(r, client, msg_for_client(r->last->keyframe, client));
+     }
+ }
+
+ // Put a client on keyframes only until its queue drains.
+ static void client_degrade(client_t *client, uint64_t now)
+ {
+     client->dropped += ws_queue_trim(&client->outq);
+     client->degraded = true;
+     client->keyframe_sent = false;
+     client->stalled_since = now;
+ }
+
+ // Apply the slow-consumer policy to one client for one broadcast.
+ static void broadcast_to_client(frontend_reactor_t *r, client_t *client,
+                                 broadcast_batch_t *batch, uint64_t now)
+ {
+     if (client->degraded)
+     {
+         if (now - client->stalled_since >= CLIENT_STALL_TIMEOUT_MS)
+         {
+             ws_log_warn("Client FD %d stalled for %llu ms, disconnecting",
+                         client->fd, (unsigned long long)(now - client->stalled_since));
+             close_client(r, client);
+             return;
+         }
+         client->dropped++;
+         client_try_recover(r, client);
+         return;
+     }
+
+     ws_msg *msg = msg_for_client(batch->delta, client);
+     if (!msg)
+         return;
+     if (client->outq.count >= CLIENT_QUEUE_HIGH_MSGS ||
+         client->outq.bytes + msg->len > CLIENT_QUEUE_HIGH_BYTES)
+     {
+         // Drop the backlog; a keyframe replaces it once the socket drains.
+         client_degrade(client, now);
+         client->dropped++;
+         client->degrade_count++;
+         ws_log_warn("Client FD %d is a slow consumer (%zu bytes queued), sending keyframes only",
+                     client->fd, client->outq.bytes);
+         return;
+     }
+     client_send_msg(r, client, msg);
+ }
+
+ // Hand a batch to one reactor. Called only from the ingest thread.
+ static void reactor_post(frontend_reactor_t *r, broadcast_batch_t *batch)
+ {
+     unsigned tail = r->inbox_tail;
+     unsigned head = __atomic_load_n(&r->inbox_head, __ATOMIC_ACQUIRE);
+     if (tail - head == REACTOR_INBOX_SIZE)
+     {
+         __atomic_store_n(&r->inbox_overrun, true, __ATOMIC_RELEASE);
+         return;
+     }
+     __atomic_add_fetch(&batch->refs, 1, __ATOMIC_RELAXED);
+     r->inbox[tail & (REACTOR_INBOX_SIZE - 1)] = batch;
+     __atomic_store_n(&r->inbox_tail, tail + 1, __ATOMIC_RELEASE);
+     ws_reactor_wake(&r->loop);
+ }
+
+ // Broadcast the buffered sensor data to all connected frontend clients
+ // and then clear the sensor buffer. Runs on the ingest thread: encodes
+ // the tick once and posts it to every reactor.
+ void broadcast_sensor_data()
+ {
+     uint64_t now = monotonic_ms();
+     bool want_deflate = __atomic_load_n(&deflate_clients, __ATOMIC_RELAXED) > 0;
+     ws_msg *kf[2] = {NULL, NULL};
+     encoded_msg_t *key = current_keyframe();
+     if (key)
+         encoded_msg_get(key, want_deflate, kf);
+     backfill_sample(now, kf);
+     if (latest_sensor_buffer_count == 0)
+     {
+         ws_msg_unref(kf[0]);
+         ws_msg_unref(kf[1]);
+         return;
+     }
+     char *json_str = encode_sensor_json(latest_sensor_buffer, latest_sensor_buffer_count);
+     latest_sensor_buffer_count = 0;
+     broadcast_batch_t *batch = json_str ? calloc(1, sizeof(*batch)) : NULL;
+     if (!batch)
+     {
+         free(json_str);
+         ws_msg_unref(kf[0]);
+         ws_msg_unref(kf[1]);
+         return;
+     }
+
      // Debug print: show data being forwarded.
     //  printf("Forwarding sensor data to frontend: %s\n", json_str);
- 
-     uint8_t frame_data[BUFFER_SIZE];
-     size_t frame_len = sizeof(frame_data);
-     ws_create_text_frame(json_str, frame_data, &frame_len);
-     free(json_str);
- 
-     for (int i = 0; i < MAX_CLIENTS; i++)
-     {
-         if (g_clients[i].fd != -1 && g_clients[i].handshake_done)
+
+     encoded_msg_t delta = {0};
+     encoded_msg_reset(&delta, json_str);
+     encoded_msg_get(&delta, want_deflate, batch->delta);
+     encoded_msg_reset(&delta, NULL);
+     batch->keyframe[0] = kf[0];
+     batch->keyframe[1] = kf[1];
+     batch->refs = 1;
+     for (int i = 0; i < reactor_count; i++)
+         reactor_post(&reactors[i], batch);
+     batch_unref(batch);
+ }
+
+ // Fan out every batch waiting in the inbox to this reactor's clients.
+ // Runs on the reactor thread after the ingest thread woke it.
+ static void reactor_drain_inbox(void *data)
+ {
+     frontend_reactor_t *r = data;
+     uint64_t now = monotonic_ms();
+     unsigned head = r->inbox_head;
+     unsigned tail = __atomic_load_n(&r->inbox_tail, __ATOMIC_ACQUIRE);
+ #ifdef WS_IO_URING
+     r->fanout = true;
+ #endif
+     for (; head != tail; head++)
+     {
+         broadcast_batch_t *batch = r->inbox[head & (REACTOR_INBOX_SIZE - 1)];
+         // Backwards, since closing a stalled client swap-removes it.
+         for (int i = r->clients.active_count - 1; i >= 0; i--)
          {
-             if (send(g_clients[i].fd, frame_data, frame_len, 0) < 0)
+             client_t *client = r->clients.active[i];
+             if (client->handshake_done)
+                 broadcast_to_client(r, client, batch, now);
+         }
+ #ifdef WS_IO_URING
+         reactor_flush_sends(r);
+ #endif
+         batch_unref(r->last);
+         r->last = batch;
+         __atomic_store_n(&r->inbox_head, head + 1, __ATOMIC_RELEASE);
+     }
+
+     // Deltas were lost while the inbox was full: resync everyone.
+     if (__atomic_exchange_n(&r->inbox_overrun, false, __ATOMIC_ACQ_REL))
+     {
+         ws_log_warn("Frontend reactor %d fell behind, resending keyframes", r->id);
+         for (int i = r->clients.active_count - 1; i >= 0; i--)
+         {
+             client_t *client = r->clients.active[i];
+             if (client->handshake_done && !client->degraded)
              {
-                 perror("send() broadcast_sensor_data");
+                 client_degrade(client, now);
+                 client_try_recover(r, client);
              }
          }
+ #ifdef WS_IO_URING
+         reactor_flush_sends(r);
+ #endif
      }
-     latest_sensor_buffer_count = 0;
+ #ifdef WS_IO_URING
+     r->fanout = false;
+ #endif
+ }
+
+ // Flush a client's queue when its socket becomes writable again.
+static void handle_client_write(frontend_reactor_t *r, client_t *client)
+ {
+     if (client->fd == -1 || !client->handshake_done)
+         return;
+     if (ws_queue_flush(&client->outq, client->fd) < 0)
+     {
+         ws_log_perror("send() frontend client");
+         close_client(r, client);
+         return;
+     }
+     client_try_recover(r, client);
+ }
+
+ /*-------------------- Keepalive --------------------*/
+ // Queue a control frame behind whatever the client is already waiting for.
+ static void client_send_control(frontend_reactor_t *r, client_t *client, wsFrameType type,
+                                 const uint8_t *payload, size_t len)
+ {
+     ws_msg *msg = ws_msg_new(2 + len); // Control payloads are at most 125 bytes
+     if (!msg)
+         return;
+     ws_create_control_frame(type, payload, len, msg->data, &msg->len);
+     client_send_msg(r, client, msg);
+     ws_msg_unref(msg);
+ }
+
+ // Ping an upgraded client, or drop it if it stopped answering.
+ static void on_keepalive(void *data)
+ {
+     client_t *client = data;
+     frontend_reactor_t *r = client->server;
+     uint8_t ping[WS_PING_FRAME_LEN];
+     if (ws_keepalive_ping(&client->keepalive, monotonic_us(), KEEPALIVE_MAX_MISSED, ping) < 0)
+     {
+         ws_log_info("Client FD %d missed %d pongs, closing", client->fd, KEEPALIVE_MAX_MISSED);
+         __atomic_add_fetch(&keepalive_reaped, 1, __ATOMIC_RELAXED);
+         close_client(r, client);
+         return;
+     }
+     ws_msg *msg = ws_msg_new(sizeof(ping));
+     if (msg)
+     {
+         memcpy(msg->data, ping, sizeof(ping));
+         client_send_msg(r, client, msg);
+         ws_msg_unref(msg);
+     }
+     if (client->fd != -1)
+         ws_wheel_schedule(&r->wheel, &client->deadline, KEEPALIVE_INTERVAL_MS);
+ }
+
+ // Decoder callback for a complete message or control frame from a client.
+ static int on_client_message(void *data, const ws_message *msg)
+ {
+     client_t *client = data;
+     frontend_reactor_t *r = client->server;
+     switch (msg->type)
+     {
+     case WS_PONG_FRAME:
+     {
+         int64_t rtt = ws_keepalive_pong(&client->keepalive, msg->data, msg->len, monotonic_us());
+         if (rtt >= 0)
+             ws_rtt_record(&client_rtt, (uint64_t)rtt);
+         return 0;
+     }
+     case WS_CLOSING_FRAME:
+         ws_log_info("Client FD %d sent CLOSE, closing connection.", client->fd);
+         client_send_control(r, client, WS_CLOSING_FRAME, msg->data, msg->len);
+         close_client(r, client);
+         return 1;
+     default:
+         // Clients have nothing to say to us beyond control frames.
+         return 0;
+     }
+ }
+
+ // Decoder callback that queues the automatic pong.
+ static int client_reply(void *data, const uint8_t *frame, size_t len)
+ {
+     client_t *client = data;
+     ws_msg *msg = ws_msg_new(len);
+     if (msg)
+     {
+         memcpy(msg->data, frame, len);
+         client_send_msg(client->server, client, msg);
+         ws_msg_unref(msg);
+     }
+     return client->fd == -1;
+ }
+
+ // Print and reset the round-trip distribution; called with the broadcast stats.
+void frontend_report_keepalive(void)
+ {
+     ws_rtt_summary s;
+     ws_rtt_take(&client_rtt, &s);
+     uint64_t reaped = __atomic_exchange_n(&keepalive_reaped, 0, __ATOMIC_RELAXED);
+     if (s.samples == 0 && reaped == 0)
+         return;
+     ws_log_info("Client RTT: %" PRIu64 " pongs, p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms, "
+                 "%" PRIu64 " dead clients dropped",
+                 s.samples, s.p50_us / 1000.0, s.p90_us / 1000.0, s.p99_us / 1000.0,
+                 s.max_us / 1000.0, reaped);
  }
- 
 
  /*-------------------- Frontend Client Read Handling --------------------*/
  // Handle data from a frontend client. Here we process handshake data if needed.
-void handle_client_read(client_t *client)
+static void handle_client_read(frontend_reactor_t *r, client_t *client)
  {
+     int tls = ws_tls_handshake(&client->tls);
+     if (tls <= 0)
+     {
+         if (tls < 0)
+         {
+             ws_log_info("Client FD %d TLS handshake failed.", client->fd);
+             close_client(r, client);
+         }
+         return;
+     }
      while (1)
      {
          uint8_t recv_buf[BUFFER_SIZE];
-         ssize_t n = recv(client->fd, recv_buf, sizeof(recv_buf), 0);
+         ssize_t n = ws_tls_recv(&client->tls, client->fd, recv_buf, sizeof(recv_buf));
          if (n <= 0)
          {
              if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
                  break;
-             printf("Client FD %d disconnected.\n", client->fd);
-             close_client(client);
+             ws_log_info("Client FD %d disconnected.", client->fd);
+             close_client(r, client);
              break;
          }
          if (!client->handshake_done)
          {
              if (client->buffer_len + n > BUFFER_SIZE)
              {
-                 printf("Handshake buffer overflow for client FD %d\n", client->fd);
-                 close_client(client);
+                 ws_log_warn("Handshake buffer overflow for client FD %d", client->fd);
+                 close_client(r, client);
                  break;
              }
              memcpy(client->buffer + client->buffer_len, recv_buf, n);
              client->buffer_len += n;
              http_header header;
              memset(&header, 0, sizeof(header));
+             header.extensions = WS_EXT_DEFLATE;
              size_t out_len = BUFFER_SIZE;
-             ws_handshake(&header, client->buffer, client->buffer_len, &out_len);
+             ws_handshake(&header, &client->handshake_scanned, client->buffer, client->buffer_len, &out_len);
              if (header.type == WS_OPENING_FRAME)
              {
-                 send(client->fd, client->buffer, out_len, 0);
-                 client->handshake_done = true;
+                 send(client->fd, client->buffer, out_len, MSG_NOSIGNAL);
+                 if (ws_queue_init(&client->outq, CLIENT_QUEUE_HIGH_MSGS) < 0)
+                 {
+                     ws_log_perror("ws_queue_init()");
+                     close_client(r, client);
+                     break;
+                 }
+                 if (client_handshake_finished(client, on_client_message, client_reply) < 0)
+                 {
+                     ws_log_perror("malloc() decoder");
+                     close_client(r, client);
+                     break;
+                 }
+                 // The handshake deadline becomes the keepalive ping.
+                 ws_wheel_cancel(&r->wheel, &client->deadline);
+                 ws_deadline_init(&client->deadline, on_keepalive, client);
+                 ws_keepalive_reset(&client->keepalive);
+                 ws_wheel_schedule(&r->wheel, &client->deadline, KEEPALIVE_INTERVAL_MS);
+                 client->deflate = (header.extensions & WS_EXT_DEFLATE) != 0;
+                 if (client->deflate)
+                     __atomic_add_fetch(&deflate_clients, 1, __ATOMIC_RELAXED);
                  //  ws_send_text(client->fd, "Welcome to sensor server");
-                 printf("Client FD %d handshake done (Key=%s)\n", client->fd, header.key);
-                 client->buffer_len = 0;
+                 ws_log_info("Client FD %d handshake done (Key=%s)", client->fd, header.key);
+                 send_initial_state(r, client, backfill_seconds_requested(header.uri));
+                 if (client->fd == -1)
+                     break;
              }
              else if (out_len > 0)
              {
-                 send(client->fd, client->buffer, out_len, 0);
-                 close_client(client);
+                 send(client->fd, client->buffer, out_len, MSG_NOSIGNAL);
+                 close_client(r, client);
                  break;
              }
          }
          else
          {
-             // For this application, frontend clients only receive data.
+             if (ws_decoder_feed(client->decoder, recv_buf, (size_t)n) == WS_DECODE_ERROR)
+             {
+                 ws_log_info("Client FD %d protocol error, closing with %u", client->fd,
+                             client->decoder->close_code);
+                 // Behind what is queued, so a partly sent frame is finished first
+                 uint8_t code[2] = {(uint8_t)(client->decoder->close_code >> 8),
+                                    (uint8_t)client->decoder->close_code};
+                 client_send_control(r, client, WS_CLOSING_FRAME, code, sizeof(code));
+                 if (client->fd != -1)
+                     close_client(r, client);
+             }
+             if (client->fd == -1)
+                 break;
          }
      }
- }
\ No newline at end of file
+ }
+
+ /*-------------------- Reactor Threads --------------------*/
+ static void on_client_ready(void *data, uint32_t events)
+ {
+     client_t *client = data;
+     frontend_reactor_t *r = client->server;
+     if (client->fd != -1 && (events & EPOLLOUT))
+         handle_client_write(r, client);
+     // A TLS handshake may be waiting for either direction.
+     if (client->fd != -1 && ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ||
+                              client->tls.state == WS_TLS_HANDSHAKE))
+         handle_client_read(r, client);
+ }
+
+ static void on_handshake_timeout(void *data)
+ {
+     client_t *client = data;
+     ws_log_info("Client FD %d did not complete the handshake in %d ms, closing",
+                 client->fd, HANDSHAKE_TIMEOUT_MS);
+     close_client(client->server, client);
+ }
+
+ static void on_listener_ready(void *data, uint32_t events)
+ {
+     (void)events;
+     handle_new_client(data);
+ }
+
+ static void *reactor_main(void *arg)
+ {
+     frontend_reactor_t *r = arg;
+     if (ws_reactor_run(&r->loop) < 0)
+         ws_log_error("Frontend reactor %d stopped on error", r->id);
+
+     // Shutting down: say goodbye to every upgraded client this reactor
+     // owns, behind what is already queued so it never lands inside a frame.
+     // Clients still in the HTTP or TLS handshake are just closed.
+     while (r->clients.active_count > 0)
+     {
+         client_t *client = r->clients.active[r->clients.active_count - 1];
+         if (client->handshake_done)
+             client_send_control(r, client, WS_CLOSING_FRAME, NULL, 0);
+         if (client->fd != -1)
+             close_client(r, client);
+     }
+     return NULL;
+ }
+
+ static void reactor_close(frontend_reactor_t *r)
+ {
+     if (r->listen_fd != -1)
+         close(r->listen_fd);
+     ws_wheel_free(&r->wheel, &r->loop);
+     ws_reactor_free(&r->loop);
+     for (unsigned i = r->inbox_head; i != r->inbox_tail; i++)
+         batch_unref(r->inbox[i & (REACTOR_INBOX_SIZE - 1)]);
+     batch_unref(r->last);
+     client_table_free(&r->clients);
+ #ifdef WS_IO_URING
+     ws_uring_free(&r->uring);
+ #endif
+ }
+
+ static int reactor_init(frontend_reactor_t *r, int id, int port, int client_limit)
+ {
+     memset(r, 0, sizeof(*r));
+     r->id = id;
+ #ifdef WS_IO_URING
+     r->uring.fd = -1;
+ #endif
+     if (ws_reactor_init(&r->loop, reactor_drain_inbox, r) < 0)
+         return -1;
+     if (ws_wheel_init(&r->wheel, &r->loop, TIMER_WHEEL_TICK_MS) < 0)
+     {
+         ws_reactor_free(&r->loop);
+         return -1;
+     }
+     r->listen_fd = init_frontend_server(port);
+     r->listener.fn = on_listener_ready;
+     r->listener.data = r;
+     if (r->listen_fd < 0 || client_table_init(&r->clients, client_limit) < 0 ||
+         ws_reactor_add(&r->loop, r->listen_fd, EPOLLIN, &r->listener) < 0)
+     {
+         reactor_close(r);
+         return -1;
+     }
+ #ifdef WS_IO_URING
+     if (ws_uring_init(&r->uring, REACTOR_URING_ENTRIES) < 0)
+         ws_log_perror("io_uring_setup(): frontend fanout falls back to sendmsg()");
+ #endif
+     return 0;
+ }
+
+ // Start the frontend server: threads reactors (0 = one per online CPU),
+ // each accepting on its own SO_REUSEPORT socket bound to port.
+int frontend_start(int port, int threads)
+ {
+     if (threads <= 0)
+         threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+     if (threads <= 0)
+         threads = 1;
+     reactors = calloc(threads, sizeof(frontend_reactor_t));
+     if (!reactors)
+     {
+         ws_log_perror("calloc() frontend reactors");
+         return -1;
+     }
+     int limit = (FRONTEND_CLIENT_LIMIT + threads - 1) / threads;
+     for (reactor_count = 0; reactor_count < threads; reactor_count++)
+     {
+         frontend_reactor_t *r = &reactors[reactor_count];
+         if (reactor_init(r, reactor_count, port, limit) < 0)
+         {
+             frontend_stop();
+             return -1;
+         }
+         if (pthread_create(&r->thread, NULL, reactor_main, r) != 0)
+         {
+             ws_log_perror("pthread_create() frontend reactor");
+             reactor_close(r);
+             frontend_stop();
+             return -1;
+         }
+     }
+     ws_log_info("Frontend WebSocket server listening on port %d with %d reactor threads",
+                 port, reactor_count);
+     return 0;
+ }
+
+ // Stop and join the reactors, closing their clients, then release the
+ // shared broadcast state.
+void frontend_stop(void)
+ {
+     for (int i = 0; i < reactor_count; i++)
+         ws_reactor_stop(&reactors[i].loop);
+     for (int i = 0; i < reactor_count; i++)
+     {
+         pthread_join(reactors[i].thread, NULL);
+         reactor_close(&reactors[i]);
+     }
+     free(reactors);
+     reactors = NULL;
+     reactor_count = 0;
+
+     encoded_msg_reset(&keyframe, NULL);
+     for (int i = 0; i < BACKFILL_SLOTS; i++)
+     {
+         ws_msg_unref(backfill[i][0]);
+         ws_msg_unref(backfill[i][1]);
+         backfill[i][0] = backfill[i][1] = NULL;
+     }
+     backfill_count = 0;
+ }
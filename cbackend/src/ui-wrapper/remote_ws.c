@@ -3,7 +3,6 @@
 
 #include "remote_ws.h"
 #include "common_ws.h"
-#include "frontend_ws.h" // for broadcast_sensor_data()
 
 #include "websocket.h"
 #include "cJSON.h"
@@ -15,8 +14,6 @@
 
 
 
-uint64_t last_broadcast_time = 0;
-
 FILE* csv_file = NULL;
 char csv_filename[256] = {0};
 
@@ -29,7 +26,7 @@ int initialize_csv_logging() {
         fprintf(csv_file, "timestamp,sensor_name,value\n");
         fflush(csv_file);
     } else {
-        perror("Failed to create CSV file");
+        ws_log_perror("Failed to create CSV file");
     }
 }
 
@@ -38,11 +35,13 @@ double apply_sensor_calculations(const char* sensor_name, double raw_value) {
     return raw_value;
 }
 
-// Connect to the remote WebSocket sensor data server.
+// Start a non-blocking connect to the remote WebSocket sensor data server.
+// Returns the socket, which becomes writable once the connect completes or
+// fails, or -1 if it could not be started.
 int connect_remote_ws(const char *ip, int port) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (fd < 0) {
-        perror("socket() remote");
+        ws_log_perror("socket() remote");
         return -1;
     }
     struct sockaddr_in addr;
@@ -50,16 +49,15 @@ int connect_remote_ws(const char *ip, int port) {
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
     if (inet_pton(AF_INET, ip, &addr.sin_addr) <= 0) {
-        perror("inet_pton()");
+        ws_log_perror("inet_pton()");
         close(fd);
         return -1;
     }
-    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("connect() remote");
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        ws_log_perror("connect() remote");
         close(fd);
         return -1;
     }
-    printf("Connected to remote WebSocket server at %s:%d\n", ip, port);
     return fd;
 }
 
@@ -67,7 +65,7 @@ int connect_remote_ws(const char *ip, int port) {
 static void parse_sensor_data(const char *data) {
     cJSON *root = cJSON_Parse(data);
     if (!root || !cJSON_IsArray(root)) {
-        printf("Error parsing JSON sensor data: %s\n", data);
+        ws_log_warn("Error parsing JSON sensor data: %s", data);
         if (root)
             cJSON_Delete(root);
         return;
@@ -104,6 +102,7 @@ static void parse_sensor_data(const char *data) {
             }
 
             set_sensor_warning(sd);
+            sensor_table_update(sd);
 
             // CSV Logging
             if (csv_file) {
@@ -120,7 +119,7 @@ static void parse_sensor_data(const char *data) {
                     redisReply *reply;
                     for (int i = 0; i < pipeline_count; i++) {
                         if (redisGetReply(redis_ctx, (void **)&reply) == REDIS_ERR) {
-                            printf("Redis error executing pipelined command\n");
+                            ws_log_error("Redis error executing pipelined command");
                         }
                         if (reply)
                             freeReplyObject(reply);
@@ -131,14 +130,10 @@ static void parse_sensor_data(const char *data) {
         }
     }
 
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    uint64_t current_time = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
-    if ((current_time - last_broadcast_time) >= 100) {
+    // Publish the newest frame; the broadcast timer sends it on its next tick.
+    if (sensor_buffer_count > 0) {
         memcpy(latest_sensor_buffer, sensor_buffer, sizeof(sensor_data_t) * sensor_buffer_count);
         latest_sensor_buffer_count = sensor_buffer_count;
-        broadcast_sensor_data();
-        last_broadcast_time = current_time;
     }
 
     memset(sensor_buffer, 0, sizeof(sensor_data_t) * sensor_buffer_count);
@@ -200,36 +195,152 @@ void set_sensor_warning(sensor_data_t *sd) {
 }
 
 /*-------------------- Remote WebSocket Handling --------------------*/
-void handle_remote_ws_read() {
-    uint8_t recv_buf[BUFFER_SIZE];
-    ssize_t n = recv(g_remote_fd, recv_buf, sizeof(recv_buf), 0);
-    if (n <= 0) {
-        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
-            return;
-        printf("Remote WS connection lost. Reconnecting in 10 seconds...\n");
-        close(g_remote_fd);
+static ws_reactor *remote_loop = NULL;
+static ws_handler remote_handler;
+static ws_decoder remote_decoder; // Frames from the sensor server, across reads
+static ws_timer remote_timer = {.fd = -1}; // Retry backoff, or the connect timeout
+static bool remote_connecting = false;     // g_remote_fd has a connect in flight
 
-        while ((g_remote_fd = connect_remote_ws(REMOTE_WS_IP, REMOTE_WS_PORT)) < 0) {
-            fprintf(stderr, "Reconnection attempt failed. Retrying in 10 seconds...\n");
-            sleep(1);
-        }
+static void remote_ws_retry(void);
 
-        struct epoll_event ev;
-        ev.events = EPOLLIN | EPOLLET;
-        ev.data.fd = g_remote_fd;
-        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, g_remote_fd, &ev) < 0) {
-            perror("epoll_ctl(): server_fd");
-            return;
+static void on_remote_ready(void *data, uint32_t events) {
+    (void)data;
+    (void)events;
+    ws_log_debug("Data from remote incoming");
+    handle_remote_ws_read();
+}
+
+static int on_remote_message(void *data, const ws_message *msg) {
+    (void)data;
+    if (msg->type == WS_TEXT_FRAME) {
+        char *text = strndup((const char *)msg->data, msg->len);
+        if (text) {
+            parse_sensor_data(text);
+            free(text);
         }
+    } else if (msg->type == WS_CLOSING_FRAME) {
+        ws_log_warn("Remote WS server sent CLOSE");
+        return 1;
+    }
+    return 0;
+}
+
+static int remote_reply(void *data, const uint8_t *frame, size_t len) {
+    (void)data;
+    if (send(g_remote_fd, frame, len, MSG_NOSIGNAL) < 0)
+        ws_log_perror("send() remote pong");
+    return 0;
+}
+
+// The connect finished one way or the other: start reading with a fresh
+// decoder (edge-triggered, so reads drain to EAGAIN), or schedule a retry.
+static void on_remote_connected(void *data, uint32_t events) {
+    (void)data;
+    (void)events;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(g_remote_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+    if (err == EINPROGRESS)
+        return;
+    remote_connecting = false;
+    ws_timer_set(&remote_timer, 0, 0);
+    if (err != 0) {
+        ws_log_warn("Failed to connect to remote WebSocket server at %s:%d: %s",
+                    REMOTE_WS_IP, REMOTE_WS_PORT, strerror(err));
+        remote_ws_retry();
         return;
     }
+    ws_log_info("Connected to remote WebSocket server at %s:%d", REMOTE_WS_IP, REMOTE_WS_PORT);
+    ws_decoder_free(&remote_decoder);
+    ws_decoder_init(&remote_decoder, WS_DECODER_CLIENT, REMOTE_MAX_MESSAGE,
+                    on_remote_message, remote_reply, NULL);
+    remote_handler.fn = on_remote_ready;
+    if (ws_reactor_mod(remote_loop, g_remote_fd, EPOLLIN | EPOLLET, &remote_handler) < 0)
+        remote_ws_retry();
+}
 
-    ws_frame frame;
-    memset(&frame, 0, sizeof(frame));
-    ws_parse_frame(&frame, recv_buf, n);
-    if (frame.type == WS_TEXT_FRAME && frame.payload) {
-        char *text = strndup((char *)frame.payload, frame.payload_length);
-        parse_sensor_data(text);
-        free(text);
+// Start a connect attempt; it completes in on_remote_connected() unless
+// REMOTE_CONNECT_TIMEOUT_MS passes first.
+static void remote_ws_connect(void) {
+    g_remote_fd = connect_remote_ws(REMOTE_WS_IP, REMOTE_WS_PORT);
+    if (g_remote_fd < 0) {
+        remote_ws_retry();
+        return;
     }
-}
\ No newline at end of file
+    remote_handler.fn = on_remote_connected;
+    remote_handler.data = NULL;
+    if (ws_reactor_add(remote_loop, g_remote_fd, EPOLLOUT | EPOLLET, &remote_handler) < 0) {
+        remote_ws_retry();
+        return;
+    }
+    remote_connecting = true;
+    ws_timer_set(&remote_timer, REMOTE_CONNECT_TIMEOUT_MS, 0);
+}
+
+// Drop the connection, if any, and try again after REMOTE_RETRY_MS. The
+// ingest loop keeps running meanwhile, so signals and broadcast ticks are
+// still handled while the remote is away.
+static void remote_ws_retry(void) {
+    if (g_remote_fd != -1)
+        close(g_remote_fd); // Also removes it from the loop
+    g_remote_fd = -1;
+    remote_connecting = false;
+    ws_log_warn("Retrying the remote WebSocket server in %d ms", REMOTE_RETRY_MS);
+    ws_timer_set(&remote_timer, REMOTE_RETRY_MS, 0);
+}
+
+static void on_remote_timer(void *data, uint64_t expirations) {
+    (void)data;
+    (void)expirations;
+    if (remote_connecting) {
+        ws_log_warn("Connecting to remote WebSocket server at %s:%d timed out",
+                    REMOTE_WS_IP, REMOTE_WS_PORT);
+        remote_ws_retry();
+    } else {
+        remote_ws_connect();
+    }
+}
+
+// Connect to the remote sensor server from the ingest loop, reconnecting
+// whenever the link drops. Returns -1 only if the retry timer cannot be set up.
+int remote_ws_start(ws_reactor *loop) {
+    remote_loop = loop;
+    if (ws_timer_start(loop, &remote_timer, 0, 0, on_remote_timer, NULL) < 0)
+        return -1;
+    remote_ws_connect();
+    return 0;
+}
+
+void remote_ws_stop(void) {
+    ws_timer_stop(remote_loop, &remote_timer);
+    remote_connecting = false;
+}
+
+// The socket is edge-triggered, so read until it would block; frames may
+// span reads or share one.
+void handle_remote_ws_read() {
+    while (1) {
+        uint8_t recv_buf[BUFFER_SIZE];
+        ssize_t n = recv(g_remote_fd, recv_buf, sizeof(recv_buf), 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            if (n == 0)
+                ws_log_warn("Remote WS connection closed");
+            else
+                ws_log_perror("recv() remote");
+            remote_ws_retry();
+            return;
+        }
+        int ret = ws_decoder_feed(&remote_decoder, recv_buf, (size_t)n);
+        if (ret == WS_DECODE_ERROR)
+            ws_log_error("Remote WS protocol error (close code %u)", remote_decoder.close_code);
+        if (ret != 0) {
+            remote_ws_retry();
+            return;
+        }
+    }
+}
@@ -1,5 +1,6 @@
 #include "rtsp2ws_video.h"
-#include "video_ws.h"       // Provides g_video_clients, g_video_clients_mutex, etc.
+#include "video_ws.h"       // Provides video_broadcast()
+#include "config.h"         // VIDEO_MAX_CAMERAS
 #include "websocket.h"
 
 #include <libavformat/avformat.h>
@@ -7,30 +8,91 @@
 #include <libavutil/avutil.h>
 
 #include <pthread.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-#define MAX_PKT 2000000
+// A camera's streaming thread
+typedef struct {
+    int camera;           // Index for video_broadcast()
+    const char *rtsp_url; // Owned by video_ws.c
+    pthread_t thread;
+} video_source_t;
 
-static const char *g_rtsp_url = NULL;
+static video_source_t g_sources[VIDEO_MAX_CAMERAS];
+static int g_source_count = 0;
+// Set by rtsp_video_stop(), under g_video_mutex; blocking FFmpeg calls poll
+// it through their interrupt callback and retry waits wake on g_video_cond.
 static volatile int g_video_shutdown = 0;
-static pthread_t g_video_thread;
+static pthread_mutex_t g_video_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_video_cond = PTHREAD_COND_INITIALIZER;
+
+static int video_interrupted(void *opaque) {
+    (void)opaque;
+    return g_video_shutdown;
+}
+
+// Wait a second before reconnecting, or less if the module is stopping.
+static void video_retry_wait(void) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    pthread_mutex_lock(&g_video_mutex);
+    while (!g_video_shutdown &&
+           pthread_cond_timedwait(&g_video_cond, &g_video_mutex, &deadline) != ETIMEDOUT)
+        ;
+    pthread_mutex_unlock(&g_video_mutex);
+}
 
 //
-// Broadcast a WebSocket frame to all video clients (managed by video_ws.c)
+// Broadcast a small binary frame (codec configuration) to a camera's video
+// clients (managed by video_ws.c). The payload is copied into the message.
 //
-static void broadcast_video_frame(uint8_t *wsbuf, size_t wslen) {
-    pthread_mutex_lock(&g_video_clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (g_video_clients[i].fd != -1 && g_video_clients[i].handshake_done) {
-            if (send(g_video_clients[i].fd, wsbuf, wslen, 0) < 0) {
-                perror("send() video client");
-            }
-        }
+static void broadcast_video_frame(int camera, const uint8_t *payload, size_t len) {
+    ws_msg *msg = ws_msg_new(WS_MAX_HEADER_LEN + len);
+    if (!msg) {
+        ws_log_perror("ws_msg_new() video");
+        return;
+    }
+    msg->len = ws_frame_header(WS_BINARY_FRAME, 0, len, msg->data);
+    memcpy(msg->data + msg->len, payload, len);
+    msg->len += len;
+    video_broadcast(camera, msg);
+    ws_msg_unref(msg);
+}
+
+static void release_packet(void *owner) {
+    AVPacket *packet = owner;
+    av_packet_free(&packet);
+}
+
+//
+// Broadcast a demuxed packet without copying it: the message takes a new
+// reference to the packet's buffer and carries only the frame header, and
+// every client queue shares it until the last one has sent it.
+//
+static void broadcast_video_packet(int camera, enum AVCodecID codec, const AVPacket *packet) {
+    AVPacket *ref = av_packet_clone(packet);
+    if (!ref) {
+        ws_log_error("av_packet_clone() failed, dropping a video frame");
+        return;
     }
-    pthread_mutex_unlock(&g_video_clients_mutex);
+    uint8_t header[WS_MAX_HEADER_LEN];
+    size_t header_len = ws_frame_header(WS_BINARY_FRAME, 0, ref->size, header);
+    ws_msg *msg = ws_msg_wrap(header, header_len, ref->data, ref->size, release_packet, ref);
+    if (!msg) {
+        release_packet(ref);
+        return;
+    }
+    ws_codec wc = codec == AV_CODEC_ID_H264 ? WS_CODEC_H264 :
+                  codec == AV_CODEC_ID_HEVC ? WS_CODEC_HEVC : WS_CODEC_OTHER;
+    msg->flags = ws_frame_flags(wc, ref->flags & AV_PKT_FLAG_KEY, ref->flags & AV_PKT_FLAG_DISPOSABLE,
+                                ref->data, ref->size);
+    video_broadcast(camera, msg);
+    ws_msg_unref(msg);
 }
 
 //
@@ -38,7 +100,7 @@ static void broadcast_video_frame(uint8_t *wsbuf, size_t wslen) {
 // and send them as a configuration record (avcC) to the clients.
 // Returns 0 on success, -1 on failure.
 //
-static int send_config_from_packet(AVPacket *pkt, AVCodecContext *ctx, uint8_t *wsbuf, size_t *wslen) {
+static int send_config_from_packet(int camera, AVPacket *pkt, AVCodecContext *ctx) {
     // Assume pkt->data is in Annex B format.
     uint8_t *data = pkt->data;
     int size = pkt->size;
@@ -69,7 +131,7 @@ static int send_config_from_packet(AVPacket *pkt, AVCodecContext *ctx, uint8_t *
     }
     
     if (!sps || !pps || sps_size <= 0 || pps_size <= 0) {
-        fprintf(stderr, "[ERROR] Could not extract SPS/PPS from packet\n");
+        ws_log_error("Could not extract SPS/PPS from packet");
         return -1;
     }
     
@@ -77,7 +139,7 @@ static int send_config_from_packet(AVPacket *pkt, AVCodecContext *ctx, uint8_t *
     int avcc_size = 5 + 1 + 2 + sps_size + 1 + 2 + pps_size;
     uint8_t *avcc = malloc(avcc_size);
     if (!avcc) {
-        perror("malloc");
+        ws_log_perror("malloc");
         return -1;
     }
     int offset = 0;
@@ -99,24 +161,22 @@ static int send_config_from_packet(AVPacket *pkt, AVCodecContext *ctx, uint8_t *
     memcpy(&avcc[offset], pps, pps_size);
     offset += pps_size;
 
-    // Create a WebSocket binary frame from the configuration.
-    ws_create_binary_frame(avcc, offset, wsbuf, wslen);
+    broadcast_video_frame(camera, avcc, offset);
     free(avcc);
     return 0;
 }
 
 //
-// The video stream thread: opens the RTSP stream, sets up the decoder,
+// A camera's stream thread: opens the RTSP stream, sets up the decoder,
 // sends SPS/PPS configuration immediately if possible (or on first keyframe),
-// and then continuously broadcasts video frames.
+// and then continuously broadcasts video frames until rtsp_video_stop().
 //
 static void *video_stream_thread(void *arg) {
-    (void)arg;
+    video_source_t *src = arg;
+    int camera = src->camera;
     int ret;
     int video_stream_index = -1;
     int sent_sps = 0;
-    uint8_t wsbuf[10 + MAX_PKT];
-    size_t wslen = 0;
     
     AVDictionary *opts = NULL;
     AVFormatContext *fmt_ctx = NULL;
@@ -124,51 +184,59 @@ static void *video_stream_thread(void *arg) {
     AVPacket *packet = NULL;
     
     while (!g_video_shutdown) {
-        printf("[VIDEO] Opening RTSP stream: %s\n", g_rtsp_url);
+        ws_log_info("[VIDEO] Opening RTSP stream: %s", src->rtsp_url);
         
+        // The interrupt callback lets rtsp_video_stop() end blocking reads.
+        fmt_ctx = avformat_alloc_context();
+        if (!fmt_ctx) {
+            ws_log_error("avformat_alloc_context failed");
+            video_retry_wait();
+            continue;
+        }
+        fmt_ctx->interrupt_callback.callback = video_interrupted;
         av_dict_set(&opts, "rtsp_transport", "tcp", 0);
         av_dict_set(&opts, "max_delay", "500000", 0);  // 500ms delay
         
-        ret = avformat_open_input(&fmt_ctx, g_rtsp_url, NULL, &opts);
+        ret = avformat_open_input(&fmt_ctx, src->rtsp_url, NULL, &opts);
         av_dict_free(&opts);
         if (ret < 0) {
-            fprintf(stderr, "[ERROR] avformat_open_input failed (%d)\n", ret);
-            sleep(1);
+            ws_log_error("avformat_open_input failed (%d)", ret);
+            video_retry_wait();
             continue;
         }
         
         if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0) {
-            fprintf(stderr, "[ERROR] avformat_find_stream_info failed (%d)\n", ret);
+            ws_log_error("avformat_find_stream_info failed (%d)", ret);
             avformat_close_input(&fmt_ctx);
-            sleep(1);
+            video_retry_wait();
             continue;
         }
         
         video_stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
         if (video_stream_index < 0) {
-            fprintf(stderr, "[ERROR] No video stream found\n");
+            ws_log_error("No video stream found");
             avformat_close_input(&fmt_ctx);
-            sleep(1);
+            video_retry_wait();
             continue;
         }
-        printf("[DEBUG] Found video stream index: %d\n", video_stream_index);
+        ws_log_debug("Found video stream index: %d", video_stream_index);
         
         AVCodecParameters *codecpar = fmt_ctx->streams[video_stream_index]->codecpar;
         const AVCodec *decoder = avcodec_find_decoder(codecpar->codec_id);
         if (!decoder) {
-            fprintf(stderr, "[ERROR] Unsupported codec (%d)\n", codecpar->codec_id);
+            ws_log_error("Unsupported codec (%d)", codecpar->codec_id);
             avformat_close_input(&fmt_ctx);
-            sleep(1);
+            video_retry_wait();
             continue;
         }
         
         codec_ctx = avcodec_alloc_context3(decoder);
         if (!codec_ctx || avcodec_parameters_to_context(codec_ctx, codecpar) < 0) {
-            fprintf(stderr, "[ERROR] Failed to copy codec parameters to context\n");
+            ws_log_error("Failed to copy codec parameters to context");
             if (codec_ctx)
                 avcodec_free_context(&codec_ctx);
             avformat_close_input(&fmt_ctx);
-            sleep(1);
+            video_retry_wait();
             continue;
         }
         
@@ -176,30 +244,29 @@ static void *video_stream_thread(void *arg) {
         codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
         
         if (avcodec_open2(codec_ctx, decoder, NULL) < 0) {
-            fprintf(stderr, "[ERROR] Failed to open decoder\n");
+            ws_log_error("Failed to open decoder");
             avcodec_free_context(&codec_ctx);
             avformat_close_input(&fmt_ctx);
-            sleep(1);
+            video_retry_wait();
             continue;
         }
         
         // Immediately send extradata if available.
         if (codec_ctx->extradata && codec_ctx->extradata_size > 0) {
-            printf("[DEBUG] Sending extradata immediately (size: %d)\n", codec_ctx->extradata_size);
-            ws_create_binary_frame(codec_ctx->extradata, codec_ctx->extradata_size, wsbuf, &wslen);
-            broadcast_video_frame(wsbuf, wslen);
+            ws_log_debug("Sending extradata immediately (size: %d)", codec_ctx->extradata_size);
+            broadcast_video_frame(camera, codec_ctx->extradata, codec_ctx->extradata_size);
             sent_sps = 1;
         } else {
-            fprintf(stderr, "[WARN] extradata missing or empty after decoder init\n");
+            ws_log_warn("extradata missing or empty after decoder init");
             sent_sps = 0;
         }
         
         packet = av_packet_alloc();
         if (!packet) {
-            fprintf(stderr, "[ERROR] av_packet_alloc failed\n");
+            ws_log_error("av_packet_alloc failed");
             avcodec_free_context(&codec_ctx);
             avformat_close_input(&fmt_ctx);
-            sleep(1);
+            video_retry_wait();
             continue;
         }
         
@@ -210,62 +277,66 @@ static void *video_stream_thread(void *arg) {
                 continue;
             }
             
-            printf("[DEBUG] Packet received: size=%d, keyframe=%d\n", packet->size, packet->flags & AV_PKT_FLAG_KEY);
+            ws_log_debug("Packet received: size=%d, keyframe=%d", packet->size, packet->flags & AV_PKT_FLAG_KEY);
             
             // If extradata hasn't been sent, try to send it from the keyframe.
             if (!sent_sps && (packet->flags & AV_PKT_FLAG_KEY)) {
                 if (codec_ctx->extradata && codec_ctx->extradata_size > 0) {
-                    printf("[DEBUG] Sending extradata after first keyframe (size: %d)\n", codec_ctx->extradata_size);
-                    ws_create_binary_frame(codec_ctx->extradata, codec_ctx->extradata_size, wsbuf, &wslen);
-                    broadcast_video_frame(wsbuf, wslen);
+                    ws_log_debug("Sending extradata after first keyframe (size: %d)", codec_ctx->extradata_size);
+                    broadcast_video_frame(camera, codec_ctx->extradata, codec_ctx->extradata_size);
                     sent_sps = 1;
                 } else {
-                    printf("[DEBUG] extradata missing; attempting extraction from keyframe packet\n");
-                    if (send_config_from_packet(packet, codec_ctx, wsbuf, &wslen) == 0) {
-                        broadcast_video_frame(wsbuf, wslen);
+                    ws_log_debug("extradata missing; attempting extraction from keyframe packet");
+                    if (send_config_from_packet(camera, packet, codec_ctx) == 0)
                         sent_sps = 1;
-                    }
                 }
             }
             
             // Broadcast the current video frame.
-            ws_create_binary_frame(packet->data, packet->size, wsbuf, &wslen);
-            broadcast_video_frame(wsbuf, wslen);
+            broadcast_video_packet(camera, codecpar->codec_id, packet);
             
             av_packet_unref(packet);
         }
         
-        if (ret != AVERROR_EOF)
-            fprintf(stderr, "[ERROR] av_read_frame failed (%d)\n", ret);
+        if (ret < 0 && ret != AVERROR_EOF && !g_video_shutdown)
+            ws_log_error("av_read_frame failed (%d)", ret);
         
         av_packet_free(&packet);
         avcodec_free_context(&codec_ctx);
         avformat_close_input(&fmt_ctx);
         
-        sleep(1);
+        video_retry_wait();
     }
     
     return NULL;
 }
 
-int rtsp_video_init(const char *rtsp_url) {
-    if (!rtsp_url)
+int rtsp_video_start(int camera, const char *rtsp_url) {
+    if (!rtsp_url || g_source_count == VIDEO_MAX_CAMERAS)
         return -1;
-    g_rtsp_url = rtsp_url;
-    g_video_shutdown = 0;
-    avformat_network_init();
-    return 0;
-}
-
-int rtsp_video_start(void) {
-    if (pthread_create(&g_video_thread, NULL, video_stream_thread, NULL) != 0) {
-        perror("pthread_create() video");
+    if (g_source_count == 0) {
+        g_video_shutdown = 0;
+        avformat_network_init();
+    }
+    video_source_t *src = &g_sources[g_source_count];
+    src->camera = camera;
+    src->rtsp_url = rtsp_url;
+    if (pthread_create(&src->thread, NULL, video_stream_thread, src) != 0) {
+        ws_log_perror("pthread_create() video");
         return -1;
     }
+    g_source_count++;
     return 0;
 }
 
 void rtsp_video_stop(void) {
+    if (g_source_count == 0)
+        return;
+    pthread_mutex_lock(&g_video_mutex);
     g_video_shutdown = 1;
-    pthread_join(g_video_thread, NULL);
+    pthread_cond_broadcast(&g_video_cond);
+    pthread_mutex_unlock(&g_video_mutex);
+    while (g_source_count > 0)
+        pthread_join(g_sources[--g_source_count].thread, NULL);
+    avformat_network_deinit();
 }
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // accept4
 #include "video_ws.h"
 #include "websocket.h"
 #include <stdio.h>
@@ -6,35 +7,195 @@
 #include <unistd.h>
 #include <errno.h>
 #include <arpa/inet.h>
-#include <sys/epoll.h>
 #include <pthread.h>
 #include "wshandshake.h"
+#include "rtsp2ws_video.h"
+#include "config.h"
 
-int g_video_server_fd = -1;
-client_t *g_video_clients = NULL; // Separate array for video clients
-pthread_mutex_t g_video_clients_mutex = PTHREAD_MUTEX_INITIALIZER;
-int g_video_epoll_fd = -1;
+#include <inttypes.h>
 
+// A camera, served to the viewers that connect on its path. Its cache lets
+// a new viewer start decoding at once instead of waiting for the next
+// keyframe. The cache is video thread only; the counters are atomic and
+// reset by video_report_stats().
+typedef struct {
+    char path[VIDEO_PATH_MAX];
+    char url[VIDEO_URL_MAX];
+    ws_gop_cache cache;
+    int viewers;       // Upgraded clients watching it
+    uint64_t frames;   // Frames received from the stream
+    uint64_t dropped;  // Frames skipped for its lagging viewers
+} video_camera_t;
 
+static video_camera_t video_cameras[VIDEO_MAX_CAMERAS];
+static int video_camera_count = 0;
 
-void handle_video_client_read(client_t *client) {
+static int video_listen_fd = -1;
+static client_table_t video_clients; // Only touched by the video thread
+static ws_reactor video_loop;        // Woken by the streaming threads for new frames
+static ws_handler video_listener;
+static ws_wheel video_wheel; // Handshake timeouts and keepalive pings
+static pthread_t video_thread;
+static bool video_running = false; // Between video_start() and video_stop()
+static ws_gop_burst video_gop_burst;
+
+static const ws_lag_limits video_lag_limits = {
+    .disposable_frames = VIDEO_LAG_DISPOSABLE_FRAMES,
+    .skip_frames = VIDEO_LAG_SKIP_FRAMES,
+    .high_bytes = VIDEO_QUEUE_HIGH_BYTES,
+};
+
+static void handle_new_video_client(void);
+
+// Frames handed over by the streaming threads, tagged with their camera.
+// The lock is held only to append or take them; fanout and sends run on
+// the video thread.
+#define VIDEO_INBOX_SIZE 256
+typedef struct {
+    int camera;
+    ws_msg *msg;
+} video_inbox_entry_t;
+static video_inbox_entry_t video_inbox[VIDEO_INBOX_SIZE];
+static int video_inbox_count = 0;
+static pthread_mutex_t video_inbox_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Release a video client's slot; closing the fd also drops it from epoll.
+static void close_video_client(client_t *client) {
+    ws_wheel_cancel(&video_wheel, &client->deadline);
+    if (client->handshake_done) {
+        __atomic_sub_fetch(&video_cameras[client->camera].viewers, 1, __ATOMIC_RELAXED);
+        ws_log_info("Video client FD %d stats: %llu frames sent, %llu dropped, "
+                    "skipped to a keyframe %u times, peak lag %u frames / %zu bytes, rtt %u us",
+                    client->fd, (unsigned long long)client->outq.sent_msgs,
+                    (unsigned long long)client->viewer.dropped, client->viewer.skips,
+                    client->viewer.peak_lag, client->peak_queued, client->keepalive.rtt_us);
+    }
+    ws_tls_close(&client->tls);
+    close(client->fd);
+    ws_queue_free(&client->outq);
+    client->handshake_done = false;
+    client->peak_queued = 0;
+    ws_viewer_reset(&client->viewer);
+    client_table_release(&video_clients, client);
+}
+
+// Queue a message for a video client without writing it, subject to the
+// VIDEO_LAG_* policy: slow viewers get a lower frame rate and never a
+// corrupt stream.
+static void video_client_queue(client_t *client, ws_msg *msg) {
+    if (ws_viewer_queue(&client->viewer, &client->outq, msg, &video_lag_limits, client->fd) == 0 &&
+        client->outq.bytes > client->peak_queued)
+        client->peak_queued = client->outq.bytes;
+}
+
+// Queue a message for a video client and write out what the socket takes.
+static void video_client_send(client_t *client, ws_msg *msg) {
+    video_client_queue(client, msg);
+    if (ws_queue_flush(&client->outq, client->fd) < 0) {
+        ws_log_perror("send() video client");
+        close_video_client(client);
+    }
+}
+
+// Queue an encoded control frame behind the video frames already queued,
+// so it never lands inside one.
+static void video_client_send_frame(client_t *client, const uint8_t *frame, size_t len) {
+    ws_msg *msg = ws_msg_new(len);
+    if (!msg)
+        return;
+    memcpy(msg->data, frame, len);
+    video_client_send(client, msg);
+    ws_msg_unref(msg);
+}
+
+// Ping an upgraded video client, or drop it if it stopped answering.
+static void on_video_keepalive(void *data) {
+    client_t *client = data;
+    uint8_t ping[WS_PING_FRAME_LEN];
+    if (ws_keepalive_ping(&client->keepalive, monotonic_us(), KEEPALIVE_MAX_MISSED, ping) < 0) {
+        ws_log_info("Video client FD %d missed %d pongs, closing", client->fd, KEEPALIVE_MAX_MISSED);
+        close_video_client(client);
+        return;
+    }
+    video_client_send_frame(client, ping, sizeof(ping));
+    if (client->fd != -1)
+        ws_wheel_schedule(&video_wheel, &client->deadline, KEEPALIVE_INTERVAL_MS);
+}
+
+// Video clients only send control frames; watch for pongs and close.
+static int on_video_client_message(void *data, const ws_message *msg) {
+    client_t *client = data;
+    if (msg->type == WS_PONG_FRAME) {
+        ws_keepalive_pong(&client->keepalive, msg->data, msg->len, monotonic_us());
+    } else if (msg->type == WS_CLOSING_FRAME) {
+        ws_log_info("Video client FD %d sent CLOSE (rtt %u us)", client->fd,
+                    client->keepalive.rtt_us);
+        close_video_client(client);
+        return 1;
+    }
+    return 0;
+}
+
+// Bring a new client up in one write from its camera's cache, as much of
+// it as the configured GOP burst asks for.
+static void video_send_join_burst(client_t *client) {
+    ws_gop_cache *cache = &video_cameras[client->camera].cache;
+    int frames = ws_viewer_join(&client->viewer, &client->outq, cache, video_gop_burst);
+    if (client->outq.bytes > client->peak_queued)
+        client->peak_queued = client->outq.bytes;
+    if (ws_queue_flush(&client->outq, client->fd) < 0) {
+        ws_log_perror("send() video client");
+        close_video_client(client);
+        return;
+    }
+    if (cache->config || frames > 0)
+        ws_log_info("Sent video client FD %d %s%d cached frames", client->fd,
+                    cache->config ? "configuration and " : "", frames);
+}
+
+// Decoder callback that queues the automatic pong.
+static int video_client_reply(void *data, const uint8_t *frame, size_t len) {
+    client_t *client = data;
+    video_client_send_frame(client, frame, len);
+    return client->fd == -1;
+}
+
+// The camera a handshake URI asks for, ignoring any query string, or -1.
+static int video_route(const char *uri) {
+    size_t len = strcspn(uri, "?");
+    for (int i = 0; i < video_camera_count; i++) {
+        if (strlen(video_cameras[i].path) == len && strncmp(video_cameras[i].path, uri, len) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void handle_video_client_read(client_t *client) {
+    // A fresh socket has room for the server's handshake flight, so waiting
+    // for input is enough to drive it.
+    int tls = ws_tls_handshake(&client->tls);
+    if (tls <= 0) {
+        if (tls < 0) {
+            ws_log_info("Video client FD %d TLS handshake failed.", client->fd);
+            close_video_client(client);
+        }
+        return;
+    }
     while (1) {
         uint8_t recv_buf[BUFFER_SIZE];
-        ssize_t n = recv(client->fd, recv_buf, sizeof(recv_buf), 0);
+        ssize_t n = ws_tls_recv(&client->tls, client->fd, recv_buf, sizeof(recv_buf));
         if (n <= 0) {
             if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
                 break;
-            printf("Video client FD %d disconnected.\n", client->fd);
-            close(client->fd);
-            client->fd = -1;
+            ws_log_info("Video client FD %d disconnected.", client->fd);
+            close_video_client(client);
             break;
         }
 
         if (!client->handshake_done) {
             if (client->buffer_len + n > BUFFER_SIZE) {
-                printf("Video handshake buffer overflow for client FD %d\n", client->fd);
-                close(client->fd);
-                client->fd = -1;
+                ws_log_warn("Video handshake buffer overflow for client FD %d", client->fd);
+                close_video_client(client);
                 break;
             }
             memcpy(client->buffer + client->buffer_len, recv_buf, n);
@@ -43,134 +204,363 @@ void handle_video_client_read(client_t *client) {
             http_header header;
             memset(&header, 0, sizeof(header));
             size_t out_len = BUFFER_SIZE;
-            ws_handshake(&header, client->buffer, client->buffer_len, &out_len);
+            ws_handshake(&header, &client->handshake_scanned, client->buffer, client->buffer_len, &out_len);
             if (header.type == WS_OPENING_FRAME) {
-                send(client->fd, client->buffer, out_len, 0);
-                client->handshake_done = true;
-                printf("Video client FD %d handshake done\n", client->fd);
-                client->buffer_len = 0;
+                client->camera = video_route(header.uri);
+                if (client->camera < 0) {
+                    static const char not_found[] = "HTTP/1.1 404 Not Found\r\n"
+                                                    "Content-Length: 0\r\n"
+                                                    "Connection: close\r\n\r\n";
+                    send(client->fd, not_found, sizeof(not_found) - 1, MSG_NOSIGNAL);
+                    ws_log_warn("Video client FD %d asked for unknown camera %s", client->fd, header.uri);
+                    close_video_client(client);
+                    break;
+                }
+                send(client->fd, client->buffer, out_len, MSG_NOSIGNAL);
+                if (ws_queue_init(&client->outq, VIDEO_QUEUE_MSGS) < 0) {
+                    ws_log_perror("ws_queue_init()");
+                    close_video_client(client);
+                    break;
+                }
+                if (client_handshake_finished(client, on_video_client_message, video_client_reply) < 0) {
+                    ws_log_perror("malloc() decoder");
+                    close_video_client(client);
+                    break;
+                }
+                ws_wheel_cancel(&video_wheel, &client->deadline);
+                ws_deadline_init(&client->deadline, on_video_keepalive, client);
+                ws_keepalive_reset(&client->keepalive);
+                ws_wheel_schedule(&video_wheel, &client->deadline, KEEPALIVE_INTERVAL_MS);
+                __atomic_add_fetch(&video_cameras[client->camera].viewers, 1, __ATOMIC_RELAXED);
+                ws_log_info("Video client FD %d handshake done, camera %s", client->fd,
+                            video_cameras[client->camera].path);
+                video_send_join_burst(client);
+                if (client->fd == -1)
+                    break;
+            } else if (out_len > 0) {
+                // Not a valid upgrade: send the error response and close
+                send(client->fd, client->buffer, out_len, MSG_NOSIGNAL);
+                close_video_client(client);
+                break;
             }
         } else {
-            // If you ever want to accept input from video clients, handle it here.
+            int ret = ws_decoder_feed(client->decoder, recv_buf, (size_t)n);
+            if (ret == WS_DECODE_ERROR) {
+                ws_log_info("Video client FD %d protocol error, closing with %u", client->fd,
+                            client->decoder->close_code);
+                uint8_t close_frame[4];
+                size_t close_len;
+                ws_create_close_frame(client->decoder->close_code, close_frame, &close_len);
+                video_client_send_frame(client, close_frame, close_len);
+                if (client->fd != -1)
+                    close_video_client(client);
+            }
+            if (ret != 0)
+                break;
         }
     }
 }
 
+// Hand a camera's frame to the video thread, which queues a reference for
+// every upgraded client watching it. Called from the streaming threads.
+void video_broadcast(int camera, ws_msg *msg) {
+    bool full = false, wake = false;
+    pthread_mutex_lock(&video_inbox_mutex);
+    if (video_inbox_count < VIDEO_INBOX_SIZE) {
+        video_inbox[video_inbox_count].camera = camera;
+        video_inbox[video_inbox_count++].msg = ws_msg_ref(msg);
+        wake = video_inbox_count == 1;
+    } else {
+        full = true;
+    }
+    pthread_mutex_unlock(&video_inbox_mutex);
+    if (wake)
+        ws_reactor_wake(&video_loop);
+    if (full)
+        ws_log_warn("Video thread fell behind, dropping a frame");
+}
+
+// Queue every frame waiting in the inbox for each upgraded client of its
+// camera, then write each of those clients out once; what the socket does
+// not take goes out on EPOLLOUT. Runs on the video thread after a wakeup.
+static void video_drain_inbox(void *data) {
+    (void)data;
+    video_inbox_entry_t frames[VIDEO_INBOX_SIZE];
+    pthread_mutex_lock(&video_inbox_mutex);
+    int count = video_inbox_count;
+    memcpy(frames, video_inbox, count * sizeof(frames[0]));
+    video_inbox_count = 0;
+    pthread_mutex_unlock(&video_inbox_mutex);
+    for (int f = 0; f < count; f++) {
+        video_camera_t *cam = &video_cameras[frames[f].camera];
+        if (frames[f].msg->flags & WS_MSG_FRAME)
+            __atomic_add_fetch(&cam->frames, 1, __ATOMIC_RELAXED);
+        ws_gop_cache_add(&cam->cache, frames[f].msg);
+    }
+
+    for (int i = video_clients.active_count - 1; i >= 0; i--) {
+        client_t *client = video_clients.active[i];
+        if (!client->handshake_done)
+            continue;
+        int queued = 0;
+        uint64_t dropped = client->viewer.dropped;
+        for (int f = 0; f < count; f++) {
+            if (frames[f].camera != client->camera)
+                continue;
+            video_client_queue(client, frames[f].msg);
+            queued++;
+        }
+        if (client->viewer.dropped != dropped)
+            __atomic_add_fetch(&video_cameras[client->camera].dropped,
+                               client->viewer.dropped - dropped, __ATOMIC_RELAXED);
+        if (queued > 0 && ws_queue_flush(&client->outq, client->fd) < 0) {
+            ws_log_perror("send() video client");
+            close_video_client(client);
+        }
+    }
+    for (int f = 0; f < count; f++)
+        ws_msg_unref(frames[f].msg);
+}
+
+static void on_video_listener_ready(void *data, uint32_t events) {
+    (void)data;
+    (void)events;
+    handle_new_video_client();
+}
+
+static void on_video_handshake_timeout(void *data) {
+    client_t *client = data;
+    ws_log_info("Video client FD %d did not complete the handshake in %d ms, closing",
+                client->fd, HANDSHAKE_TIMEOUT_MS);
+    close_video_client(client);
+}
 
-int init_video_server(int port) {
-    g_video_server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (g_video_server_fd < 0) {
-        perror("socket()");
+// Write out what a client's queue still holds once its socket has room.
+static void handle_video_client_write(client_t *client) {
+    if (!client->handshake_done)
+        return;
+    if (ws_queue_flush(&client->outq, client->fd) < 0) {
+        ws_log_perror("send() video client");
+        close_video_client(client);
+    }
+}
+
+static void on_video_client_ready(void *data, uint32_t events) {
+    client_t *client = data;
+    if (client->fd != -1 && (events & EPOLLOUT))
+        handle_video_client_write(client);
+    if (client->fd != -1 && ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ||
+                             client->tls.state == WS_TLS_HANDSHAKE))
+        handle_video_client_read(client);
+}
+
+// Give an accepted (non-blocking) socket a video client slot and register it.
+static void add_video_client(int client_fd) {
+    client_t *client = client_table_alloc(&video_clients, client_fd);
+    if (!client) {
+        ws_log_warn("Video client limit reached, rejecting connection.");
+        send_busy_response(client_fd);
+        close(client_fd);
+        return;
+    }
+    if (ws_tls_accept(&client->tls, g_tls_ctx, client_fd) < 0) {
+        close(client_fd);
+        client_table_release(&video_clients, client);
+        return;
+    }
+    client->io.fn = on_video_client_ready;
+    client->io.data = client;
+    if (ws_reactor_add(&video_loop, client_fd, EPOLLIN | EPOLLOUT | EPOLLET, &client->io) < 0) {
+        ws_tls_close(&client->tls);
+        close(client_fd);
+        client_table_release(&video_clients, client);
+    } else {
+        ws_deadline_init(&client->deadline, on_video_handshake_timeout, client);
+        ws_wheel_schedule(&video_wheel, &client->deadline, HANDSHAKE_TIMEOUT_MS);
+        ws_log_info("New video client connected. FD = %d", client_fd);
+    }
+}
+
+// Drain pending video connections, at most ACCEPT_BATCH_MAX per wakeup.
+static void handle_new_video_client(void) {
+    for (int n = 0; n < ACCEPT_BATCH_MAX; n++) {
+        int client_fd = accept4(video_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                ws_log_perror("accept4() video");
+            return;
+        }
+        add_video_client(client_fd);
+    }
+}
+
+// Add a camera read from the camera file. Paths must be absolute and unique.
+static int video_add_camera(const char *path, const char *url) {
+    if (video_camera_count == VIDEO_MAX_CAMERAS) {
+        ws_log_error("Too many video cameras (at most %d)", VIDEO_MAX_CAMERAS);
         return -1;
     }
-    int opt = 1;
-    if (setsockopt(g_video_server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt()");
-        close(g_video_server_fd);
+    if (path[0] != '/' || strlen(path) >= VIDEO_PATH_MAX || strlen(url) >= VIDEO_URL_MAX) {
+        ws_log_error("Invalid video camera %s", path);
         return -1;
     }
-    struct sockaddr_in serv;
-    memset(&serv, 0, sizeof(serv));
-    serv.sin_family = AF_INET;
-    serv.sin_addr.s_addr = INADDR_ANY;
-    serv.sin_port = htons(port);
-    if (bind(g_video_server_fd, (struct sockaddr *)&serv, sizeof(serv)) < 0) {
-        perror("bind()");
-        close(g_video_server_fd);
+    for (int i = 0; i < video_camera_count; i++) {
+        if (strcmp(video_cameras[i].path, path) == 0) {
+            ws_log_error("Video camera path %s listed twice", path);
+            return -1;
+        }
+    }
+    video_camera_t *cam = &video_cameras[video_camera_count++];
+    memset(cam, 0, sizeof(*cam));
+    strcpy(cam->path, path);
+    strcpy(cam->url, url);
+    return 0;
+}
+
+// Read the camera file: one "<path> <rtsp_url>" per line, skipping blank
+// lines and '#' comments. A missing file means no cameras.
+static int video_load_cameras(const char *file) {
+    FILE *f = fopen(file, "r");
+    if (!f) {
+        if (errno == ENOENT)
+            return 0;
+        ws_log_error("%s: %s", file, strerror(errno));
         return -1;
     }
-    if (listen(g_video_server_fd, 10) < 0) {
-        perror("listen()");
-        close(g_video_server_fd);
+    char line[VIDEO_PATH_MAX + VIDEO_URL_MAX + 64];
+    int lineno = 0;
+    int ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+        char *path = strtok(p, " \t\r\n");
+        char *url = strtok(NULL, " \t\r\n");
+        if (!url || strtok(NULL, " \t\r\n")) {
+            ws_log_error("%s:%d: expected \"<path> <rtsp_url>\"", file, lineno);
+            ret = -1;
+        } else {
+            ret = video_add_camera(path, url);
+        }
+    }
+    fclose(f);
+    return ret;
+}
+
+static void *video_main(void *arg) {
+    (void)arg;
+    if (ws_reactor_run(&video_loop) < 0)
+        ws_log_error("Video server loop failed");
+
+    // Shutting down: queue a close frame for every upgraded video client.
+    // Clients still in the HTTP or TLS handshake are just closed.
+    uint8_t close_buf[WS_MAX_HEADER_LEN];
+    size_t close_size = sizeof(close_buf);
+    ws_create_closing_frame(close_buf, &close_size);
+    while (video_clients.active_count > 0) {
+        client_t *client = video_clients.active[video_clients.active_count - 1];
+        if (client->handshake_done)
+            video_client_send_frame(client, close_buf, close_size);
+        if (client->fd != -1)
+            close_video_client(client);
+    }
+    return NULL;
+}
+
+// Release everything video_start() set up once the loop is not running.
+static void video_close(void) {
+    if (video_listen_fd != -1)
+        close(video_listen_fd);
+    video_listen_fd = -1;
+    ws_wheel_free(&video_wheel, &video_loop);
+    ws_reactor_free(&video_loop);
+    client_table_free(&video_clients);
+    pthread_mutex_lock(&video_inbox_mutex);
+    while (video_inbox_count > 0)
+        ws_msg_unref(video_inbox[--video_inbox_count].msg);
+    pthread_mutex_unlock(&video_inbox_mutex);
+    for (int i = 0; i < video_camera_count; i++)
+        ws_gop_cache_free(&video_cameras[i].cache);
+    video_camera_count = 0;
+}
+
+// Start the video server: read the cameras from camera_file, serve them on
+// port from one video thread, and start a streaming thread per camera.
+// New viewers get gop_burst of the cached GOP. With no cameras configured
+// video stays off and this succeeds.
+int video_start(int port, const char *camera_file, ws_gop_burst gop_burst) {
+    if (video_load_cameras(camera_file) < 0) {
+        video_camera_count = 0;
         return -1;
     }
-    set_nonblocking(g_video_server_fd);
+    if (video_camera_count == 0) {
+        ws_log_info("No cameras in %s, video is off", camera_file);
+        return 0;
+    }
+    video_gop_burst = gop_burst;
 
-    g_video_epoll_fd = epoll_create1(0);
-    if (g_video_epoll_fd < 0) {
-        perror("epoll_create1()");
-        close(g_video_server_fd);
+    if (ws_reactor_init(&video_loop, video_drain_inbox, NULL) < 0) {
+        video_camera_count = 0;
         return -1;
     }
-    struct epoll_event ev;
-    ev.events = EPOLLIN;
-    ev.data.fd = g_video_server_fd;
-    if (epoll_ctl(g_video_epoll_fd, EPOLL_CTL_ADD, g_video_server_fd, &ev) < 0) {
-        perror("epoll_ctl() video server");
-        close(g_video_server_fd);
+    if (ws_wheel_init(&video_wheel, &video_loop, TIMER_WHEEL_TICK_MS) < 0) {
+        ws_reactor_free(&video_loop);
+        video_camera_count = 0;
         return -1;
     }
-
-    g_video_clients = calloc(MAX_CLIENTS, sizeof(client_t));
-    if (!g_video_clients) {
-        fprintf(stderr, "Failed to allocate video clients\n");
-        close(g_video_server_fd);
+    video_listen_fd = init_frontend_server(port);
+    video_listener.fn = on_video_listener_ready;
+    video_listener.data = NULL;
+    if (video_listen_fd < 0 || client_table_init(&video_clients, VIDEO_CLIENT_LIMIT) < 0 ||
+        ws_reactor_add(&video_loop, video_listen_fd, EPOLLIN, &video_listener) < 0) {
+        video_close();
+        return -1;
+    }
+    if (pthread_create(&video_thread, NULL, video_main, NULL) != 0) {
+        ws_log_perror("pthread_create() video server");
+        video_close();
         return -1;
     }
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        g_video_clients[i].fd = -1;
-        g_video_clients[i].handshake_done = false;
-        g_video_clients[i].buffer_len = 0;
+    video_running = true;
+
+    for (int i = 0; i < video_camera_count; i++) {
+        if (rtsp_video_start(i, video_cameras[i].url) < 0) {
+            video_stop();
+            return -1;
+        }
+        ws_log_info("Video camera %s: %s", video_cameras[i].path, video_cameras[i].url);
     }
-    printf("Video WebSocket server listening on port %d\n", port);
+    ws_log_info("Video WebSocket server listening on port %d with %d cameras", port,
+                video_camera_count);
     return 0;
 }
 
-void handle_new_video_client() {
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-    int client_fd = accept(g_video_server_fd, (struct sockaddr *)&client_addr, &addr_len);
-    if (client_fd < 0) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK)
-            perror("accept() video");
+// Stop and join the streaming threads first, so nothing is posted after
+// the video thread is gone, then the video thread, which closes its
+// clients. Safe to call when video is off.
+void video_stop(void) {
+    if (!video_running)
         return;
-    }
-    set_nonblocking(client_fd);
-
-    pthread_mutex_lock(&g_video_clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (g_video_clients[i].fd == -1) {
-            g_video_clients[i].fd = client_fd;
-            g_video_clients[i].handshake_done = false;
-            g_video_clients[i].buffer_len = 0;
-            struct epoll_event ev;
-            ev.events = EPOLLIN | EPOLLET;
-            ev.data.ptr = &g_video_clients[i];
-            if (epoll_ctl(g_video_epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
-                perror("epoll_ctl() video client");
-                close(client_fd);
-                g_video_clients[i].fd = -1;
-            } else {
-                printf("New video client connected. FD = %d\n", client_fd);
-            }
-            pthread_mutex_unlock(&g_video_clients_mutex);
-            return;
-        }
-    }
-    pthread_mutex_unlock(&g_video_clients_mutex);
-    printf("Max video clients reached, rejecting connection.\n");
-    close(client_fd);
+    rtsp_video_stop();
+    ws_reactor_stop(&video_loop);
+    pthread_join(video_thread, NULL);
+    video_close();
+    video_running = false;
 }
 
-void video_epoll_loop() {
-    struct epoll_event events[64];
-    while (1) {
-        int nfds = epoll_wait(g_video_epoll_fd, events, 64, 1000);
-        if (nfds < 0) {
-            if (errno == EINTR) continue;
-            perror("epoll_wait() video");
-            break;
-        }
-        for (int i = 0; i < nfds; i++) {
-            if (events[i].data.fd == g_video_server_fd) {
-                handle_new_video_client();
-            } else {
-                client_t *client = (client_t *)events[i].data.ptr;
-                if (client && client->fd != -1) {
-                    handle_video_client_read(client);
-                }
-            }
-        }
+// Log and reset each camera's counters; called with the broadcast stats.
+void video_report_stats(void) {
+    if (!video_running)
+        return;
+    for (int i = 0; i < video_camera_count; i++) {
+        video_camera_t *cam = &video_cameras[i];
+        uint64_t frames = __atomic_exchange_n(&cam->frames, 0, __ATOMIC_RELAXED);
+        uint64_t dropped = __atomic_exchange_n(&cam->dropped, 0, __ATOMIC_RELAXED);
+        ws_log_info("Video camera %s: %" PRIu64 " frames, %d viewers, %" PRIu64
+                    " frames dropped for lagging viewers",
+                    cam->path, frames, __atomic_load_n(&cam->viewers, __ATOMIC_RELAXED), dropped);
     }
 }
-
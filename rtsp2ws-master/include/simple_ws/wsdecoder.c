@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+#include "wsdecoder.h"
+
+#define WS_DECODER_BUF_SIZE 65536 /* Pooled reassembly buffers */
+#define WS_DECODER_POOL_MAX 32    /* Idle buffers kept for reuse */
+
+static uint8_t *buf_pool[WS_DECODER_POOL_MAX];
+static int buf_pool_count;
+static pthread_mutex_t buf_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint8_t *ws_decoder_buf_get(void)
+{
+    uint8_t *buf = NULL;
+    pthread_mutex_lock(&buf_pool_mutex);
+    if (buf_pool_count > 0)
+        buf = buf_pool[--buf_pool_count];
+    pthread_mutex_unlock(&buf_pool_mutex);
+    return buf ? buf : malloc(WS_DECODER_BUF_SIZE);
+}
+
+/* Pool-sized buffers go back to the pool, grown ones are freed */
+static void ws_decoder_buf_put(uint8_t *buf, size_t cap)
+{
+    if (!buf)
+        return;
+    if (cap == WS_DECODER_BUF_SIZE)
+    {
+        pthread_mutex_lock(&buf_pool_mutex);
+        if (buf_pool_count < WS_DECODER_POOL_MAX)
+        {
+            buf_pool[buf_pool_count++] = buf;
+            buf = NULL;
+        }
+        pthread_mutex_unlock(&buf_pool_mutex);
+    }
+    free(buf);
+}
+
+/* Sets up a decoder. Messages over max_message bytes fail with
+ * WS_CLOSE_TOO_BIG. reply may be NULL to ignore pings. */
+void ws_decoder_init(ws_decoder *d, ws_decoder_role role, size_t max_message,
+                     ws_message_fn on_message, ws_reply_fn reply, void *data)
+{
+    memset(d, 0, sizeof(*d));
+    d->role = role;
+    d->max_message = max_message;
+    d->on_message = on_message;
+    d->reply = reply;
+    d->data = data;
+}
+
+/* Drops any partial frame or message, e.g. after a reconnect */
+void ws_decoder_reset(ws_decoder *d)
+{
+    ws_decoder_buf_put(d->msg, d->msg_cap);
+    d->msg = NULL;
+    d->msg_len = 0;
+    d->msg_cap = 0;
+    d->msg_opcode = 0;
+    d->header_len = 0;
+    d->in_payload = 0;
+    d->close_code = 0;
+}
+
+void ws_decoder_free(ws_decoder *d)
+{
+    ws_decoder_reset(d);
+}
+
+/* Unmasked close frame carrying a status code (server to client) */
+void ws_create_close_frame(uint16_t code, uint8_t out_data[4], size_t *out_len)
+{
+    uint8_t payload[2] = {(uint8_t)(code >> 8), (uint8_t)code};
+    ws_create_control_frame(WS_CLOSING_FRAME, payload, sizeof(payload), out_data, out_len);
+}
+
+static int ws_decoder_fail(ws_decoder *d, uint16_t code)
+{
+    d->close_code = code;
+    return WS_DECODE_ERROR;
+}
+
+/* Header size implied by its first two bytes */
+static size_t ws_header_size(const uint8_t *h)
+{
+    size_t size = 2;
+    if ((h[1] & 0x7F) == 0x7E)
+        size += 2;
+    else if ((h[1] & 0x7F) == 0x7F)
+        size += 8;
+    if (h[1] & 0x80)
+        size += 4;
+    return size;
+}
+
+/* Validates a complete header and starts its frame */
+static int ws_decoder_begin_frame(ws_decoder *d, const uint8_t *h)
+{
+    uint8_t opcode = h[0] & 0x0F;
+    uint8_t rsv1 = (h[0] & 0x40) != 0;
+    uint64_t len = h[1] & 0x7F;
+    size_t pos = 2;
+
+    d->fin = (h[0] & 0x80) != 0;
+    d->masked = (h[1] & 0x80) != 0;
+    if (h[0] & 0x30)
+        return ws_decoder_fail(d, WS_CLOSE_PROTOCOL_ERROR); /* RSV2/RSV3 */
+    if (d->masked != (d->role == WS_DECODER_SERVER))
+        return ws_decoder_fail(d, WS_CLOSE_PROTOCOL_ERROR);
+
+    if (len == 0x7E)
+    {
+        len = ((uint64_t)h[2] << 8) | h[3];
+        pos = 4;
+    }
+    else if (len == 0x7F)
+    {
+        len = 0;
+        for (int i = 0; i < 8; i++)
+            len = (len << 8) | h[2 + i];
+        pos = 10;
+        if (len >> 63)
+            return ws_decoder_fail(d, WS_CLOSE_PROTOCOL_ERROR);
+    }
+    if (d->masked)
+        memcpy(d->mask, h + pos, 4);
+
+    switch (opcode)
+    {
+    case 0x0: /* Continuation */
+        if (!d->msg_opcode || rsv1)
+            return ws_decoder_fail(d, WS_CLOSE_PROTOCOL_ERROR);
+        break;
+    case WS_TEXT_FRAME:
+    case WS_BINARY_FRAME:
+        if (d->msg_opcode)
+            return ws_decoder_fail(d, WS_CLOSE_PROTOCOL_ERROR);
+        d->msg_rsv1 = rsv1;
+        break;
+    case WS_CLOSING_FRAME:
+    case WS_PING_FRAME:
+    case WS_PONG_FRAME:
+        if (!d->fin || rsv1 || len > WS_CONTROL_MAX)
+            return ws_decoder_fail(d, WS_CLOSE_PROTOCOL_ERROR);
+        break;
+    default:
+        return ws_decoder_fail(d, WS_CLOSE_PROTOCOL_ERROR);
+    }
+    if (opcode < WS_CLOSING_FRAME && len > d->max_message - d->msg_len)
+        return ws_decoder_fail(d, WS_CLOSE_TOO_BIG);
+
+    d->opcode = opcode;
+    d->remaining = len;
+    d->offset = 0;
+    d->in_payload = 1;
+    return 0;
+}
+
+/* Unmasks payload bytes that start offset bytes into the frame */
+static void ws_decoder_unmask(ws_decoder *d, uint8_t *p, size_t len, uint64_t offset)
+{
+    if (!d->masked)
+        return;
+    uint8_t key[4];
+    for (int k = 0; k < 4; k++)
+        key[k] = d->mask[(offset + k) & 3];
+    ws_mask_payload(p, len, key);
+}
+
+/* Handles a complete control frame; pings are answered here */
+static int ws_decoder_control(ws_decoder *d, uint8_t opcode, const uint8_t *payload, size_t len)
+{
+    if (opcode == WS_PING_FRAME)
+    {
+        if (!d->reply)
+            return 0;
+        uint8_t frame[2 + 4 + WS_CONTROL_MAX];
+        size_t frame_len;
+        ws_frame pong = {.payload_length = len, .payload = (uint8_t *)payload, .type = WS_PONG_FRAME};
+        if (d->role == WS_DECODER_CLIENT)
+        {
+            uint8_t key[4];
+            if (getrandom(key, sizeof(key), 0) != sizeof(key))
+                memset(key, 0, sizeof(key));
+            ws_create_masked_frame(&pong, key, frame, &frame_len);
+        }
+        else
+        {
+            ws_create_frame(&pong, frame, &frame_len);
+        }
+        return d->reply(d->data, frame, frame_len) ? WS_DECODE_STOP : 0;
+    }
+    if (opcode == WS_CLOSING_FRAME && len == 1)
+        return ws_decoder_fail(d, WS_CLOSE_PROTOCOL_ERROR);
+    ws_message msg = {.type = (wsFrameType)opcode, .rsv1 = 0, .data = payload, .len = len};
+    return d->on_message(d->data, &msg) ? WS_DECODE_STOP : 0;
+}
+
+/* Emits the reassembled message and returns its buffer to the pool */
+static int ws_decoder_finish_message(ws_decoder *d)
+{
+    ws_message msg = {.type = (wsFrameType)d->msg_opcode, .rsv1 = d->msg_rsv1,
+                      .data = d->msg ? d->msg : (const uint8_t *)"", .len = d->msg_len};
+    int stop = d->on_message(d->data, &msg);
+    /* The callback may have freed or reset the decoder along with its
+     * connection; it must return non-zero if it did. */
+    if (stop)
+        return WS_DECODE_STOP;
+    ws_decoder_buf_put(d->msg, d->msg_cap);
+    d->msg = NULL;
+    d->msg_len = 0;
+    d->msg_cap = 0;
+    d->msg_opcode = 0;
+    return 0;
+}
+
+/* Makes room for need more bytes in the reassembly buffer */
+static int ws_decoder_reserve(ws_decoder *d, size_t need)
+{
+    if (d->msg_len + need <= d->msg_cap)
+        return 0;
+    if (!d->msg && need <= WS_DECODER_BUF_SIZE)
+    {
+        d->msg = ws_decoder_buf_get();
+        if (!d->msg)
+            return -1;
+        d->msg_cap = WS_DECODER_BUF_SIZE;
+        return 0;
+    }
+    size_t cap = d->msg_cap ? d->msg_cap : WS_DECODER_BUF_SIZE;
+    while (cap < d->msg_len + need)
+        cap *= 2;
+    uint8_t *grown = realloc(d->msg, cap);
+    if (!grown)
+        return -1;
+    d->msg = grown;
+    d->msg_cap = cap;
+    return 0;
+}
+
+/* Consumes len bytes of the stream. Returns 0 once all are consumed,
+ * WS_DECODE_STOP if the message callback returned non-zero (the decoder
+ * must not be touched again if the callback freed it), or WS_DECODE_ERROR
+ * with close_code set. Payload bytes are unmasked in place in data. */
+int ws_decoder_feed(ws_decoder *d, uint8_t *data, size_t len)
+{
+    while (len > 0)
+    {
+        if (!d->in_payload)
+        {
+            const uint8_t *h;
+            size_t size;
+            if (d->header_len == 0 && len >= 2 && len >= ws_header_size(data))
+            {
+                /* Whole header in this chunk: parse it where it is */
+                h = data;
+                size = ws_header_size(data);
+            }
+            else
+            {
+                size_t want = d->header_len < 2 ? 2 : ws_header_size(d->header);
+                size_t take = want - d->header_len;
+                if (take > len)
+                    take = len;
+                memcpy(d->header + d->header_len, data, take);
+                d->header_len += take;
+                data += take;
+                len -= take;
+                if (d->header_len < 2 || d->header_len < ws_header_size(d->header))
+                    continue;
+                h = d->header;
+                size = 0;
+            }
+            if (ws_decoder_begin_frame(d, h) < 0)
+                return WS_DECODE_ERROR;
+            d->header_len = 0;
+            data += size;
+            len -= size;
+
+            /* Fast path: the whole payload is here and needs no assembly */
+            if (d->remaining <= len && (d->opcode >= WS_CLOSING_FRAME || (d->fin && d->opcode != 0)))
+            {
+                size_t n = (size_t)d->remaining;
+                ws_decoder_unmask(d, data, n, 0);
+                d->in_payload = 0;
+                int ret;
+                if (d->opcode >= WS_CLOSING_FRAME)
+                {
+                    ret = ws_decoder_control(d, d->opcode, data, n);
+                }
+                else
+                {
+                    ws_message msg = {.type = (wsFrameType)d->opcode, .rsv1 = d->msg_rsv1, .data = data, .len = n};
+                    ret = d->on_message(d->data, &msg) ? WS_DECODE_STOP : 0;
+                }
+                if (ret != 0)
+                    return ret;
+                data += n;
+                len -= n;
+                continue;
+            }
+            if (d->opcode != 0 && d->opcode < WS_CLOSING_FRAME)
+                d->msg_opcode = d->opcode;
+        }
+
+        /* Payload bytes of a frame being assembled */
+        size_t n = d->remaining < len ? (size_t)d->remaining : len;
+        if (d->opcode >= WS_CLOSING_FRAME)
+        {
+            memcpy(d->control + d->offset, data, n);
+            ws_decoder_unmask(d, d->control + d->offset, n, d->offset);
+        }
+        else
+        {
+            if (ws_decoder_reserve(d, n) < 0)
+                return ws_decoder_fail(d, WS_CLOSE_TOO_BIG);
+            memcpy(d->msg + d->msg_len, data, n);
+            ws_decoder_unmask(d, d->msg + d->msg_len, n, d->offset);
+            d->msg_len += n;
+        }
+        d->offset += n;
+        d->remaining -= n;
+        data += n;
+        len -= n;
+        if (d->remaining > 0)
+            break;
+
+        d->in_payload = 0;
+        int ret = 0;
+        if (d->opcode >= WS_CLOSING_FRAME)
+            ret = ws_decoder_control(d, d->opcode, d->control, (size_t)d->offset);
+        else if (d->fin)
+            ret = ws_decoder_finish_message(d);
+        if (ret != 0)
+            return ret;
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+#ifndef __WS_DECODER_H
+#define __WS_DECODER_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "websocket.h"
+
+/* Streaming RFC 6455 decoder. Bytes are fed in whatever chunks recv()
+ * returns; complete messages come out through a callback. A message that
+ * arrives as one unfragmented frame inside a single chunk is unmasked in
+ * place and handed out without copying. Fragmented or split messages are
+ * reassembled in a pooled buffer. Pings are answered automatically; pongs
+ * and close frames are passed up like messages. */
+
+#define WS_CLOSE_NORMAL 1000
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_TOO_BIG 1009
+
+#define WS_CONTROL_MAX 125 /* Largest control frame payload */
+
+#define WS_DECODE_STOP 1   /* The message callback asked to stop */
+#define WS_DECODE_ERROR -1 /* Protocol violation; see close_code */
+
+typedef enum
+{
+    WS_DECODER_SERVER, /* Decodes client frames, which must be masked */
+    WS_DECODER_CLIENT  /* Decodes server frames, which must not be; replies are masked */
+} ws_decoder_role;
+
+typedef struct
+{
+    wsFrameType type;    /* WS_TEXT_FRAME, WS_BINARY_FRAME, WS_PONG_FRAME or WS_CLOSING_FRAME */
+    uint8_t rsv1;        /* Set on the first frame (permessage-deflate) */
+    const uint8_t *data; /* Valid only during the callback */
+    size_t len;
+} ws_message;
+
+/* Returns non-zero to stop decoding, e.g. after closing the connection. */
+typedef int (*ws_message_fn)(void *data, const ws_message *msg);
+/* Sends an encoded control frame (the automatic pong); non-zero stops
+ * decoding like ws_message_fn. */
+typedef int (*ws_reply_fn)(void *data, const uint8_t *frame, size_t len);
+
+typedef struct
+{
+    ws_decoder_role role;
+    size_t max_message;
+    ws_message_fn on_message;
+    ws_reply_fn reply;
+    void *data;
+
+    uint8_t header[14]; /* Partial frame header carried between chunks */
+    uint8_t header_len;
+    uint8_t opcode;     /* Current frame */
+    uint8_t fin;
+    uint8_t masked;
+    uint8_t mask[4];
+    uint64_t remaining; /* Payload bytes of the current frame still to come */
+    uint64_t offset;    /* Payload bytes of the current frame seen so far */
+    int in_payload;
+
+    uint8_t *msg;       /* Reassembly buffer, from the pool while in use */
+    size_t msg_len;
+    size_t msg_cap;
+    uint8_t msg_opcode; /* 0 when no fragmented message is open */
+    uint8_t msg_rsv1;
+
+    uint8_t control[WS_CONTROL_MAX];
+    uint16_t close_code; /* Reason for WS_DECODE_ERROR */
+} ws_decoder;
+
+void ws_decoder_init(ws_decoder *d, ws_decoder_role role, size_t max_message,
+                     ws_message_fn on_message, ws_reply_fn reply, void *data);
+void ws_decoder_reset(ws_decoder *d);
+void ws_decoder_free(ws_decoder *d);
+int ws_decoder_feed(ws_decoder *d, uint8_t *data, size_t len);
+void ws_create_close_frame(uint16_t code, uint8_t out_data[4], size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WS_DECODER_H */
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <strings.h>
 #include "wshandshake.h"
 
 #ifdef _WIN32
@@ -9,117 +10,194 @@
 #define strdup _strdup
 #endif
 
-/* Reads a line from the HTTP request buffer */
-static int http_header_readline(char *in, char *buf, size_t len)
+/* Trims leading and trailing spaces of [*start, *end) */
+static void http_trim(const char **start, const char **end)
 {
-    char *ptr = buf;
-    char *ptr_end = buf + len - 1;
+    while (*start < *end && (**start == ' ' || **start == '\t'))
+        (*start)++;
+    while (*end > *start && ((*end)[-1] == ' ' || (*end)[-1] == '\t'))
+        (*end)--;
+}
+
+/* Case-insensitive comparison of [start, end) against a token */
+static int http_token_eq(const char *start, const char *end, const char *token)
+{
+    size_t len = strlen(token);
+    return (size_t)(end - start) == len && strncasecmp(start, token, len) == 0;
+}
 
-    while (ptr < ptr_end)
+/* Checks one permessage-deflate offer's parameters. We always compress with
+ * a 15-bit window and no context takeover, so offers that restrict the
+ * server window or carry unknown parameters are declined. */
+static int http_deflate_params_ok(const char *p, const char *end)
+{
+    while (p < end)
     {
-        *ptr = *in++;
-        if (*ptr == '\0')
-            break;
-        if (*ptr == '\r')
-            continue;
-        if (*ptr == '\n')
+        const char *next = memchr(p, ';', end - p);
+        const char *param_end = next ? next : end;
+        const char *eq = memchr(p, '=', param_end - p);
+        const char *name = p;
+        const char *name_end = eq ? eq : param_end;
+        http_trim(&name, &name_end);
+
+        if (http_token_eq(name, name_end, "server_max_window_bits"))
+        {
+            const char *v = eq ? eq + 1 : param_end;
+            while (v < param_end && (*v == ' ' || *v == '"'))
+                v++;
+            if (v == param_end || atoi(v) < 15)
+                return 0;
+        }
+        else if (name != name_end &&
+                 !http_token_eq(name, name_end, "client_max_window_bits") &&
+                 !http_token_eq(name, name_end, "server_no_context_takeover") &&
+                 !http_token_eq(name, name_end, "client_no_context_takeover"))
         {
-            *ptr = '\0';
-            return ptr - buf;
+            return 0;
         }
-        ptr++;
+        p = next ? next + 1 : end;
     }
-    *ptr = '\0';
-    return ptr - buf;
+    return 1;
 }
 
-/* Parses individual HTTP headers */
-static int http_parse_headers(http_header *header, char *hdr_line)
+/* Parses a Sec-WebSocket-Extensions value [p, end) into WS_EXT_* bits */
+static uint8_t http_parse_extensions(const char *p, const char *end)
 {
-    char *p = strchr(hdr_line, ':');
-    if (!p)
-        return -1;
+    uint8_t ext = 0;
+
+    while (p < end)
+    {
+        const char *next = memchr(p, ',', end - p);
+        const char *offer_end = next ? next : end;
+        const char *semi = memchr(p, ';', offer_end - p);
+        const char *name = p;
+        const char *name_end = semi ? semi : offer_end;
+        http_trim(&name, &name_end);
+
+        if (http_token_eq(name, name_end, "permessage-deflate") &&
+            (!semi || http_deflate_params_ok(semi + 1, offer_end)))
+        {
+            ext |= WS_EXT_DEFLATE;
+        }
+        p = next ? next + 1 : end;
+    }
+    return ext;
+}
 
-    *p = '\0'; // Split name and value
-    char *header_content = p + 1;
+/* Copies [start, end) into a fixed-size, NUL-terminated field */
+static void http_copy_field(char *dst, size_t size, const char *start, const char *end)
+{
+    size_t len = (size_t)(end - start);
+    if (len > size - 1)
+        len = size - 1;
+    memcpy(dst, start, len);
+    dst[len] = '\0';
+}
 
-    // Trim leading spaces
-    while (*header_content == ' ')
-        header_content++;
+/* Parses one header line [line, end), without its CRLF, in place */
+static void http_parse_header(http_header *header, const char *line, const char *end)
+{
+    const char *colon = memchr(line, ':', end - line);
+    if (!colon)
+        return;
+    const char *name = line;
+    const char *name_end = colon;
+    const char *value = colon + 1;
+    const char *value_end = end;
+    http_trim(&name, &name_end);
+    http_trim(&value, &value_end);
 
-    if (strncmp(WS_HDR_UPG, hdr_line, strlen(WS_HDR_UPG)) == 0)
+    if (http_token_eq(name, name_end, WS_HDR_UPG))
     {
-        header->upgrade = (strncmp(WS_WEBSOCK, header_content, strlen(WS_WEBSOCK)) == 0);
+        header->upgrade = http_token_eq(value, value_end, WS_WEBSOCK);
     }
-    else if (strncmp(WS_HDR_VER, hdr_line, strlen(WS_HDR_VER)) == 0)
+    else if (http_token_eq(name, name_end, WS_HDR_VER))
     {
-        header->version = (uint8_t)atoi(header_content);
+        unsigned version = 0;
+        while (value < value_end && *value >= '0' && *value <= '9' && version < 256)
+            version = version * 10 + (unsigned)(*value++ - '0');
+        header->version = version < 256 ? (uint8_t)version : 0;
     }
-    else if (strncmp(WS_HDR_KEY, hdr_line, strlen(WS_HDR_KEY)) == 0)
+    else if (http_token_eq(name, name_end, WS_HDR_KEY))
     {
-        strncpy(header->key, header_content, sizeof(header->key) - 1);
-        header->key[sizeof(header->key) - 1] = '\0';
+        http_copy_field(header->key, sizeof(header->key), value, value_end);
+    }
+    else if (http_token_eq(name, name_end, WS_HDR_EXT))
+    {
+        header->extensions |= http_parse_extensions(value, value_end);
     }
-
-    *p = ':'; // Restore separator
-    return 0;
 }
 
 /* Parses the first request line (GET /path HTTP/1.1) */
-static int http_parse_request_line(http_header *header, char *hdr_line)
+static void http_parse_request_line(http_header *header, const char *line, const char *end)
 {
-    char *token = strtok(hdr_line, " ");
-    if (token)
-        strncpy(header->method, token, sizeof(header->method) - 1);
-
-    token = strtok(NULL, " ");
-    if (token)
-        strncpy(header->uri, token, sizeof(header->uri) - 1);
+    const char *sp = memchr(line, ' ', end - line);
+    if (!sp)
+        return;
+    http_copy_field(header->method, sizeof(header->method), line, sp);
+    const char *uri = sp + 1;
+    const char *uri_end = memchr(uri, ' ', end - uri);
+    http_copy_field(header->uri, sizeof(header->uri), uri, uri_end ? uri_end : end);
+}
 
+/* Finds the blank line ending the request headers in buf[0, len). The
+ * search resumes at *scanned, so bytes already seen are not scanned again
+ * as more of the request arrives. Returns the header length including the
+ * blank line, or 0 if it has not arrived yet. */
+size_t ws_http_request_end(const uint8_t *buf, size_t len, size_t *scanned)
+{
+    size_t pos = *scanned;
+    while (pos < len)
+    {
+        const uint8_t *lf = memchr(buf + pos, '\n', len - pos);
+        if (!lf)
+            break;
+        size_t i = (size_t)(lf - buf);
+        if (i >= 3 && lf[-1] == '\r' && lf[-2] == '\n' && lf[-3] == '\r')
+        {
+            *scanned = i + 1;
+            return i + 1;
+        }
+        pos = i + 1;
+    }
+    *scanned = len;
     return 0;
 }
 
-/* Parses the entire WebSocket handshake request */
-static void ws_http_parse_handshake_header(http_header *header, uint8_t *in_buf, size_t in_len)
+/* Parses a complete request [in_buf, in_buf + in_len) in a single pass.
+ * Lines are split with memchr and matched in place; nothing is copied
+ * except the fields kept in the header, and no state is shared between
+ * calls, so handshakes can run on any number of threads. */
+static void ws_http_parse_handshake_header(http_header *header, const uint8_t *in_buf, size_t in_len)
 {
-    char header_line[256];
-    int res;
-    int count = 0;
+    const char *p = (const char *)in_buf;
+    const char *end = p + in_len;
+    uint8_t accepted_ext = header->extensions;
+    int first = 1;
 
     header->type = WS_ERROR_FRAME;
+    header->extensions = 0;
 
-    /* We read lines until we run out of buffer (in_len) or get an empty line. */
-    while (in_len > 0)
+    while (p < end)
     {
-        size_t read_limit = (in_len < sizeof(header_line) - 1) ? in_len : (sizeof(header_line) - 1);
-
-        res = http_header_readline((char *)in_buf, header_line, read_limit);
-        if (res <= 0)
-            break;
-
-        size_t consumed = res + 2;
-
-        // If we might have read only '\n' (no '\r'), adjust if needed.
-        // But let's keep it simple for a typical CRLF scenario.
-        if (consumed > in_len)
-            break;
+        const char *lf = memchr(p, '\n', end - p);
+        const char *line_end = lf ? lf : end;
+        if (line_end > p && line_end[-1] == '\r')
+            line_end--;
+        if (line_end == p)
+            break; // Blank line: end of headers
 
-        // Parse the line
-        if (count == 0)
-        {
-            http_parse_request_line(header, header_line);
-        }
+        if (first)
+            http_parse_request_line(header, p, line_end);
         else
-        {
-            http_parse_headers(header, header_line);
-        }
-        count++;
-
-        // Advance the buffer pointer
-        in_buf += consumed;
-        in_len -= consumed;
+            http_parse_header(header, p, line_end);
+        first = 0;
+        p = lf ? lf + 1 : end;
     }
 
+    /* Keep only the extensions both sides agreed on. */
+    header->extensions &= accepted_ext;
+
     /* If we have a key AND the version is correct => mark as opening frame. */
     if (header->key[0] && header->version == WS_VERSION)
     {
@@ -146,6 +224,10 @@ static int ws_make_accept_key(const char *key, char *out_key, size_t *out_len)
     return (int)*out_len;
 }
 
+/* Extension response line for the only deflate variant we speak */
+#define WS_DEFLATE_RESPONSE WS_HDR_EXT ": permessage-deflate; " \
+                            "server_no_context_takeover; client_no_context_takeover\r\n"
+
 /* Generates the WebSocket handshake response */
 static void ws_get_handshake_header(http_header *header, uint8_t *out_buff, size_t *out_len)
 {
@@ -160,10 +242,12 @@ static void ws_get_handshake_header(http_header *header, uint8_t *out_buff, size
                            "HTTP/1.1 101 Switching Protocols\r\n"
                            "%s: %s\r\n"
                            "%s: %s\r\n"
-                           "%s: %s\r\n\r\n",
+                           "%s: %s\r\n"
+                           "%s\r\n",
                            WS_HDR_UPG, WS_WEBSOCK,
                            WS_HDR_CON, WS_HDR_UPG,
-                           WS_HDR_ACP, new_key);
+                           WS_HDR_ACP, new_key,
+                           (header->extensions & WS_EXT_DEFLATE) ? WS_DEFLATE_RESPONSE : "");
     }
     else
     {
@@ -178,10 +262,21 @@ static void ws_get_handshake_header(http_header *header, uint8_t *out_buff, size
     *out_len = written;
 }
 
-/* Handles the WebSocket handshake */
-int ws_handshake(http_header *header, uint8_t *in_buf, size_t in_len, size_t *out_len)
+/* Handles the WebSocket handshake on the bytes received so far. *scanned
+ * starts at 0 for a new connection and carries the search position between
+ * calls. Until the request is complete, header->type is WS_INCOMPLETE_FRAME,
+ * *out_len is 0 and in_buf is left alone; afterwards the response replaces
+ * the request in in_buf. */
+int ws_handshake(http_header *header, size_t *scanned, uint8_t *in_buf, size_t in_len, size_t *out_len)
 {
-    ws_http_parse_handshake_header(header, in_buf, in_len);
+    size_t request_len = ws_http_request_end(in_buf, in_len, scanned);
+    if (request_len == 0)
+    {
+        header->type = WS_INCOMPLETE_FRAME;
+        *out_len = 0;
+        return 0;
+    }
+    ws_http_parse_handshake_header(header, in_buf, request_len);
     ws_get_handshake_header(header, in_buf, out_len);
     return 0;
 }
\ No newline at end of file
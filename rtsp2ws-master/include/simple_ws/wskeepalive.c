@@ -0,0 +1,85 @@
+#include <string.h>
+
+#include "wskeepalive.h"
+#include "websocket.h"
+
+void ws_keepalive_reset(ws_keepalive *k)
+{
+    memset(k, 0, sizeof(*k));
+}
+
+/* Call once per keepalive interval. Returns -1 once max_missed pings in a
+ * row went unanswered (the peer is gone), otherwise writes a ping frame of
+ * WS_PING_FRAME_LEN bytes to out and returns 0. */
+int ws_keepalive_ping(ws_keepalive *k, uint64_t now_us, unsigned max_missed,
+                      uint8_t out[WS_PING_FRAME_LEN])
+{
+    if (k->ping_sent_us && ++k->missed >= max_missed)
+        return -1;
+    uint8_t stamp[8];
+    for (int i = 0; i < 8; i++)
+        stamp[i] = (uint8_t)(now_us >> (56 - 8 * i));
+    size_t len;
+    ws_create_control_frame(WS_PING_FRAME, stamp, sizeof(stamp), out, &len);
+    k->ping_sent_us = now_us;
+    return 0;
+}
+
+/* Handles a pong payload (already unmasked). Returns the round trip in
+ * microseconds, or -1 if it does not answer the outstanding ping. */
+int64_t ws_keepalive_pong(ws_keepalive *k, const uint8_t *payload, size_t len, uint64_t now_us)
+{
+    if (!k->ping_sent_us || len != 8)
+        return -1;
+    uint64_t stamp = 0;
+    for (int i = 0; i < 8; i++)
+        stamp = (stamp << 8) | payload[i];
+    if (stamp != k->ping_sent_us)
+        return -1;
+    uint64_t rtt = now_us >= stamp ? now_us - stamp : 0;
+    k->ping_sent_us = 0;
+    k->missed = 0;
+    k->rtt_us = rtt > UINT32_MAX ? UINT32_MAX : (uint32_t)rtt;
+    return (int64_t)rtt;
+}
+
+void ws_rtt_record(ws_rtt_hist *h, uint64_t rtt_us)
+{
+    int b = 0;
+    while (b < WS_RTT_BUCKETS - 1 && rtt_us >= (1ull << b))
+        b++;
+    __atomic_add_fetch(&h->buckets[b], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+    while (rtt_us > max &&
+           !__atomic_compare_exchange_n(&h->max_us, &max, rtt_us, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Summarizes and clears the histogram. */
+void ws_rtt_take(ws_rtt_hist *h, ws_rtt_summary *out)
+{
+    uint64_t counts[WS_RTT_BUCKETS];
+    memset(out, 0, sizeof(*out));
+    for (int b = 0; b < WS_RTT_BUCKETS; b++)
+    {
+        counts[b] = __atomic_exchange_n(&h->buckets[b], 0, __ATOMIC_RELAXED);
+        out->samples += counts[b];
+    }
+    out->max_us = __atomic_exchange_n(&h->max_us, 0, __ATOMIC_RELAXED);
+    if (out->samples == 0)
+        return;
+
+    uint64_t *targets[3] = {&out->p50_us, &out->p90_us, &out->p99_us};
+    const unsigned pct[3] = {50, 90, 99};
+    uint64_t seen = 0;
+    int t = 0;
+    for (int b = 0; b < WS_RTT_BUCKETS && t < 3; b++)
+    {
+        seen += counts[b];
+        while (t < 3 && seen * 100 >= out->samples * pct[t])
+        {
+            uint64_t bound = 1ull << b;
+            *targets[t++] = bound < out->max_us ? bound : out->max_us;
+        }
+    }
+}
@@ -0,0 +1,563 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "wslog.h"
+
+#define WS_LOG_SLOT_SIZE 256    /* Bytes per record, header included */
+#define WS_LOG_RING_SLOTS 1024  /* Records per thread; a power of two */
+#define WS_LOG_IDLE_MS 10       /* Writer sleep when every ring is empty */
+#define WS_LOG_BURST 20         /* Lines per call site per second before suppressing */
+#define WS_LOG_SITES 256        /* Rate-limit table entries; a power of two */
+#define WS_LOG_LINE_MAX 1024
+
+/* Argument classes, as stored in a record */
+enum
+{
+    WS_ARG_END,
+    WS_ARG_LITERAL, /* "%%" */
+    WS_ARG_INT,
+    WS_ARG_LONG,
+    WS_ARG_LLONG,
+    WS_ARG_SIZE,
+    WS_ARG_INTMAX,
+    WS_ARG_PTRDIFF,
+    WS_ARG_DOUBLE,
+    WS_ARG_PTR,
+    WS_ARG_STR
+};
+
+typedef struct
+{
+    uint64_t ts_ns; /* CLOCK_REALTIME when logged */
+    const char *fmt;
+    uint16_t len; /* Bytes used in args */
+    uint8_t level;
+    uint8_t truncated; /* Arguments did not fit; printed as far as they go */
+    uint8_t args[WS_LOG_SLOT_SIZE - 20];
+} ws_log_record;
+
+typedef struct ws_log_ring
+{
+    ws_log_record slots[WS_LOG_RING_SLOTS];
+    uint64_t head;    /* Next record to format; written by the writer thread */
+    uint64_t tail;    /* Next free slot; written by the owning thread */
+    uint64_t dropped; /* Records lost to a full ring */
+    uint64_t dropped_reported;
+    uint64_t drain_tail; /* Writer's snapshot of tail for the current pass */
+    struct ws_log_ring *next;
+} ws_log_ring;
+
+typedef struct
+{
+    const char *fmt;
+    time_t second;
+    unsigned count;
+    unsigned suppressed;
+} ws_log_site;
+
+int ws_log_level = WS_LOG_INFO;
+
+static const char *const level_names[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+static __thread ws_log_ring *thread_ring;
+static ws_log_ring *rings; /* Every thread's ring; only ever prepended to */
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t writer;
+static int running;
+static int stopping;
+static ws_log_site sites[WS_LOG_SITES];
+
+/* Steps over one conversion of a printf format. Returns its argument class
+ * and points *spec (*spec_len bytes) at "%...c", or WS_ARG_END with the
+ * trailing literal text in *literal_len. */
+static int ws_log_next_conv(const char **fmt, size_t *literal_len, const char **spec, size_t *spec_len)
+{
+    const char *p = *fmt;
+    const char *pct = strchr(p, '%');
+    if (!pct)
+    {
+        *literal_len = strlen(p);
+        *fmt = p + *literal_len;
+        return WS_ARG_END;
+    }
+    *literal_len = (size_t)(pct - p);
+    const char *q = pct + 1;
+    while (*q && strchr("-+ #0123456789.'", *q))
+        q++;
+    int cls = WS_ARG_INT;
+    if (q[0] == 'h')
+        q += q[1] == 'h' ? 2 : 1;
+    else if (q[0] == 'l' && q[1] == 'l')
+        q += 2, cls = WS_ARG_LLONG;
+    else if (q[0] == 'l')
+        q++, cls = WS_ARG_LONG;
+    else if (q[0] == 'z')
+        q++, cls = WS_ARG_SIZE;
+    else if (q[0] == 'j')
+        q++, cls = WS_ARG_INTMAX;
+    else if (q[0] == 't')
+        q++, cls = WS_ARG_PTRDIFF;
+
+    switch (*q)
+    {
+    case '%':
+        cls = WS_ARG_LITERAL;
+        break;
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+        break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        cls = WS_ARG_DOUBLE;
+        break;
+    case 's':
+        cls = WS_ARG_STR;
+        break;
+    case 'p':
+        cls = WS_ARG_PTR;
+        break;
+    default:
+        /* Unsupported or truncated: print the rest verbatim */
+        *literal_len = strlen(p);
+        *fmt = p + *literal_len;
+        return WS_ARG_END;
+    }
+    *spec = pct;
+    *spec_len = (size_t)(q + 1 - pct);
+    *fmt = q + 1;
+    return cls;
+}
+
+/* Copies the arguments fmt consumes from ap into rec->args */
+static void ws_log_capture(ws_log_record *rec, const char *fmt, va_list ap)
+{
+    uint8_t *out = rec->args;
+    uint8_t *end = rec->args + sizeof(rec->args);
+    size_t literal_len, spec_len;
+    const char *spec;
+    int cls;
+
+    rec->truncated = 0;
+    while ((cls = ws_log_next_conv(&fmt, &literal_len, &spec, &spec_len)) != WS_ARG_END)
+    {
+        union
+        {
+            long long i;
+            double d;
+            const void *p;
+        } v = {0};
+        switch (cls)
+        {
+        case WS_ARG_LITERAL:
+            continue;
+        case WS_ARG_INT:
+            v.i = va_arg(ap, int);
+            break;
+        case WS_ARG_LONG:
+            v.i = va_arg(ap, long);
+            break;
+        case WS_ARG_LLONG:
+            v.i = va_arg(ap, long long);
+            break;
+        case WS_ARG_SIZE:
+            v.i = (long long)va_arg(ap, size_t);
+            break;
+        case WS_ARG_INTMAX:
+            v.i = (long long)va_arg(ap, intmax_t);
+            break;
+        case WS_ARG_PTRDIFF:
+            v.i = (long long)va_arg(ap, ptrdiff_t);
+            break;
+        case WS_ARG_DOUBLE:
+            v.d = va_arg(ap, double);
+            break;
+        case WS_ARG_PTR:
+            v.p = va_arg(ap, void *);
+            break;
+        case WS_ARG_STR:
+        {
+            const char *s = va_arg(ap, const char *);
+            if (!s)
+                s = "(null)";
+            size_t room = (size_t)(end - out);
+            if (room < 2)
+            {
+                rec->truncated = 1;
+                goto done;
+            }
+            size_t n = strnlen(s, room - 1);
+            memcpy(out, s, n);
+            out[n] = '\0';
+            out += n + 1;
+            if (s[n] != '\0')
+            {
+                rec->truncated = 1;
+                goto done;
+            }
+            continue;
+        }
+        }
+        if ((size_t)(end - out) < sizeof(v))
+        {
+            rec->truncated = 1;
+            goto done;
+        }
+        memcpy(out, &v, sizeof(v));
+        out += sizeof(v);
+    }
+done:
+    rec->len = (uint16_t)(out - rec->args);
+}
+
+/* Formats a record into line; returns the length written */
+static size_t ws_log_format(const ws_log_record *rec, char *line, size_t size)
+{
+    const char *fmt = rec->fmt;
+    const uint8_t *in = rec->args;
+    const uint8_t *in_end = rec->args + rec->len;
+    size_t len = 0;
+    size_t literal_len, spec_len;
+    const char *spec;
+    int cls;
+
+    for (;;)
+    {
+        const char *literal = fmt;
+        cls = ws_log_next_conv(&fmt, &literal_len, &spec, &spec_len);
+        if (literal_len > size - 1 - len)
+            literal_len = size - 1 - len;
+        memcpy(line + len, literal, literal_len);
+        len += literal_len;
+        if (cls == WS_ARG_END)
+            break;
+        if (cls == WS_ARG_LITERAL)
+        {
+            if (len < size - 1)
+                line[len++] = '%';
+            continue;
+        }
+
+        char conv[32];
+        if (spec_len >= sizeof(conv))
+            break;
+        memcpy(conv, spec, spec_len);
+        conv[spec_len] = '\0';
+
+        union
+        {
+            long long i;
+            double d;
+            const void *p;
+        } v;
+        const char *s = NULL;
+        if (cls == WS_ARG_STR)
+        {
+            if (in >= in_end)
+                break;
+            s = (const char *)in;
+            in += strlen(s) + 1;
+        }
+        else
+        {
+            if ((size_t)(in_end - in) < sizeof(v))
+                break;
+            memcpy(&v, in, sizeof(v));
+            in += sizeof(v);
+        }
+
+        int n;
+        switch (cls)
+        {
+        case WS_ARG_INT:
+            n = snprintf(line + len, size - len, conv, (int)v.i);
+            break;
+        case WS_ARG_LONG:
+            n = snprintf(line + len, size - len, conv, (long)v.i);
+            break;
+        case WS_ARG_SIZE:
+            n = snprintf(line + len, size - len, conv, (size_t)v.i);
+            break;
+        case WS_ARG_INTMAX:
+            n = snprintf(line + len, size - len, conv, (intmax_t)v.i);
+            break;
+        case WS_ARG_PTRDIFF:
+            n = snprintf(line + len, size - len, conv, (ptrdiff_t)v.i);
+            break;
+        case WS_ARG_DOUBLE:
+            n = snprintf(line + len, size - len, conv, v.d);
+            break;
+        case WS_ARG_PTR:
+            n = snprintf(line + len, size - len, conv, v.p);
+            break;
+        case WS_ARG_STR:
+            n = snprintf(line + len, size - len, conv, s);
+            break;
+        default:
+            n = snprintf(line + len, size - len, conv, v.i);
+            break;
+        }
+        if (n > 0)
+            len += (size_t)n < size - len ? (size_t)n : size - 1 - len;
+    }
+    if (rec->truncated && len + 4 < size)
+    {
+        memcpy(line + len, "...", 3);
+        len += 3;
+    }
+    line[len] = '\0';
+    return len;
+}
+
+static uint64_t ws_log_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void ws_log_emit(FILE *out, uint64_t ts_ns, int level, const char *msg)
+{
+    time_t sec = (time_t)(ts_ns / 1000000000ull);
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    fprintf(out, "%02d:%02d:%02d.%03u %s %s\n", tm.tm_hour, tm.tm_min, tm.tm_sec,
+            (unsigned)(ts_ns / 1000000ull % 1000), level_names[level], msg);
+}
+
+static FILE *ws_log_stream(int level)
+{
+    return level >= WS_LOG_WARN ? stderr : stdout;
+}
+
+static void ws_log_report_suppressed(ws_log_site *site, uint64_t now_ns)
+{
+    char msg[WS_LOG_LINE_MAX];
+    snprintf(msg, sizeof(msg), "Suppressed %u repeats of \"%s\"", site->suppressed, site->fmt);
+    ws_log_emit(stderr, now_ns, WS_LOG_WARN, msg);
+    site->suppressed = 0;
+}
+
+/* Returns 1 if the record should be printed; at most WS_LOG_BURST per call
+ * site per second. */
+static int ws_log_admit(const ws_log_record *rec)
+{
+    uintptr_t key = (uintptr_t)rec->fmt;
+    ws_log_site *site = &sites[(key >> 3 ^ key >> 11) & (WS_LOG_SITES - 1)];
+    time_t second = (time_t)(rec->ts_ns / 1000000000ull);
+    if (site->fmt != rec->fmt || site->second != second)
+    {
+        if (site->suppressed)
+            ws_log_report_suppressed(site, rec->ts_ns);
+        site->fmt = rec->fmt;
+        site->second = second;
+        site->count = 0;
+    }
+    if (++site->count > WS_LOG_BURST)
+    {
+        site->suppressed++;
+        return 0;
+    }
+    return 1;
+}
+
+/* Reports suppression counts for call sites that have gone quiet, or for
+ * all of them when flushing at exit */
+static void ws_log_sweep_sites(uint64_t now_ns, int all)
+{
+    time_t second = (time_t)(now_ns / 1000000000ull);
+    for (int i = 0; i < WS_LOG_SITES; i++)
+    {
+        if (sites[i].suppressed && (all || sites[i].second != second))
+            ws_log_report_suppressed(&sites[i], now_ns);
+    }
+}
+
+/* Formats and writes every queued record, merging the per-thread rings in
+ * timestamp order; returns how many there were */
+static size_t ws_log_drain(void)
+{
+    char line[WS_LOG_LINE_MAX];
+    size_t total = 0;
+    ws_log_ring *first = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    ws_log_ring *ring;
+
+    for (ring = first; ring; ring = ring->next)
+        ring->drain_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    for (;;)
+    {
+        ws_log_ring *oldest = NULL;
+        const ws_log_record *rec = NULL;
+        for (ring = first; ring; ring = ring->next)
+        {
+            if (ring->head == ring->drain_tail)
+                continue;
+            const ws_log_record *r = &ring->slots[ring->head & (WS_LOG_RING_SLOTS - 1)];
+            if (!rec || r->ts_ns < rec->ts_ns)
+            {
+                oldest = ring;
+                rec = r;
+            }
+        }
+        if (!oldest)
+            break;
+        if (ws_log_admit(rec))
+        {
+            ws_log_format(rec, line, sizeof(line));
+            ws_log_emit(ws_log_stream(rec->level), rec->ts_ns, rec->level, line);
+        }
+        __atomic_store_n(&oldest->head, oldest->head + 1, __ATOMIC_RELEASE);
+        total++;
+    }
+
+    for (ring = first; ring; ring = ring->next)
+    {
+        uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped != ring->dropped_reported)
+        {
+            snprintf(line, sizeof(line), "%llu log records dropped, ring full",
+                     (unsigned long long)(dropped - ring->dropped_reported));
+            ws_log_emit(stderr, ws_log_now_ns(), WS_LOG_WARN, line);
+            ring->dropped_reported = dropped;
+        }
+    }
+    if (total)
+    {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return total;
+}
+
+static void *ws_log_writer(void *arg)
+{
+    (void)arg;
+    struct timespec idle = {0, WS_LOG_IDLE_MS * 1000000L};
+    time_t last_sweep = 0;
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    {
+        size_t n = ws_log_drain();
+        uint64_t now = ws_log_now_ns();
+        if ((time_t)(now / 1000000000ull) != last_sweep)
+        {
+            ws_log_sweep_sites(now, 0);
+            last_sweep = (time_t)(now / 1000000000ull);
+        }
+        if (n == 0)
+            nanosleep(&idle, NULL);
+    }
+    ws_log_drain();
+    ws_log_sweep_sites(ws_log_now_ns(), 1);
+    fflush(stdout);
+    fflush(stderr);
+    return NULL;
+}
+
+static ws_log_ring *ws_log_thread_ring(void)
+{
+    if (thread_ring)
+        return thread_ring;
+    ws_log_ring *ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = rings;
+    __atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rings_mutex);
+    thread_ring = ring;
+    return ring;
+}
+
+/* Starts the writer thread with the given runtime level. Returns -1 if it
+ * could not be started; logging then stays synchronous. */
+int ws_log_start(int level)
+{
+    ws_log_set_level(level);
+    if (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        return 0;
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELEASE);
+    /* The writer never handles signals, whatever the caller blocks later */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&writer, NULL, ws_log_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0)
+    {
+        errno = err;
+        perror("pthread_create() log writer");
+        return -1;
+    }
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Writes out everything queued and joins the writer. Safe to call twice. */
+void ws_log_stop(void)
+{
+    if (!__atomic_exchange_n(&running, 0, __ATOMIC_ACQ_REL))
+        return;
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+}
+
+void ws_log_set_level(int level)
+{
+    if (level < WS_LOG_DEBUG)
+        level = WS_LOG_DEBUG;
+    if (level > WS_LOG_OFF)
+        level = WS_LOG_OFF;
+    __atomic_store_n(&ws_log_level, level, __ATOMIC_RELAXED);
+}
+
+/* "debug", "info", "warn", "error" or "off"; -1 if unknown */
+int ws_log_parse_level(const char *name)
+{
+    static const char *const names[] = {"debug", "info", "warn", "error", "off"};
+    if (!name)
+        return -1;
+    for (int i = 0; i <= WS_LOG_OFF; i++)
+    {
+        if (strcasecmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void ws_log_write(int level, const char *fmt, ...)
+{
+    va_list ap;
+    ws_log_ring *ring;
+    if (level < WS_LOG_DEBUG || level > WS_LOG_ERROR)
+        return;
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE) || !(ring = ws_log_thread_ring()))
+    {
+        char line[WS_LOG_LINE_MAX];
+        va_start(ap, fmt);
+        vsnprintf(line, sizeof(line), fmt, ap);
+        va_end(ap);
+        ws_log_emit(ws_log_stream(level), ws_log_now_ns(), level, line);
+        return;
+    }
+
+    uint64_t tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= WS_LOG_RING_SLOTS)
+    {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    ws_log_record *rec = &ring->slots[tail & (WS_LOG_RING_SLOTS - 1)];
+    rec->ts_ns = ws_log_now_ns();
+    rec->fmt = fmt;
+    rec->level = (uint8_t)level;
+    va_start(ap, fmt);
+    ws_log_capture(rec, fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
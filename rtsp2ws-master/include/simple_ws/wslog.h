@@ -0,0 +1,62 @@
+#ifndef __WS_LOG_H
+#define __WS_LOG_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <errno.h>
+#include <string.h>
+
+/* Leveled logging that stays off the hot path. A call copies the format
+ * pointer and its raw arguments into a lock-free ring owned by the calling
+ * thread; a background thread formats the records, rate-limits repeats of
+ * the same call site and writes them out (DEBUG/INFO to stdout, WARN/ERROR
+ * to stderr). Before ws_log_start() and after ws_log_stop() records are
+ * written synchronously instead.
+ *
+ * Formats are printf-style with a string literal format, except that '*'
+ * widths and long double are not supported. Strings are copied, so they
+ * need only live for the call. */
+
+#define WS_LOG_DEBUG 0
+#define WS_LOG_INFO 1
+#define WS_LOG_WARN 2
+#define WS_LOG_ERROR 3
+#define WS_LOG_OFF 4
+
+/* Calls below this level compile to nothing; set with -DWS_LOG_MIN_LEVEL=. */
+#ifndef WS_LOG_MIN_LEVEL
+#define WS_LOG_MIN_LEVEL WS_LOG_DEBUG
+#endif
+
+extern int ws_log_level; /* Runtime threshold, WS_LOG_INFO by default */
+
+int ws_log_start(int level);
+void ws_log_stop(void);
+void ws_log_set_level(int level);
+int ws_log_parse_level(const char *name);
+void ws_log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define ws_log(level, ...)                                                  \
+    do                                                                      \
+    {                                                                       \
+        if ((level) >= WS_LOG_MIN_LEVEL &&                                  \
+            (level) >= __atomic_load_n(&ws_log_level, __ATOMIC_RELAXED))    \
+            ws_log_write((level), __VA_ARGS__);                             \
+    } while (0)
+
+#define ws_log_debug(...) ws_log(WS_LOG_DEBUG, __VA_ARGS__)
+#define ws_log_info(...) ws_log(WS_LOG_INFO, __VA_ARGS__)
+#define ws_log_warn(...) ws_log(WS_LOG_WARN, __VA_ARGS__)
+#define ws_log_error(...) ws_log(WS_LOG_ERROR, __VA_ARGS__)
+
+/* perror() replacement; what must be a string literal. */
+#define ws_log_perror(what) ws_log(WS_LOG_ERROR, what ": %s", strerror(errno))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WS_LOG_H */
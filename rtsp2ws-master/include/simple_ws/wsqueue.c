@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "wsqueue.h"
+
+/* Allocates a message with room for len bytes of encoded frame */
+ws_msg *ws_msg_new(size_t len)
+{
+    ws_msg *msg = malloc(sizeof(ws_msg) + len);
+    if (!msg)
+        return NULL;
+    msg->refs = 1;
+    msg->len = len;
+    msg->data = (uint8_t *)(msg + 1);
+    msg->payload = NULL;
+    msg->payload_len = 0;
+    msg->release = NULL;
+    msg->owner = NULL;
+    msg->flags = 0;
+    return msg;
+}
+
+/* Wraps a payload owned elsewhere: the header is copied, the payload is
+ * not, and release(owner) runs when the last reference is dropped. On
+ * failure nothing is released. */
+ws_msg *ws_msg_wrap(const uint8_t *header, size_t header_len, const uint8_t *payload,
+                    size_t payload_len, void (*release)(void *owner), void *owner)
+{
+    ws_msg *msg = ws_msg_new(header_len);
+    if (!msg)
+        return NULL;
+    memcpy(msg->data, header, header_len);
+    msg->len = header_len + payload_len;
+    msg->payload = payload;
+    msg->payload_len = payload_len;
+    msg->release = release;
+    msg->owner = owner;
+    return msg;
+}
+
+/* Fills iov with the bytes of msg from offset off on. Returns the number
+ * of entries used (1 or 2). */
+int ws_msg_iov(const ws_msg *msg, size_t off, struct iovec iov[2])
+{
+    size_t header_len = msg->len - msg->payload_len;
+    int n = 0;
+    if (off < header_len || !msg->payload)
+    {
+        iov[n].iov_base = msg->data + off;
+        iov[n].iov_len = (msg->payload ? header_len : msg->len) - off;
+        n++;
+        off = header_len;
+    }
+    if (msg->payload)
+    {
+        iov[n].iov_base = (void *)(msg->payload + (off - header_len));
+        iov[n].iov_len = msg->len - off;
+        n++;
+    }
+    return n;
+}
+
+ws_msg *ws_msg_ref(ws_msg *msg)
+{
+    __atomic_add_fetch(&msg->refs, 1, __ATOMIC_RELAXED);
+    return msg;
+}
+
+void ws_msg_unref(ws_msg *msg)
+{
+    if (msg && __atomic_sub_fetch(&msg->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        if (msg->release)
+            msg->release(msg->owner);
+        free(msg);
+    }
+}
+
+/* Initializes an empty queue; cap is rounded up to a power of two */
+int ws_queue_init(ws_queue *q, uint32_t cap)
+{
+    uint32_t n = 1;
+    while (n < cap)
+        n <<= 1;
+
+    memset(q, 0, sizeof(*q));
+    q->ring = calloc(n, sizeof(ws_msg *));
+    if (!q->ring)
+        return -1;
+    q->cap = n;
+    return 0;
+}
+
+/* Drops every queued reference and releases the ring */
+void ws_queue_free(ws_queue *q)
+{
+    for (uint32_t i = 0; i < q->count; i++)
+        ws_msg_unref(q->ring[(q->head + i) & (q->cap - 1)]);
+    free(q->ring);
+    memset(q, 0, sizeof(*q));
+}
+
+/* Appends a reference to msg. Returns -1 if the ring is full. */
+int ws_queue_push(ws_queue *q, ws_msg *msg)
+{
+    if (!q->ring || q->count == q->cap)
+        return -1;
+    q->ring[(q->head + q->count) & (q->cap - 1)] = ws_msg_ref(msg);
+    q->count++;
+    q->bytes += msg->len;
+    return 0;
+}
+
+/* Drops every message that has not started going out on the wire. A partly
+ * written head is kept so the peer never sees a truncated frame.
+ * Returns the number of messages dropped. */
+uint32_t ws_queue_trim(ws_queue *q)
+{
+    uint32_t keep = (q->count > 0 && q->head_off > 0) ? 1 : 0;
+    uint32_t dropped = q->count - keep;
+
+    for (uint32_t i = keep; i < q->count; i++)
+    {
+        ws_msg *msg = q->ring[(q->head + i) & (q->cap - 1)];
+        q->bytes -= msg->len;
+        ws_msg_unref(msg);
+    }
+    q->count = keep;
+    return dropped;
+}
+
+/* Drops every message that has not started going out on the wire and has
+ * one of flags set, keeping the others in order. A partly written head is
+ * kept. Returns the number of messages dropped. */
+uint32_t ws_queue_drop(ws_queue *q, uint8_t flags)
+{
+    uint32_t keep = (q->count > 0 && q->head_off > 0) ? 1 : 0;
+    uint32_t kept = keep;
+
+    for (uint32_t i = keep; i < q->count; i++)
+    {
+        ws_msg *msg = q->ring[(q->head + i) & (q->cap - 1)];
+        if (msg->flags & flags)
+        {
+            q->bytes -= msg->len;
+            ws_msg_unref(msg);
+        }
+        else
+        {
+            q->ring[(q->head + kept++) & (q->cap - 1)] = msg;
+        }
+    }
+    uint32_t dropped = q->count - kept;
+    q->count = kept;
+    return dropped;
+}
+
+/* Advances the queue past written bytes sent from its head, releasing every
+ * message that went out completely. For callers that write the queue
+ * themselves, e.g. through io_uring. */
+void ws_queue_consume(ws_queue *q, size_t written)
+{
+    q->bytes -= written;
+    q->sent_bytes += written;
+    while (written > 0)
+    {
+        ws_msg *msg = q->ring[q->head];
+        size_t rem = msg->len - q->head_off;
+        if (written < rem)
+        {
+            q->head_off += written;
+            break;
+        }
+        written -= rem;
+        ws_msg_unref(msg);
+        q->head = (q->head + 1) & (q->cap - 1);
+        q->count--;
+        q->head_off = 0;
+        q->sent_msgs++;
+    }
+}
+
+/* Writes as much of the queue as the socket accepts.
+ * Returns 0 when drained, 1 when the socket is full, -1 on error. */
+int ws_queue_flush(ws_queue *q, int fd)
+{
+    while (q->count > 0)
+    {
+        struct iovec iov[WS_QUEUE_IOV_MAX];
+        int n = 0;
+        for (uint32_t i = 0; i < q->count && n + 2 <= WS_QUEUE_IOV_MAX; i++)
+        {
+            ws_msg *msg = q->ring[(q->head + i) & (q->cap - 1)];
+            n += ws_msg_iov(msg, (i == 0) ? q->head_off : 0, iov + n);
+        }
+
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = n;
+        ssize_t written = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+            return -1;
+        }
+        ws_queue_consume(q, (size_t)written);
+    }
+    return 0;
+}
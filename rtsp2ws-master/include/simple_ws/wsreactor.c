@@ -0,0 +1,264 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "wsreactor.h"
+#include "wslog.h"
+
+#define WS_REACTOR_MAX_EVENTS 256
+
+static void ws_reactor_on_wake(void *data, uint32_t events)
+{
+    ws_reactor *r = data;
+    uint64_t count;
+    (void)events;
+    if (read(r->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        ws_log_perror("read() reactor wakeup");
+    if (r->on_wake && !ws_reactor_stopped(r))
+        r->on_wake(r->wake_data);
+}
+
+/* Creates the epoll set and the wakeup eventfd. on_wake runs on the loop
+ * thread whenever another thread calls ws_reactor_wake(). */
+int ws_reactor_init(ws_reactor *r, ws_wake_fn on_wake, void *data)
+{
+    memset(r, 0, sizeof(*r));
+    r->on_wake = on_wake;
+    r->wake_data = data;
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd < 0)
+    {
+        ws_log_perror("epoll_create1()");
+        r->wake_fd = -1;
+        return -1;
+    }
+    r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->wake_fd < 0)
+    {
+        ws_log_perror("eventfd()");
+        ws_reactor_free(r);
+        return -1;
+    }
+    r->wake.fn = ws_reactor_on_wake;
+    r->wake.data = r;
+    if (ws_reactor_add(r, r->wake_fd, EPOLLIN, &r->wake) < 0)
+    {
+        ws_reactor_free(r);
+        return -1;
+    }
+    return 0;
+}
+
+void ws_reactor_free(ws_reactor *r)
+{
+    if (r->wake_fd >= 0)
+        close(r->wake_fd);
+    if (r->epoll_fd >= 0)
+        close(r->epoll_fd);
+    r->wake_fd = -1;
+    r->epoll_fd = -1;
+}
+
+int ws_reactor_add(ws_reactor *r, int fd, uint32_t events, ws_handler *h)
+{
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        ws_log_perror("epoll_ctl() add");
+        return -1;
+    }
+    return 0;
+}
+
+int ws_reactor_mod(ws_reactor *r, int fd, uint32_t events, ws_handler *h)
+{
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0)
+    {
+        ws_log_perror("epoll_ctl() mod");
+        return -1;
+    }
+    return 0;
+}
+
+/* Only needed when the fd stays open; closing it unregisters it too. */
+void ws_reactor_del(ws_reactor *r, int fd)
+{
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/* Waits up to timeout_ms (-1 forever) and dispatches what is ready.
+ * Returns the number of events handled, or -1 on error. */
+int ws_reactor_poll(ws_reactor *r, int timeout_ms)
+{
+    struct epoll_event events[WS_REACTOR_MAX_EVENTS];
+    int n = epoll_wait(r->epoll_fd, events, WS_REACTOR_MAX_EVENTS, timeout_ms);
+    if (n < 0)
+    {
+        if (errno == EINTR)
+            return 0;
+        ws_log_perror("epoll_wait()");
+        return -1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        ws_handler *h = events[i].data.ptr;
+        h->fn(h->data, events[i].events);
+    }
+    return n;
+}
+
+/* Dispatches events until ws_reactor_stop(). Returns -1 on error. */
+int ws_reactor_run(ws_reactor *r)
+{
+    while (!ws_reactor_stopped(r))
+    {
+        if (ws_reactor_poll(r, -1) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Safe from any thread. */
+void ws_reactor_wake(ws_reactor *r)
+{
+    uint64_t one = 1;
+    if (write(r->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        ws_log_perror("write() reactor wakeup");
+}
+
+/* Safe from any thread; ws_reactor_run() returns after the current pass. */
+void ws_reactor_stop(ws_reactor *r)
+{
+    __atomic_store_n(&r->stop, 1, __ATOMIC_RELEASE);
+    ws_reactor_wake(r);
+}
+
+int ws_reactor_stopped(ws_reactor *r)
+{
+    return __atomic_load_n(&r->stop, __ATOMIC_ACQUIRE);
+}
+
+static void ws_timer_on_ready(void *data, uint32_t events)
+{
+    ws_timer *t = data;
+    uint64_t expirations;
+    (void)events;
+    if (read(t->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        if (errno != EAGAIN)
+            ws_log_perror("read() timerfd");
+        return;
+    }
+    t->fn(t->data, expirations);
+}
+
+int ws_timer_start(ws_reactor *r, ws_timer *t, unsigned first_ms, unsigned interval_ms,
+                   ws_timer_fn fn, void *data)
+{
+    t->fn = fn;
+    t->data = data;
+    t->h.fn = ws_timer_on_ready;
+    t->h.data = t;
+    t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (t->fd < 0)
+    {
+        ws_log_perror("timerfd_create()");
+        return -1;
+    }
+    if (ws_timer_set(t, first_ms, interval_ms) < 0)
+    {
+        close(t->fd);
+        t->fd = -1;
+        return -1;
+    }
+    if (ws_reactor_add(r, t->fd, EPOLLIN, &t->h) < 0)
+    {
+        close(t->fd);
+        t->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* Re-arms a running timer; first_ms 0 disarms it. */
+int ws_timer_set(ws_timer *t, unsigned first_ms, unsigned interval_ms)
+{
+    struct itimerspec its;
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (long)(interval_ms % 1000) * 1000000L;
+    its.it_value.tv_sec = first_ms / 1000;
+    its.it_value.tv_nsec = (long)(first_ms % 1000) * 1000000L;
+    if (timerfd_settime(t->fd, 0, &its, NULL) < 0)
+    {
+        ws_log_perror("timerfd_settime()");
+        return -1;
+    }
+    return 0;
+}
+
+void ws_timer_stop(ws_reactor *r, ws_timer *t)
+{
+    (void)r;
+    if (t->fd >= 0)
+        close(t->fd);
+    t->fd = -1;
+}
+
+static void ws_signals_on_ready(void *data, uint32_t events)
+{
+    ws_signals *s = data;
+    struct signalfd_siginfo info;
+    (void)events;
+    while (read(s->fd, &info, sizeof(info)) == sizeof(info))
+        s->fn(s->data, (int)info.ssi_signo);
+}
+
+/* Blocks mask in the calling thread and delivers those signals through the
+ * loop instead of asynchronous handlers. */
+int ws_signals_start(ws_reactor *r, ws_signals *s, const sigset_t *mask,
+                     ws_signal_fn fn, void *data)
+{
+    s->fn = fn;
+    s->data = data;
+    s->h.fn = ws_signals_on_ready;
+    s->h.data = s;
+    int err = pthread_sigmask(SIG_BLOCK, mask, NULL);
+    if (err != 0)
+    {
+        errno = err;
+        ws_log_perror("pthread_sigmask()");
+        s->fd = -1;
+        return -1;
+    }
+    s->fd = signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (s->fd < 0)
+    {
+        ws_log_perror("signalfd()");
+        return -1;
+    }
+    if (ws_reactor_add(r, s->fd, EPOLLIN, &s->h) < 0)
+    {
+        close(s->fd);
+        s->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* The signals stay blocked; pending ones are discarded with the fd. */
+void ws_signals_stop(ws_reactor *r, ws_signals *s)
+{
+    (void)r;
+    if (s->fd >= 0)
+        close(s->fd);
+    s->fd = -1;
+}
@@ -0,0 +1,212 @@
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "wstls.h"
+#include "wslog.h"
+
+/* TLS 1.2 suites the kernel can offload; TLS 1.3 defaults are all AEADs
+ * it handles (AES-GCM, ChaCha20-Poly1305 since Linux 5.11). */
+#define WS_TLS12_CIPHERS "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:" \
+                         "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:" \
+                         "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305"
+
+static void ws_tls_log_error(const char *what)
+{
+    char buf[256];
+    unsigned long err = ERR_get_error();
+    ERR_error_string_n(err, buf, sizeof(buf));
+    ws_log_error("%s: %s", what, err ? buf : "unknown error");
+    ERR_clear_error();
+}
+
+/* Attaches the "tls" ULP to a connected loopback socket, which is the first
+ * step OpenSSL takes when it offloads a session. Returns -1 if the kernel
+ * lacks kTLS (CONFIG_TLS, or the tls module is not loaded). */
+static int ws_tls_probe_kernel(void)
+{
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int cfd = socket(AF_INET, SOCK_STREAM, 0);
+    int afd = -1;
+    int ret = -1;
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (lfd < 0 || cfd < 0 ||
+        bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0 ||
+        getsockname(lfd, (struct sockaddr *)&addr, &alen) < 0 ||
+        connect(cfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        (afd = accept(lfd, NULL, NULL)) < 0)
+    {
+        ws_log_perror("kTLS probe socket");
+    }
+    else if (setsockopt(afd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0)
+    {
+        ws_log_error("Kernel TLS is not available (%s); load the tls module", strerror(errno));
+    }
+    else
+    {
+        ret = 0;
+    }
+    if (afd >= 0)
+        close(afd);
+    if (cfd >= 0)
+        close(cfd);
+    if (lfd >= 0)
+        close(lfd);
+    return ret;
+}
+
+/* Builds a server context for the PEM certificate chain and key, with kTLS
+ * enabled. Returns NULL (after logging why) on any failure. */
+struct ssl_ctx_st *ws_tls_server_ctx(const char *cert_file, const char *key_file)
+{
+    if (ws_tls_probe_kernel() < 0)
+        return NULL;
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+    {
+        ws_tls_log_error("SSL_CTX_new()");
+        return NULL;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+    // No session tickets: nothing may be written through OpenSSL once the
+    // kernel owns the transmit side.
+    SSL_CTX_set_num_tickets(ctx, 0);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    if (SSL_CTX_set_cipher_list(ctx, WS_TLS12_CIPHERS) != 1)
+    {
+        ws_tls_log_error("SSL_CTX_set_cipher_list()");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1)
+    {
+        ws_tls_log_error(cert_file);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1)
+    {
+        ws_tls_log_error(key_file);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void ws_tls_ctx_free(struct ssl_ctx_st *ctx)
+{
+    SSL_CTX_free(ctx);
+}
+
+/* Starts the server side of a handshake on a non-blocking socket. With no
+ * context the connection stays plain TCP. */
+int ws_tls_accept(ws_tls *t, struct ssl_ctx_st *ctx, int fd)
+{
+    t->ssl = NULL;
+    t->state = WS_TLS_NONE;
+    if (!ctx)
+        return 0;
+    t->ssl = SSL_new(ctx);
+    if (!t->ssl || SSL_set_fd(t->ssl, fd) != 1)
+    {
+        ws_tls_log_error("SSL_new()");
+        ws_tls_close(t);
+        return -1;
+    }
+    SSL_set_accept_state(t->ssl);
+    t->state = WS_TLS_HANDSHAKE;
+    return 0;
+}
+
+/* Advances the handshake. Returns 1 once the connection is open, 0 while
+ * it waits for the socket, -1 if it failed or could not be offloaded. */
+int ws_tls_handshake(ws_tls *t)
+{
+    if (t->state != WS_TLS_HANDSHAKE)
+        return 1;
+    int ret = SSL_do_handshake(t->ssl);
+    if (ret != 1)
+    {
+        int err = SSL_get_error(t->ssl, ret);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+            return 0;
+        if (err == SSL_ERROR_SSL)
+            ws_tls_log_error("TLS handshake");
+        ERR_clear_error();
+        return -1;
+    }
+    if (!BIO_get_ktls_send(SSL_get_wbio(t->ssl)))
+    {
+        ws_log_warn("TLS %s with %s could not be offloaded to the kernel, closing",
+                    SSL_get_version(t->ssl), SSL_get_cipher_name(t->ssl));
+        return -1;
+    }
+    ws_log_debug("TLS %s with %s, kTLS send%s", SSL_get_version(t->ssl),
+                 SSL_get_cipher_name(t->ssl),
+                 BIO_get_ktls_recv(SSL_get_rbio(t->ssl)) ? " and receive" : "");
+    t->state = WS_TLS_OPEN;
+    return 1;
+}
+
+/* recv() for a possibly encrypted connection: same return values, with
+ * errno EAGAIN while no application data is ready and 0 on close_notify. */
+ssize_t ws_tls_recv(ws_tls *t, int fd, void *buf, size_t len)
+{
+    if (t->state == WS_TLS_NONE)
+        return recv(fd, buf, len, 0);
+    if (t->state != WS_TLS_OPEN)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    int n = SSL_read(t->ssl, buf, len > INT_MAX ? INT_MAX : (int)len);
+    if (n > 0)
+        return n;
+    int err = SSL_get_error(t->ssl, n);
+    ERR_clear_error();
+    switch (err)
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_SYSCALL:
+        if (errno == 0)
+            errno = ECONNRESET;
+        return -1;
+    default:
+        errno = EPROTO;
+        return -1;
+    }
+}
+
+/* Sends close_notify if the session is open and frees it; the caller
+ * closes the fd. Safe on plain and already closed connections. */
+void ws_tls_close(ws_tls *t)
+{
+    if (t->ssl)
+    {
+        if (t->state == WS_TLS_OPEN)
+            SSL_shutdown(t->ssl);
+        SSL_free(t->ssl);
+        ERR_clear_error();
+    }
+    t->ssl = NULL;
+    t->state = WS_TLS_NONE;
+}
@@ -0,0 +1,207 @@
+#include "wsuring.h"
+
+#ifdef WS_IO_URING
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Sets up a ring with room for entries submissions. Returns -1 with errno
+ * set if the kernel does not offer io_uring. */
+int ws_uring_init(ws_uring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = sys_io_uring_setup(entries, &p);
+    if (r->fd < 0)
+    {
+        r->fd = -1;
+        return -1;
+    }
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_ring_size > r->sq_ring_size)
+            r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        r->cq_ring = r->sq_ring;
+    }
+    else
+    {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED)
+        {
+            r->cq_ring = NULL;
+            goto fail;
+        }
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+    {
+        r->sqes = NULL;
+        goto fail;
+    }
+
+    uint8_t *sq = r->sq_ring;
+    uint8_t *cq = r->cq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    {
+        int saved = errno;
+        if (r->sq_ring == MAP_FAILED)
+            r->sq_ring = NULL;
+        ws_uring_free(r);
+        errno = saved;
+    }
+    return -1;
+}
+
+void ws_uring_free(ws_uring *r)
+{
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring)
+        munmap(r->sq_ring, r->sq_ring_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+/* Claims the next submission entry, zeroed, or NULL if the queue is full. */
+static struct io_uring_sqe *ws_uring_get_sqe(ws_uring *r)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= r->sq_entries || r->pending + r->inflight >= r->sq_entries)
+        return NULL;
+
+    unsigned idx = tail & r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    return sqe;
+}
+
+static void ws_uring_commit_sqe(ws_uring *r)
+{
+    __atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+    r->pending++;
+}
+
+/* Queues a send of buf on fd; data comes back with its completion.
+ * Returns -1 if the submission queue is full (submit first). */
+int ws_uring_prep_send(ws_uring *r, int fd, const void *buf, size_t len, int flags, void *data)
+{
+    struct io_uring_sqe *sqe = ws_uring_get_sqe(r);
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = (unsigned)len;
+    sqe->msg_flags = (unsigned)flags;
+    sqe->user_data = (uintptr_t)data;
+    ws_uring_commit_sqe(r);
+    return 0;
+}
+
+/* Like ws_uring_prep_send() for a gathered message, e.g. a frame header
+ * and its payload. msg and its iovecs must stay valid until completion;
+ * one msghdr may be shared by many sends. */
+int ws_uring_prep_sendmsg(ws_uring *r, int fd, const struct msghdr *msg, int flags, void *data)
+{
+    struct io_uring_sqe *sqe = ws_uring_get_sqe(r);
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = (unsigned)flags;
+    sqe->user_data = (uintptr_t)data;
+    ws_uring_commit_sqe(r);
+    return 0;
+}
+
+/* Submits everything prepared with a single io_uring_enter() and waits
+ * until all of it has completed. Returns -1 on error. */
+int ws_uring_submit_wait(ws_uring *r)
+{
+    while (r->pending > 0 || r->inflight > 0)
+    {
+        unsigned ready = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) - *r->cq_head;
+        if (r->pending == 0 && ready >= r->inflight)
+            return 0;
+        /* min_complete counts completions already sitting in the ring */
+        int ret = sys_io_uring_enter(r->fd, r->pending, r->pending + r->inflight,
+                                     IORING_ENTER_GETEVENTS);
+        r->enters++;
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        r->pending -= (unsigned)ret;
+        r->inflight += (unsigned)ret;
+    }
+    return 0;
+}
+
+/* Pops one completion. Returns 1 with its data and result (bytes sent or
+ * -errno), or 0 if none is ready. */
+int ws_uring_next_cqe(ws_uring *r, void **data, int *res)
+{
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+    struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+    *data = (void *)(uintptr_t)cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    if (r->inflight > 0)
+        r->inflight--;
+    return 1;
+}
+
+#endif /* WS_IO_URING */
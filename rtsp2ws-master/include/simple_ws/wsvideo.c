@@ -0,0 +1,187 @@
+#include <string.h>
+#include <strings.h>
+
+#include "wsvideo.h"
+#include "wslog.h"
+
+/* Whether other frames may reference the picture in an Annex B frame, from
+ * its first slice: nal_ref_idc for H.264, the sub-layer non-reference NAL
+ * types for HEVC. Anything unrecognised counts as referenced. */
+static bool frame_referenced(ws_codec codec, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i + 3 < size; i++)
+    {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+            continue;
+        uint8_t nal = data[i + 3];
+        if (codec == WS_CODEC_H264)
+        {
+            int type = nal & 0x1F;
+            if (type >= 1 && type <= 5)
+                return (nal >> 5) & 0x3;
+        }
+        else if (codec == WS_CODEC_HEVC)
+        {
+            int type = (nal >> 1) & 0x3F;
+            if (type <= 31)
+                return type > 14 || (type & 1);
+        }
+        else
+        {
+            break;
+        }
+        i += 3;
+    }
+    return true;
+}
+
+/* Message flags for a demuxed video frame, so lagging viewers can shed
+ * whole frames: non-reference frames go first, then everything up to the
+ * next keyframe. disposable is the demuxer's own hint, if it has one. */
+uint8_t ws_frame_flags(ws_codec codec, bool keyframe, bool disposable, const uint8_t *data,
+                       size_t size)
+{
+    if (keyframe)
+        return WS_MSG_FRAME | WS_MSG_KEYFRAME;
+    if (disposable || !frame_referenced(codec, data, size))
+        return WS_MSG_FRAME | WS_MSG_DISPOSABLE;
+    return WS_MSG_FRAME;
+}
+
+/* Parses "all", "ref" or "off". Returns the ws_gop_burst, or -1 for NULL
+ * or anything else. */
+int ws_gop_burst_parse(const char *name)
+{
+    static const char *const names[] = {"all", "ref", "off"};
+    if (!name)
+        return -1;
+    for (int i = 0; i <= WS_GOP_BURST_OFF; i++)
+    {
+        if (strcasecmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void gop_clear(ws_gop_cache *c)
+{
+    while (c->gop_count > 0)
+        ws_msg_unref(c->gop[--c->gop_count]);
+    c->gop_bytes = 0;
+}
+
+/* Keeps a camera's message for new viewers: a message without WS_MSG_FRAME
+ * replaces the codec configuration, a keyframe starts the GOP over, and a
+ * GOP longer than the cache empties it until the next keyframe. */
+void ws_gop_cache_add(ws_gop_cache *c, ws_msg *msg)
+{
+    if (!(msg->flags & WS_MSG_FRAME))
+    {
+        ws_msg_unref(c->config);
+        c->config = ws_msg_ref(msg);
+        return;
+    }
+    if (msg->flags & WS_MSG_KEYFRAME)
+        gop_clear(c);
+    else if (c->gop_count == 0)
+        return;
+    if (c->gop_count == WS_GOP_CACHE_FRAMES || c->gop_bytes + msg->len > WS_GOP_CACHE_BYTES)
+    {
+        gop_clear(c);
+        return;
+    }
+    c->gop[c->gop_count++] = ws_msg_ref(msg);
+    c->gop_bytes += msg->len;
+}
+
+/* Releases everything the cache holds and leaves it empty. */
+void ws_gop_cache_free(ws_gop_cache *c)
+{
+    ws_msg_unref(c->config);
+    c->config = NULL;
+    gop_clear(c);
+}
+
+void ws_viewer_reset(ws_viewer *v)
+{
+    memset(v, 0, sizeof(*v));
+}
+
+/* Queues a new viewer's join burst without writing it: the codec
+ * configuration, then the cached keyframe and the frames since as burst
+ * allows, so the first picture can arrive about one round trip after the
+ * upgrade. The lag policy holds off until the burst is out. With no frames
+ * to start from the viewer waits for the next keyframe. Returns the number
+ * of frames queued. */
+int ws_viewer_join(ws_viewer *v, ws_queue *q, const ws_gop_cache *c, ws_gop_burst burst)
+{
+    if (c->config)
+        ws_queue_push(q, c->config);
+    int frames = 0;
+    for (int i = 0; burst != WS_GOP_BURST_OFF && i < c->gop_count; i++)
+    {
+        if (burst == WS_GOP_BURST_REF && (c->gop[i]->flags & WS_MSG_DISPOSABLE))
+            continue;
+        if (ws_queue_push(q, c->gop[i]) < 0)
+            break;
+        frames++;
+    }
+    v->skipping = frames == 0;
+    v->join_end = q->sent_msgs + q->count;
+    if (q->count > v->peak_lag)
+        v->peak_lag = q->count;
+    return frames;
+}
+
+/* Lag policy for a video frame: past limits->disposable_frames a viewer's
+ * non-reference frames are dropped, and past limits->skip_frames (or
+ * limits->high_bytes) every queued frame is, and it waits for the next
+ * keyframe. While its join burst is going out only the byte limit and the
+ * queue's capacity apply. fd only names the viewer in the log. */
+static bool frame_wanted(ws_viewer *v, ws_queue *q, const ws_msg *msg,
+                         const ws_lag_limits *limits, int fd)
+{
+    if (v->skipping)
+    {
+        if (!(msg->flags & WS_MSG_KEYFRAME))
+            return false;
+        v->skipping = false;
+        ws_log_info("Viewer FD %d resumed at a keyframe", fd);
+    }
+    uint32_t lag = q->count;
+    bool joining = q->sent_msgs < v->join_end;
+    if ((!joining && lag >= limits->skip_frames) || lag + 1 >= q->cap ||
+        q->bytes + msg->len > limits->high_bytes)
+    {
+        v->dropped += ws_queue_drop(q, WS_MSG_FRAME);
+        v->skips++;
+        if (!(msg->flags & WS_MSG_KEYFRAME))
+        {
+            v->skipping = true;
+            ws_log_warn("Viewer FD %d is %u frames behind, skipping to the next keyframe", fd, lag);
+            return false;
+        }
+    }
+    else if (!joining && lag >= limits->disposable_frames)
+    {
+        v->dropped += ws_queue_drop(q, WS_MSG_DISPOSABLE);
+        return !(msg->flags & WS_MSG_DISPOSABLE);
+    }
+    return true;
+}
+
+/* Queues a message for a viewer without writing it. Messages without
+ * WS_MSG_FRAME (control frames, the codec configuration) bypass the lag
+ * policy. Returns 0 if msg was queued, -1 if it was dropped. */
+int ws_viewer_queue(ws_viewer *v, ws_queue *q, ws_msg *msg, const ws_lag_limits *limits, int fd)
+{
+    if (((msg->flags & WS_MSG_FRAME) && !frame_wanted(v, q, msg, limits, fd)) ||
+        ws_queue_push(q, msg) < 0)
+    {
+        v->dropped++;
+        return -1;
+    }
+    if (q->count > v->peak_lag)
+        v->peak_lag = q->count;
+    return 0;
+}
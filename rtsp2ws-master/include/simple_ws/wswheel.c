@@ -0,0 +1,122 @@
+#include <string.h>
+
+#include "wswheel.h"
+
+#define WS_WHEEL_MASK (WS_WHEEL_SLOTS - 1)
+#define WS_WHEEL_MAX_TICKS ((1ull << (WS_WHEEL_BITS * WS_WHEEL_LEVELS)) - 1)
+
+static void ws_wheel_link(ws_wheel *w, ws_deadline *d)
+{
+    uint64_t delta = d->expires > w->now ? d->expires - w->now : 0;
+    int level = 0;
+    while (level < WS_WHEEL_LEVELS - 1 && delta >= (1ull << (WS_WHEEL_BITS * (level + 1))))
+        level++;
+    ws_deadline **slot = &w->slots[level][(d->expires >> (WS_WHEEL_BITS * level)) & WS_WHEEL_MASK];
+    d->next = *slot;
+    if (d->next)
+        d->next->pprev = &d->next;
+    d->pprev = slot;
+    *slot = d;
+}
+
+static void ws_wheel_unlink(ws_deadline *d)
+{
+    *d->pprev = d->next;
+    if (d->next)
+        d->next->pprev = d->pprev;
+    d->next = NULL;
+    d->pprev = NULL;
+}
+
+/* Redistributes a higher-level slot whose range has just come up. */
+static void ws_wheel_cascade(ws_wheel *w, int level, unsigned idx)
+{
+    ws_deadline *d = w->slots[level][idx];
+    w->slots[level][idx] = NULL;
+    while (d)
+    {
+        ws_deadline *next = d->next;
+        ws_wheel_link(w, d);
+        d = next;
+    }
+}
+
+static void ws_wheel_on_tick(void *data, uint64_t expirations)
+{
+    ws_wheel *w = data;
+    while (expirations-- > 0 && w->count > 0)
+    {
+        w->now++;
+        for (int level = 1; level < WS_WHEEL_LEVELS; level++)
+        {
+            unsigned shift = WS_WHEEL_BITS * level;
+            if (w->now & ((1ull << shift) - 1))
+                break;
+            ws_wheel_cascade(w, level, (w->now >> shift) & WS_WHEEL_MASK);
+        }
+        /* Callbacks may schedule or cancel anything, including entries
+         * still in this slot, so always restart from its head. New
+         * deadlines land at least one tick ahead. */
+        ws_deadline **slot = &w->slots[0][w->now & WS_WHEEL_MASK];
+        while (*slot)
+        {
+            ws_deadline *d = *slot;
+            ws_wheel_unlink(d);
+            w->count--;
+            d->fn(d->data);
+        }
+    }
+    if (w->count == 0)
+        ws_timer_set(&w->tick, 0, 0);
+}
+
+/* Sets up an empty wheel ticking every tick_ms on loop's thread. */
+int ws_wheel_init(ws_wheel *w, ws_reactor *loop, unsigned tick_ms)
+{
+    memset(w, 0, sizeof(*w));
+    w->tick_ms = tick_ms ? tick_ms : 1;
+    return ws_timer_start(loop, &w->tick, 0, 0, ws_wheel_on_tick, w);
+}
+
+/* Pending deadlines are dropped without firing. */
+void ws_wheel_free(ws_wheel *w, ws_reactor *loop)
+{
+    ws_timer_stop(loop, &w->tick);
+    memset(w->slots, 0, sizeof(w->slots));
+    w->count = 0;
+}
+
+void ws_deadline_init(ws_deadline *d, ws_deadline_fn fn, void *data)
+{
+    d->next = NULL;
+    d->pprev = NULL;
+    d->expires = 0;
+    d->fn = fn;
+    d->data = data;
+}
+
+/* Fires d after delay_ms (rounded up to whole ticks, at least one).
+ * Reschedules it if it is already pending. */
+void ws_wheel_schedule(ws_wheel *w, ws_deadline *d, unsigned delay_ms)
+{
+    uint64_t ticks = (delay_ms + w->tick_ms - 1) / w->tick_ms;
+    if (ticks == 0)
+        ticks = 1;
+    if (ticks > WS_WHEEL_MAX_TICKS)
+        ticks = WS_WHEEL_MAX_TICKS;
+    if (d->pprev)
+        ws_wheel_unlink(d);
+    else if (w->count++ == 0)
+        ws_timer_set(&w->tick, w->tick_ms, w->tick_ms);
+    d->expires = w->now + ticks;
+    ws_wheel_link(w, d);
+}
+
+void ws_wheel_cancel(ws_wheel *w, ws_deadline *d)
+{
+    if (!d->pprev)
+        return;
+    ws_wheel_unlink(d);
+    if (--w->count == 0)
+        ws_timer_set(&w->tick, 0, 0);
+}
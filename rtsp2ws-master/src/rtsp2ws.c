@@ -27,7 +27,6 @@
 #include "simple_ws/wshandshake.h"
 #include "simple_ws/base64.h"
 
-#define MAX_PKT 200000
 #define HANDSHAKE_BUF 2048
 
 /* Global variables */
@@ -46,6 +45,9 @@ static void Shutdown(bool signit);
 static void SIGINT_handler(int signum);
 static int connect_ws(void);
 static void stream_loop(int ws_fd);
+static void create_upstream_frame(wsFrameType type, const uint8_t *data, size_t len,
+                                  uint8_t *out, size_t *out_len);
+static int send_upstream(int fd, uint8_t **buf, size_t *cap, const uint8_t *data, size_t len);
 
 int main(int argc, char **argv)
 {
@@ -91,7 +93,7 @@ static void Shutdown(bool signit)
     /* Send WebSocket closing frame */
     uint8_t wsbuf[16];
     size_t wslen;
-    ws_create_closing_frame(wsbuf, &wslen);
+    create_upstream_frame(WS_CLOSING_FRAME, NULL, 0, wsbuf, &wslen);
     if (send(ws_fd, wsbuf, wslen, 0) < 0)
     {
         perror("[ERROR] send close frame");
@@ -108,6 +110,36 @@ static void SIGINT_handler(int signum)
     Shutdown(true);
 }
 
+/* Builds a client-to-server frame, masked with a fresh random key as
+ * RFC 6455 requires of clients */
+static void create_upstream_frame(wsFrameType type, const uint8_t *data, size_t len,
+                                  uint8_t *out, size_t *out_len)
+{
+    uint8_t key[4];
+    RAND_bytes(key, sizeof(key));
+    ws_frame frame = {.payload_length = len, .payload = (uint8_t *)data, .type = type};
+    ws_create_masked_frame(&frame, key, out, out_len);
+}
+
+/* Masks a binary message into *buf, grown to fit and kept for the next
+ * one, and sends it. Masking needs a copy anyway; sizing it per message
+ * keeps large keyframes off the stack. Returns -1 on error. */
+static int send_upstream(int fd, uint8_t **buf, size_t *cap, const uint8_t *data, size_t len)
+{
+    size_t need = WS_MAX_HEADER_LEN + len;
+    size_t wslen;
+    if (need > *cap)
+    {
+        uint8_t *grown = realloc(*buf, need);
+        if (!grown)
+            return -1;
+        *buf = grown;
+        *cap = need;
+    }
+    create_upstream_frame(WS_BINARY_FRAME, data, len, *buf, &wslen);
+    return send(fd, *buf, wslen, 0) < 0 ? -1 : 0;
+}
+
 /* Establishes a TCP connection to the WebSocket server and performs the handshake */
 static int connect_ws(void)
 {
@@ -181,6 +213,9 @@ static int connect_ws(void)
 /* Opens the RTSP stream, reads frames, and relays them via WebSocket continuously */
 static void stream_loop(int ws_fd)
 {
+    uint8_t *wsbuf = NULL; /* Masked frame, reused across packets */
+    size_t wscap = 0;
+
     for (;;)
     {
         AVFormatContext *fmt = NULL;
@@ -188,8 +223,6 @@ static void stream_loop(int ws_fd)
         AVPacket *pkt = NULL;
         int vid_idx, ret, ok = 0;
         int sent_sps = 0;
-        uint8_t wsbuf[10 + MAX_PKT];
-        size_t wslen;
 
         fprintf(stderr, "[DEBUG] Opening RTSP stream: %s\n", rtsp_url);
 
@@ -242,16 +275,14 @@ static void stream_loop(int ws_fd)
                 {
                     if (!sent_sps && (pkt->flags & AV_PKT_FLAG_KEY) && ctx->extradata)
                     {
-                        ws_create_binary_frame(ctx->extradata, ctx->extradata_size, wsbuf, &wslen);
-                        if (send(ws_fd, wsbuf, wslen, 0) < 0)
+                        if (send_upstream(ws_fd, &wsbuf, &wscap, ctx->extradata, ctx->extradata_size) < 0)
                         {
                             perror("[ERROR] send SPS/PPS");
                             Shutdown(false);
                         }
                         sent_sps = 1;
                     }
-                    ws_create_binary_frame(pkt->data, pkt->size, wsbuf, &wslen);
-                    if (send(ws_fd, wsbuf, wslen, 0) < 0)
+                    if (send_upstream(ws_fd, &wsbuf, &wscap, pkt->data, pkt->size) < 0)
                     {
                         perror("[ERROR] send frame");
                         Shutdown(false);
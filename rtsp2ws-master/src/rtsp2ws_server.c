@@ -1,18 +1,22 @@
 /* rtsp2ws_server.c - RTSP to WebSocket stream relay (Server)
  *
- * This program opens an RTSP stream, then acts as a WebSocket server
- * accepting multiple client connections. It uses epoll (with edge-triggered
- * notifications) and pthreads for scalable event notification. It performs the
- * WebSocket handshake on each new connection and broadcasts raw H264 frames
- * (wrapped in WebSocket binary frames) to all connected clients.
+ * This program pulls one or more RTSP streams, then acts as a WebSocket server
+ * accepting multiple client connections on a single port. Each camera has its
+ * own puller thread; viewers are spread over a pool of I/O threads (one per
+ * core by default), each with its own epoll loop (edge-triggered clients).
+ * The handshake URI picks the camera, and raw H264 frames (wrapped in
+ * WebSocket binary frames) are broadcast to every viewer of that camera.
  *
  * Compile with:
  *   gcc rtsp2ws_server.c -o rtsp2ws_server -lavformat -lavcodec -lavutil -lpthread -lssl -lcrypto
  *
- * Usage: ./rtsp2ws_server <rtsp_url> <listen_port>
+ * Usage: ./rtsp2ws_server <rtsp_url> <listen_port> [max_clients]
+ *        ./rtsp2ws_server -c <cameras.conf> <listen_port> [max_clients]
  * Example: ./rtsp2ws_server rtsp://192.168.1.100/stream 8765
+ *          ./rtsp2ws_server -c cameras.conf 8002
  */
 
+#define _GNU_SOURCE // accept4
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,8 +26,9 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <fcntl.h>
-#include <sys/epoll.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
 
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
@@ -32,133 +37,417 @@
 #include "simple_ws/websocket.h"
 #include "simple_ws/wshandshake.h"
 #include "simple_ws/base64.h"
+#include "simple_ws/wsqueue.h"
+#include "simple_ws/wsuring.h"
+#include "simple_ws/wsreactor.h"
+#include "simple_ws/wswheel.h"
+#include "simple_ws/wskeepalive.h"
+#include "simple_ws/wsdecoder.h"
+#include "simple_ws/wstls.h"
+#include "simple_ws/wsvideo.h"
+#include "simple_ws/wslog.h"
 
 /* Constants */
-#define MAX_PKT 2000000
 #define HANDSHAKE_BUF 4096
-#define MAX_CLIENTS 1024
+#define HANDSHAKE_POOL_MAX 64
+#define CLIENT_CHUNK 64          // Client slots added per growth step
+#define DEFAULT_MAX_CLIENTS 1024 // Soft limit unless given on the command line
+#define LISTEN_BACKLOG 1024      // Pending connections (capped by net.core.somaxconn)
+#define ACCEPT_BATCH_MAX 64      // Connections accepted per wakeup, for fairness
+#define URING_ENTRIES 256        // Frame sends submitted per io_uring_enter()
+#define WHEEL_TICK_MS 100        // Timing wheel resolution for client deadlines
+#define HANDSHAKE_TIMEOUT_MS 5000 // Close connections that never upgrade
+#define KEEPALIVE_INTERVAL_MS 15000 // Ping upgraded viewers this often
+#define KEEPALIVE_MAX_MISSED 2   // Unanswered pings in a row before dropping a viewer
+#define CLIENT_MAX_MESSAGE 4096  // Largest message accepted from a viewer
+#define CLIENT_QUEUE_MSGS 256    // Frames queued per viewer before new ones are dropped
+#define LAG_DISPOSABLE_FRAMES 15 // Viewer lag at which non-reference frames are dropped
+#define LAG_SKIP_FRAMES 60       // Viewer lag at which it skips to the next keyframe
+#define CLIENT_QUEUE_HIGH_BYTES (8 * 1024 * 1024) // Queued bytes that also trigger a skip
+#define INBOX_SIZE 256           // Frames waiting for an I/O thread, from all cameras
+#define MAX_CAMERAS 16           // RTSP inputs per process
+#define CAMERA_PATH_MAX 128      // Matches http_header.uri
+#define CAMERA_URL_MAX 512
+
+typedef struct io_thread io_thread_t;
 
 /* Client structure for tracking connection state */
 typedef struct
 {
     int fd;                        // Socket file descriptor, or -1 if unused
     bool handshake_done;           // Has the WebSocket handshake been completed?
-    uint8_t buffer[HANDSHAKE_BUF]; // Buffer for handshake data
+    uint8_t *buffer;               // Pooled handshake buffer, NULL once handshake is done
     size_t buffer_len;             // Current length of data in buffer
+    size_t handshake_scanned;      // Bytes already searched for the end of the request
+    io_thread_t *owner;            // I/O thread serving this client
+    int slot;                      // Slot index into owner->chunks
+    int active_index;              // Position in owner->active, or -1 if free
+    int camera;                    // Index into g_cameras once upgraded
+    ws_handler io;                 // Event loop registration, data points back here
+    ws_deadline deadline;          // Handshake timeout, then the keepalive ping
+    ws_keepalive keepalive;        // Outstanding ping and last round trip
+    ws_decoder *decoder;           // Inbound frames, allocated once upgraded
+    ws_tls tls;                    // TLS session, WS_TLS_NONE for plain TCP
+    ws_queue outq;                 // Frames to send, shared with every other viewer
+    ws_viewer viewer;              // Lag state for outq
 } client_t;
 
-/* Global variables for RTSP stream and server configuration */
-static const char *rtsp_url;
+/* An RTSP input, pulled by its own thread and served on one URI path */
+typedef struct
+{
+    int index;                   // Position in g_cameras
+    char path[CAMERA_PATH_MAX];  // Handshake path, or "*" for any other path
+    char url[CAMERA_URL_MAX];
+    pthread_t thread;
+} camera_t;
+
+/* A frame posted by a camera thread */
+typedef struct
+{
+    int camera;
+    ws_msg *msg;
+} inbox_entry_t;
+
+/* An I/O thread with its own SO_REUSEPORT listener, event loop, deadlines and
+ * clients, serving viewers of every camera. Only the inbox is shared. */
+struct io_thread
+{
+    int id;
+    pthread_t thread;
+    int server_fd;
+    ws_reactor loop;
+    ws_handler listener;
+    ws_wheel wheel;
+    /* Client slots in CLIENT_CHUNK-sized chunks, added on demand up to
+     * max_clients. Chunks never move, so client pointers stay valid in epoll. */
+    client_t **chunks;
+    int chunk_count;
+    int capacity;
+    int max_clients;
+    /* Free-list of slot indices and dense array of clients in use, so accept
+     * and broadcast cost scales with connected clients rather than capacity */
+    int *free_slots;
+    int free_count;
+    client_t **active;
+    int active_count;
+    /* Idle handshake buffers, so only connections still handshaking hold one */
+    uint8_t *handshake_pool[HANDSHAKE_POOL_MAX];
+    int handshake_pool_count;
+    /* Frames handed from the camera threads, which this thread queues for
+     * their viewers. The lock is held only to append or take them. */
+    inbox_entry_t inbox[INBOX_SIZE];
+    int inbox_count;
+    bool closed;                 // Shut down; frames are no longer taken
+    pthread_mutex_t inbox_mutex;
+    ws_gop_cache *caches;        // One per camera, for new viewers
+#ifdef WS_IO_URING
+    ws_uring uring;              // Batched broadcast sends
+#endif
+};
+
+/* Global variables for the cameras and server configuration */
+static camera_t g_cameras[MAX_CAMERAS];
+static int g_camera_count = 0;
 static int listen_port;
+static int g_max_clients = DEFAULT_MAX_CLIENTS; // Across all I/O threads
+static struct ssl_ctx_st *g_tls_ctx; // From WS_TLS_CERT/WS_TLS_KEY, NULL for plain TCP
+static ws_gop_burst g_gop_burst = WS_GOP_BURST_ALL; // From WS_GOP_BURST
+static const ws_lag_limits g_lag_limits = {
+    .disposable_frames = LAG_DISPOSABLE_FRAMES,
+    .skip_frames = LAG_SKIP_FRAMES,
+    .high_bytes = CLIENT_QUEUE_HIGH_BYTES,
+};
 
 /* Global variables for the WebSocket server */
-static int g_server_fd = -1;
-static int g_epoll_fd = -1;
-static client_t *g_clients = NULL;
-static pthread_mutex_t g_clients_mutex = PTHREAD_MUTEX_INITIALIZER;
-static volatile sig_atomic_t shutdown_flag = 0;
-
-/* FFmpeg globals */
-AVFormatContext *fmt = NULL;
-AVCodecContext *ctx = NULL;
-AVPacket *pkt = NULL;
-AVDictionary *opts = NULL;
-
-/* New globals for storing SPS/PPS configuration frame */
-static uint8_t *g_config_data = NULL;
-static size_t g_config_size = 0;
+static ws_reactor g_loop;       // Main thread: SIGINT only
+static ws_signals g_signals = {.fd = -1};
+static io_thread_t *g_io = NULL;
+static int g_io_count = 0;
+/* Set by Shutdown() under g_shutdown_mutex; blocking FFmpeg calls poll it
+ * through their interrupt callback and retry waits wake on g_shutdown_cond */
+static volatile int shutdown_flag = 0;
+static pthread_mutex_t g_shutdown_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_shutdown_cond = PTHREAD_COND_INITIALIZER;
 
 /* Function prototypes */
 
 static void Shutdown(void);
-static void sigint_handler(int signum);
+static void on_signal(void *data, int signo);
+static int add_camera(const char *path, const char *url);
+static int load_cameras(const char *file);
+static int route_camera(const char *uri);
 static void set_nonblocking(int fd);
 static int init_server_socket(int port);
-static void handle_new_connection(int epoll_fd);
-static void handle_client_read(client_t *client, int epoll_fd);
-static void close_client(client_t *client, const char *reason, int epoll_fd);
-static void broadcast_frame(uint8_t *wsbuf, size_t wslen);
-static void *server_thread_func(void *arg);
-static void stream_loop(void);
+static int io_thread_init(io_thread_t *io, int id, int max_clients);
+static void io_thread_close(io_thread_t *io);
+static void handle_new_connection(void *data, uint32_t events);
+static void add_connection(io_thread_t *io, int new_fd);
+static void on_client_ready(void *data, uint32_t events);
+static void handle_client_read(client_t *client);
+static void close_client(client_t *client, const char *reason);
+static void on_handshake_timeout(void *data);
+static void on_keepalive(void *data);
+static int on_client_message(void *data, const ws_message *msg);
+static int client_reply(void *data, const uint8_t *frame, size_t len);
+static void client_send(client_t *client, ws_msg *msg);
+static uint64_t monotonic_us(void);
+static int grow_clients(io_thread_t *io);
+static client_t *alloc_client(io_thread_t *io, int fd);
+static void release_client(client_t *client);
+static void put_handshake_buffer(client_t *client);
+static ws_msg *make_frame(const uint8_t *payload, size_t len);
+static void broadcast_packet(const camera_t *cam, enum AVCodecID codec, const AVPacket *packet);
+static void post_frame(int camera, ws_msg *msg);
+static void drain_inbox(void *data);
+static void send_join_burst(client_t *client);
+static void *io_thread_main(void *arg);
+static void *stream_thread_main(void *arg);
+static int stream_interrupted(void *opaque);
+static void retry_wait(void);
+static void stream_loop(camera_t *cam);
 
 #ifdef DEBUG
 FILE* fp = NULL;
 #endif
 /*------------------------------------------------------------------------------
  * main: Entry point of the RTSP to WebSocket relay server.
- * Processes command-line arguments, initializes the server and RTSP stream, starts
- * the server thread, and enters the streaming loop.
+ * Processes command-line arguments, loads the cameras, starts the I/O threads
+ * and one stream thread per camera, then waits for SIGINT.
  *------------------------------------------------------------------------------*/
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    const char *camera_file = NULL;
+    int arg = 1;
+    if (argc > 2 && strcmp(argv[1], "-c") == 0)
     {
-        fprintf(stderr, "Usage: %s <rtsp_url> <listen_port>\n", argv[0]);
+        camera_file = argv[2];
+        arg = 3;
+    }
+    else if (argc > 1)
+    {
+        arg = 2;
+    }
+    if (argc != arg + 1 && argc != arg + 2)
+    {
+        fprintf(stderr, "Usage: %s <rtsp_url> <listen_port> [max_clients]\n"
+                        "       %s -c <cameras.conf> <listen_port> [max_clients]\n", argv[0], argv[0]);
         exit(EXIT_FAILURE);
     }
-    rtsp_url = argv[1];
-    listen_port = atoi(argv[2]);
+    listen_port = atoi(argv[arg]);
+    if (argc == arg + 2)
+    {
+        g_max_clients = atoi(argv[arg + 1]);
+        if (g_max_clients <= 0)
+        {
+            ws_log_error("Invalid max_clients: %s", argv[arg + 1]);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    signal(SIGINT, sigint_handler);
+    /* OpenSSL writes the TLS handshake and close_notify with a plain
+     * write(), which would raise SIGPIPE on a connection the viewer has
+     * reset; ignore it before any thread or socket exists */
+    signal(SIGPIPE, SIG_IGN);
 
-    avformat_network_init();
+    /* Log through the background writer from here on; WS_LOG_LEVEL picks
+     * the level (info by default) and exit() flushes what is queued */
+    int log_level = ws_log_parse_level(getenv("WS_LOG_LEVEL"));
+    if (ws_log_start(log_level >= 0 ? log_level : WS_LOG_INFO) == 0)
+        atexit(ws_log_stop);
 
-    /* Initialize server socket */
-    g_server_fd = init_server_socket(listen_port);
-    if (g_server_fd < 0)
-    {
-        fprintf(stderr, "Failed to initialize server socket\n");
+    /* A single URL is served on every path */
+    if (camera_file ? load_cameras(camera_file) < 0 : add_camera("*", argv[1]) < 0)
         exit(EXIT_FAILURE);
-    }
 
-    /* Create epoll instance and add the server socket */
-    g_epoll_fd = epoll_create1(0);
-    if (g_epoll_fd < 0)
-    {
-        perror("epoll_create1()");
+    /* SIGINT is handled on the main thread's loop; block it before any
+     * thread starts so that none of them takes it asynchronously */
+    if (ws_reactor_init(&g_loop, NULL, NULL) < 0)
         exit(EXIT_FAILURE);
-    }
-    struct epoll_event ev;
-    ev.events = EPOLLIN;
-    ev.data.ptr = NULL; // NULL indicates the server socket
-    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, g_server_fd, &ev) < 0)
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    if (ws_signals_start(&g_loop, &g_signals, &mask, on_signal, NULL) < 0)
+        exit(EXIT_FAILURE);
+
+    /* Terminate TLS in-process, with kernel offload, when given a certificate */
+    const char *tls_cert = getenv("WS_TLS_CERT");
+    const char *tls_key = getenv("WS_TLS_KEY");
+    if (tls_cert && tls_key)
     {
-        perror("epoll_ctl() server_fd");
+        g_tls_ctx = ws_tls_server_ctx(tls_cert, tls_key);
+        if (!g_tls_ctx)
+        {
+            ws_log_error("Failed to set up TLS with %s", tls_cert);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Join burst for new viewers */
+    const char *gop_burst = getenv("WS_GOP_BURST");
+    int burst = ws_gop_burst_parse(gop_burst);
+    if (burst >= 0)
+        g_gop_burst = burst;
+    else if (gop_burst)
+        ws_log_warn("Unknown WS_GOP_BURST \"%s\", sending whole GOPs", gop_burst);
+
+    /* I/O threads scale with the cores, not the cameras (WS_IO_THREADS) */
+    const char *io_threads = getenv("WS_IO_THREADS");
+    int threads = io_threads ? atoi(io_threads) : 0;
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+
+    avformat_network_init();
+
+    #ifdef DEBUG
+    fp = fopen("output.h264", "wb");
+    if (!fp) {
+        ws_log_perror("fopen()");
         exit(EXIT_FAILURE);
     }
+    #endif
 
-    /* Allocate client slots */
-    g_clients = calloc(MAX_CLIENTS, sizeof(client_t));
-    if (!g_clients)
+    /* Start the I/O threads, each accepting on its own socket bound to the port */
+    g_io = calloc(threads, sizeof(io_thread_t));
+    if (!g_io)
     {
-        fprintf(stderr, "Failed to allocate client slots\n");
+        ws_log_perror("calloc() I/O threads");
         exit(EXIT_FAILURE);
     }
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    int limit = (g_max_clients + threads - 1) / threads;
+    for (g_io_count = 0; g_io_count < threads; g_io_count++)
     {
-        g_clients[i].fd = -1;
-        g_clients[i].handshake_done = false;
-        g_clients[i].buffer_len = 0;
+        io_thread_t *io = &g_io[g_io_count];
+        if (io_thread_init(io, g_io_count, limit) < 0)
+        {
+            ws_log_error("Failed to initialize server socket");
+            exit(EXIT_FAILURE);
+        }
+        if (pthread_create(&io->thread, NULL, io_thread_main, io) != 0)
+        {
+            ws_log_perror("pthread_create()");
+            exit(EXIT_FAILURE);
+        }
     }
 
-    /* Start the server thread to handle incoming connections and client I/O */
-    pthread_t server_thread;
-    if (pthread_create(&server_thread, NULL, server_thread_func, NULL) != 0)
+    /* One thread per camera pulls its RTSP stream and broadcasts the frames */
+    for (int i = 0; i < g_camera_count; i++)
     {
-        perror("pthread_create()");
-        exit(EXIT_FAILURE);
+        if (pthread_create(&g_cameras[i].thread, NULL, stream_thread_main, &g_cameras[i]) != 0)
+        {
+            ws_log_perror("pthread_create()");
+            exit(EXIT_FAILURE);
+        }
+        ws_log_info("Camera %s: RTSP stream %s", g_cameras[i].path, g_cameras[i].url);
     }
 
-    fprintf(stderr, "WebSocket server started on port %d\nRTSP stream: %s\n", listen_port, rtsp_url);
-
-    /* Main thread: start streaming RTSP and broadcasting frames */
-    stream_loop();
+    ws_log_info("WebSocket server started on port %d with %d I/O threads and %d cameras",
+                listen_port, g_io_count, g_camera_count);
 
-    pthread_join(server_thread, NULL);
+    /* Main thread: wait for SIGINT, then shut down here */
+    ws_reactor_run(&g_loop);
     Shutdown();
+    return EXIT_SUCCESS;
+}
+
+/*------------------------------------------------------------------------------
+ * add_camera: Append a camera to g_cameras. Paths must be absolute, or "*" to
+ * catch viewers whose path matches no other camera.
+ *------------------------------------------------------------------------------*/
+static int add_camera(const char *path, const char *url)
+{
+    if (g_camera_count == MAX_CAMERAS)
+    {
+        ws_log_error("Too many cameras (at most %d)", MAX_CAMERAS);
+        return -1;
+    }
+    if ((path[0] != '/' && strcmp(path, "*") != 0) || strlen(path) >= CAMERA_PATH_MAX)
+    {
+        ws_log_error("Invalid camera path: %s", path);
+        return -1;
+    }
+    if (strlen(url) >= CAMERA_URL_MAX)
+    {
+        ws_log_error("RTSP URL too long for camera %s", path);
+        return -1;
+    }
+    for (int i = 0; i < g_camera_count; i++)
+    {
+        if (strcmp(g_cameras[i].path, path) == 0)
+        {
+            ws_log_error("Camera path %s listed twice", path);
+            return -1;
+        }
+    }
+    camera_t *cam = &g_cameras[g_camera_count];
+    cam->index = g_camera_count++;
+    strcpy(cam->path, path);
+    strcpy(cam->url, url);
     return 0;
 }
 
+/*------------------------------------------------------------------------------
+ * load_cameras: Read the camera list, one "<path> <rtsp_url>" per line.
+ * Blank lines and lines starting with '#' are skipped.
+ *------------------------------------------------------------------------------*/
+static int load_cameras(const char *file)
+{
+    FILE *f = fopen(file, "r");
+    if (!f)
+    {
+        ws_log_error("%s: %s", file, strerror(errno));
+        return -1;
+    }
+    char line[CAMERA_PATH_MAX + CAMERA_URL_MAX + 64];
+    int lineno = 0;
+    int ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), f))
+    {
+        lineno++;
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+        char *path = strtok(p, " \t\r\n");
+        char *url = strtok(NULL, " \t\r\n");
+        if (!url || strtok(NULL, " \t\r\n"))
+        {
+            ws_log_error("%s:%d: expected \"<path> <rtsp_url>\"", file, lineno);
+            ret = -1;
+        }
+        else
+        {
+            ret = add_camera(path, url);
+        }
+    }
+    fclose(f);
+    if (ret == 0 && g_camera_count == 0)
+    {
+        ws_log_error("%s lists no cameras", file);
+        ret = -1;
+    }
+    return ret;
+}
+
+/*------------------------------------------------------------------------------
+ * route_camera: The camera a handshake URI asks for, ignoring any query
+ * string, or -1 if there is none.
+ *------------------------------------------------------------------------------*/
+static int route_camera(const char *uri)
+{
+    size_t len = strcspn(uri, "?");
+    int any = -1;
+    for (int i = 0; i < g_camera_count; i++)
+    {
+        const char *path = g_cameras[i].path;
+        if (strlen(path) == len && strncmp(path, uri, len) == 0)
+            return i;
+        if (strcmp(path, "*") == 0)
+            any = i;
+    }
+    return any;
+}
+
 /*------------------------------------------------------------------------------
  * set_nonblocking: Set file descriptor to non-blocking mode.
  *------------------------------------------------------------------------------*/
@@ -171,20 +460,23 @@ static void set_nonblocking(int fd)
 }
 
 /*------------------------------------------------------------------------------
- * init_server_socket: Initialize a TCP server socket.
+ * init_server_socket: Initialize a TCP server socket. SO_REUSEPORT lets every
+ * I/O thread bind its own socket to the port, and the kernel spreads new
+ * connections across them.
  *------------------------------------------------------------------------------*/
 static int init_server_socket(int port)
 {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0)
     {
-        perror("socket()");
+        ws_log_perror("socket()");
         return -1;
     }
     int opt = 1;
-    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
     {
-        perror("setsockopt()");
+        ws_log_perror("setsockopt()");
         close(fd);
         return -1;
     }
@@ -195,13 +487,13 @@ static int init_server_socket(int port)
     serv.sin_port = htons(port);
     if (bind(fd, (struct sockaddr *)&serv, sizeof(serv)) < 0)
     {
-        perror("bind()");
+        ws_log_perror("bind()");
         close(fd);
         return -1;
     }
-    if (listen(fd, 10) < 0)
+    if (listen(fd, LISTEN_BACKLOG) < 0)
     {
-        perror("listen()");
+        ws_log_perror("listen()");
         close(fd);
         return -1;
     }
@@ -210,80 +502,313 @@ static int init_server_socket(int port)
 }
 
 /*------------------------------------------------------------------------------
- * handle_new_connection: Accept and set up a new client connection.
+ * io_thread_init: Set up an I/O thread's loop, deadlines, listener and
+ * caches, with room for up to max_clients viewers.
  *------------------------------------------------------------------------------*/
-static void handle_new_connection(int epoll_fd)
+static int io_thread_init(io_thread_t *io, int id, int max_clients)
 {
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
+    io->id = id;
+    io->server_fd = -1;
+    io->max_clients = max_clients;
+    pthread_mutex_init(&io->inbox_mutex, NULL);
+#ifdef WS_IO_URING
+    io->uring.fd = -1;
+#endif
+    io->caches = calloc(g_camera_count, sizeof(ws_gop_cache));
+    if (!io->caches)
+    {
+        ws_log_perror("calloc() camera caches");
+        return -1;
+    }
+    if (ws_reactor_init(&io->loop, drain_inbox, io) < 0 ||
+        ws_wheel_init(&io->wheel, &io->loop, WHEEL_TICK_MS) < 0)
+        return -1;
+
+    io->server_fd = init_server_socket(listen_port);
+    if (io->server_fd < 0)
+        return -1;
+    /* Watch the listening socket (level-triggered) */
+    io->listener.fn = handle_new_connection;
+    io->listener.data = io;
+    if (ws_reactor_add(&io->loop, io->server_fd, EPOLLIN, &io->listener) < 0)
+        return -1;
+
+#ifdef WS_IO_URING
+    if (ws_uring_init(&io->uring, URING_ENTRIES) < 0)
+        ws_log_perror("io_uring_setup(): falling back to send() per client");
+#endif
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * io_thread_close: Release a stopped I/O thread: its upgraded viewers get a
+ * close frame queued behind what they are still waiting for, so it never
+ * lands inside a frame, and frames posted from now on are dropped. Clients
+ * still in the HTTP or TLS handshake are just closed.
+ *------------------------------------------------------------------------------*/
+static void io_thread_close(io_thread_t *io)
+{
+    uint8_t wsbuf[WS_MAX_HEADER_LEN];
+    size_t wslen = sizeof(wsbuf);
+    ws_create_closing_frame(wsbuf, &wslen);
 
-    int new_fd = accept(g_server_fd, (struct sockaddr *)&client_addr, &addr_len);
-    if (new_fd < 0)
+    while (io->active_count > 0)
     {
-        if (errno != EAGAIN && errno != EWOULDBLOCK)
-            perror("accept()");
-        return;
+        client_t *client = io->active[io->active_count - 1];
+        if (client->handshake_done)
+            client_reply(client, wsbuf, wslen);
+        if (client->fd != -1)
+            close_client(client, "Server shutting down");
     }
-    set_nonblocking(new_fd);
+    while (io->handshake_pool_count > 0)
+        free(io->handshake_pool[--io->handshake_pool_count]);
+
+    pthread_mutex_lock(&io->inbox_mutex);
+    io->closed = true;
+    while (io->inbox_count > 0)
+        ws_msg_unref(io->inbox[--io->inbox_count].msg);
+    pthread_mutex_unlock(&io->inbox_mutex);
+    for (int i = 0; i < g_camera_count; i++)
+        ws_gop_cache_free(&io->caches[i]);
+    free(io->caches);
+    io->caches = NULL;
+
+    if (io->server_fd >= 0)
+        close(io->server_fd);
+    io->server_fd = -1;
+    ws_wheel_free(&io->wheel, &io->loop);
+    ws_reactor_free(&io->loop);
+#ifdef WS_IO_URING
+    if (io->uring.fd >= 0)
+        ws_uring_free(&io->uring);
+#endif
+    for (int i = 0; i < io->chunk_count; i++)
+        free(io->chunks[i]);
+    free(io->chunks);
+    free(io->free_slots);
+    free(io->active);
+}
 
-    /* Find a free slot for the new client */
-    pthread_mutex_lock(&g_clients_mutex);
-    int found = 0;
-    for (int i = 0; i < MAX_CLIENTS; i++)
+/*------------------------------------------------------------------------------
+ * handle_new_connection: Accept pending connections until the backlog is empty
+ * or ACCEPT_BATCH_MAX is reached. The listening socket is level-triggered, so
+ * the rest are accepted on the next loop iteration.
+ *------------------------------------------------------------------------------*/
+static void handle_new_connection(void *data, uint32_t events)
+{
+    io_thread_t *io = data;
+    (void)events;
+    for (int n = 0; n < ACCEPT_BATCH_MAX; n++)
     {
-        if (g_clients[i].fd == -1)
+        int new_fd = accept4(io->server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_fd < 0)
         {
-            g_clients[i].fd = new_fd;
-            g_clients[i].handshake_done = false;
-            g_clients[i].buffer_len = 0;
-            struct epoll_event ev;
-            ev.events = EPOLLIN | EPOLLET;
-            ev.data.ptr = &g_clients[i];
-            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, new_fd, &ev) < 0)
-            {
-                perror("epoll_ctl() new client");
-                close(new_fd);
-                g_clients[i].fd = -1;
-            }
-            else
-            {
-                printf("New client connected. FD = %d\n", new_fd);
-            }
-            found = 1;
-            break;
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                ws_log_perror("accept4()");
+            return;
         }
+        add_connection(io, new_fd);
     }
-    pthread_mutex_unlock(&g_clients_mutex);
-    if (!found)
+}
+
+/*------------------------------------------------------------------------------
+ * add_connection: Give an accepted, non-blocking socket a client slot and
+ * register it with the event loop.
+ *------------------------------------------------------------------------------*/
+static void add_connection(io_thread_t *io, int new_fd)
+{
+    /* Take a free slot for the new client */
+    client_t *client = alloc_client(io, new_fd);
+    if (!client)
     {
-        printf("Too many clients, rejecting connection.\n");
+        ws_log_warn("Too many clients, rejecting connection.");
+        /* Admission control: ask the viewer to retry rather than just resetting */
+        static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                   "Retry-After: 5\r\n"
+                                   "Content-Length: 0\r\n"
+                                   "Connection: close\r\n\r\n";
+        send(new_fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
         close(new_fd);
+        return;
+    }
+    if (ws_tls_accept(&client->tls, g_tls_ctx, new_fd) < 0)
+    {
+        close(new_fd);
+        release_client(client);
+        return;
+    }
+    client->io.fn = on_client_ready;
+    client->io.data = client;
+    if (ws_reactor_add(&io->loop, new_fd, EPOLLIN | EPOLLOUT | EPOLLET, &client->io) < 0)
+    {
+        ws_tls_close(&client->tls);
+        close(new_fd);
+        release_client(client);
+    }
+    else
+    {
+        ws_deadline_init(&client->deadline, on_handshake_timeout, client);
+        ws_wheel_schedule(&io->wheel, &client->deadline, HANDSHAKE_TIMEOUT_MS);
+        ws_log_info("New client connected. FD = %d (I/O thread %d)", new_fd, io->id);
     }
 }
 
+/*------------------------------------------------------------------------------
+ * grow_clients: Add a chunk of free slots. Returns -1 if out of memory.
+ *------------------------------------------------------------------------------*/
+static int grow_clients(io_thread_t *io)
+{
+    int capacity = io->capacity + CLIENT_CHUNK;
+    client_t **chunks = realloc(io->chunks, (io->chunk_count + 1) * sizeof(client_t *));
+    if (!chunks)
+        return -1;
+    io->chunks = chunks;
+    int *free_slots = realloc(io->free_slots, capacity * sizeof(int));
+    if (!free_slots)
+        return -1;
+    io->free_slots = free_slots;
+    client_t **active = realloc(io->active, capacity * sizeof(client_t *));
+    if (!active)
+        return -1;
+    io->active = active;
+    client_t *chunk = calloc(CLIENT_CHUNK, sizeof(client_t));
+    if (!chunk)
+        return -1;
+    io->chunks[io->chunk_count++] = chunk;
+    for (int i = CLIENT_CHUNK - 1; i >= 0; i--)
+    {
+        chunk[i].fd = -1;
+        chunk[i].owner = io;
+        chunk[i].slot = io->capacity + i;
+        chunk[i].active_index = -1;
+        io->free_slots[io->free_count++] = io->capacity + i;
+    }
+    io->capacity = capacity;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * alloc_client: Pop a free slot, attach a handshake buffer and append it to
+ * the active array. Returns NULL at the client limit or when memory runs out.
+ *------------------------------------------------------------------------------*/
+static client_t *alloc_client(io_thread_t *io, int fd)
+{
+    if (io->active_count >= io->max_clients)
+        return NULL;
+    if (io->free_count == 0 && grow_clients(io) < 0)
+        return NULL;
+    uint8_t *buf = io->handshake_pool_count > 0 ? io->handshake_pool[--io->handshake_pool_count]
+                                                : malloc(HANDSHAKE_BUF);
+    if (!buf)
+        return NULL;
+    int slot = io->free_slots[--io->free_count];
+    client_t *client = &io->chunks[slot / CLIENT_CHUNK][slot % CLIENT_CHUNK];
+    client->fd = fd;
+    client->handshake_done = false;
+    client->buffer = buf;
+    client->buffer_len = 0;
+    client->handshake_scanned = 0;
+    client->camera = -1;
+    client->active_index = io->active_count;
+    io->active[io->active_count++] = client;
+    return client;
+}
+
+/*------------------------------------------------------------------------------
+ * release_client: Swap-remove a client from the active array and push its slot
+ * back on the free-list.
+ *------------------------------------------------------------------------------*/
+static void release_client(client_t *client)
+{
+    io_thread_t *io = client->owner;
+    int idx = client->active_index;
+    if (idx < 0)
+        return;
+    client_t *last = io->active[--io->active_count];
+    io->active[idx] = last;
+    last->active_index = idx;
+    client->active_index = -1;
+    client->fd = -1;
+    client->handshake_done = false;
+    if (client->decoder)
+    {
+        ws_decoder_free(client->decoder);
+        free(client->decoder);
+        client->decoder = NULL;
+    }
+    put_handshake_buffer(client);
+    io->free_slots[io->free_count++] = client->slot;
+}
+
+/*------------------------------------------------------------------------------
+ * put_handshake_buffer: Return a client's handshake buffer to the pool, or free
+ * it if the pool is full.
+ *------------------------------------------------------------------------------*/
+static void put_handshake_buffer(client_t *client)
+{
+    io_thread_t *io = client->owner;
+    if (client->buffer)
+    {
+        if (io->handshake_pool_count < HANDSHAKE_POOL_MAX)
+            io->handshake_pool[io->handshake_pool_count++] = client->buffer;
+        else
+            free(client->buffer);
+    }
+    client->buffer = NULL;
+    client->buffer_len = 0;
+    client->handshake_scanned = 0;
+}
+
+/*------------------------------------------------------------------------------
+ * on_client_ready: Event loop callback for a client socket. Queued frames go
+ * out once the socket has room again; a TLS handshake may be waiting for
+ * either direction.
+ *------------------------------------------------------------------------------*/
+static void on_client_ready(void *data, uint32_t events)
+{
+    client_t *client = data;
+    if (client->fd != -1 && client->handshake_done && (events & EPOLLOUT) &&
+        ws_queue_flush(&client->outq, client->fd) < 0)
+        close_client(client, "Send error");
+    if (client->fd != -1 && ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ||
+                             client->tls.state == WS_TLS_HANDSHAKE))
+        handle_client_read(client);
+}
+
 /*------------------------------------------------------------------------------
  * handle_client_read: Process incoming data from a client.
  *------------------------------------------------------------------------------*/
-static void handle_client_read(client_t *client, int epoll_fd)
+static void handle_client_read(client_t *client)
 {
+    /* A fresh socket has room for the server's handshake flight, so input
+     * alone drives the TLS handshake */
+    int tls = ws_tls_handshake(&client->tls);
+    if (tls <= 0)
+    {
+        if (tls < 0)
+            close_client(client, "TLS handshake failed");
+        return;
+    }
     while (1)
     {
         uint8_t recv_buf[HANDSHAKE_BUF];
-        ssize_t n = recv(client->fd, recv_buf, sizeof(recv_buf), 0);
+        ssize_t n = ws_tls_recv(&client->tls, client->fd, recv_buf, sizeof(recv_buf));
         if (n <= 0)
         {
             if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
                 break; // No more data available
-            close_client(client, "Client disconnected or read error", epoll_fd);
+            close_client(client, "Client disconnected or read error");
             return;
         }
 
         // If handshake is not complete, accumulate data and process handshake.
         if (!client->handshake_done)
         {
-            if (client->buffer_len + n > sizeof(client->buffer))
+            if (client->buffer_len + n > HANDSHAKE_BUF)
             {
-                close_client(client, "Handshake buffer overflow", epoll_fd);
+                close_client(client, "Handshake buffer overflow");
                 return;
             }
             memcpy(client->buffer + client->buffer_len, recv_buf, (size_t)n);
@@ -291,170 +816,479 @@ static void handle_client_read(client_t *client, int epoll_fd)
 
             http_header header;
             memset(&header, 0, sizeof(header));
-            size_t out_len = sizeof(client->buffer);
-            ws_handshake(&header, client->buffer, client->buffer_len, &out_len);
+            size_t out_len = HANDSHAKE_BUF;
+            ws_handshake(&header, &client->handshake_scanned, client->buffer, client->buffer_len, &out_len);
             if (header.type == WS_OPENING_FRAME)
             {
+                /* The path picks the camera */
+                client->camera = route_camera(header.uri);
+                if (client->camera < 0)
+                {
+                    static const char not_found[] = "HTTP/1.1 404 Not Found\r\n"
+                                                    "Content-Length: 0\r\n"
+                                                    "Connection: close\r\n\r\n";
+                    send(client->fd, not_found, sizeof(not_found) - 1, MSG_NOSIGNAL);
+                    ws_log_warn("Client FD %d asked for unknown camera %s", client->fd, header.uri);
+                    close_client(client, "Unknown camera");
+                    return;
+                }
                 /* Handshake complete: send handshake response */
-                send(client->fd, client->buffer, out_len, 0);
-                client->handshake_done = true;
-                printf("Client FD %d handshake done (Key=%s)\n", client->fd, header.key);
-                client->buffer_len = 0;
-                /* Send stored SPS/PPS configuration, if available */
-                if (g_config_data != NULL && g_config_size > 0)
+                send(client->fd, client->buffer, out_len, MSG_NOSIGNAL);
+                if (ws_queue_init(&client->outq, CLIENT_QUEUE_MSGS) < 0)
+                {
+                    close_client(client, "Out of memory");
+                    return;
+                }
+                // The decoder's reassembly and control-frame state stays out
+                // of the slot, which the frame fanout walks.
+                client->decoder = malloc(sizeof(ws_decoder));
+                if (!client->decoder)
                 {
-                    send(client->fd, g_config_data, g_config_size, 0);
-                    printf("Sent configuration to new client FD %d\n", client->fd);
+                    close_client(client, "Out of memory");
+                    return;
                 }
+                ws_decoder_init(client->decoder, WS_DECODER_SERVER, CLIENT_MAX_MESSAGE,
+                                on_client_message, client_reply, client);
+                client->handshake_done = true;
+                ws_viewer_reset(&client->viewer);
+                put_handshake_buffer(client);
+                ws_wheel_cancel(&client->owner->wheel, &client->deadline);
+                ws_deadline_init(&client->deadline, on_keepalive, client);
+                ws_keepalive_reset(&client->keepalive);
+                ws_wheel_schedule(&client->owner->wheel, &client->deadline, KEEPALIVE_INTERVAL_MS);
+                ws_log_info("Client FD %d handshake done, camera %s (Key=%s)", client->fd,
+                            g_cameras[client->camera].path, header.key);
+                send_join_burst(client);
+                if (client->fd == -1)
+                    return;
             }
             else if (out_len > 0)
             {
                 /* If a handshake response was generated but not valid, send it and close */
-                send(client->fd, client->buffer, out_len, 0);
-                close_client(client, "Invalid handshake", epoll_fd);
+                send(client->fd, client->buffer, out_len, MSG_NOSIGNAL);
+                close_client(client, "Invalid handshake");
                 return;
             }
             continue; // Check for more data
         }
 
-        // Handshake complete – process incoming frames.
-        ws_frame frame;
-        memset(&frame, 0, sizeof(frame));
-        ws_parse_frame(&frame, recv_buf, (size_t)n);
-        if (frame.type == WS_CLOSING_FRAME)
+        // Handshake complete – feed the frame decoder, which may stop after
+        // closing the client.
+        int ret = ws_decoder_feed(client->decoder, recv_buf, (size_t)n);
+        if (ret == WS_DECODE_ERROR)
         {
-            printf("Client FD %d sent CLOSE, closing connection.\n", client->fd);
-            uint8_t out_buf[128];
-            size_t out_size = sizeof(out_buf);
-            ws_create_closing_frame(out_buf, &out_size);
-            send(client->fd, out_buf, out_size, 0);
-            close_client(client, "Close frame", epoll_fd);
-            return;
+            uint8_t out_buf[4];
+            size_t out_size;
+            ws_create_close_frame(client->decoder->close_code, out_buf, &out_size);
+            client_reply(client, out_buf, out_size);
+            if (client->fd != -1)
+                close_client(client, "Protocol error");
         }
+        if (ret != 0)
+            return;
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * on_client_message: Decoder callback; viewers only send pongs and close.
+ *------------------------------------------------------------------------------*/
+static int on_client_message(void *data, const ws_message *msg)
+{
+    client_t *client = data;
+    if (msg->type == WS_PONG_FRAME)
+    {
+        ws_keepalive_pong(&client->keepalive, msg->data, msg->len, monotonic_us());
     }
+    else if (msg->type == WS_CLOSING_FRAME)
+    {
+        ws_log_info("Client FD %d sent CLOSE, closing connection.", client->fd);
+        uint8_t out_buf[4];
+        size_t out_size;
+        ws_create_close_frame(WS_CLOSE_NORMAL, out_buf, &out_size);
+        client_reply(client, out_buf, out_size);
+        if (client->fd != -1)
+            close_client(client, "Close frame");
+        return 1;
+    }
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+ * client_reply: Queue a control frame for a viewer behind the video frames
+ * already queued, so it never splits one.
+ *------------------------------------------------------------------------------*/
+static int client_reply(void *data, const uint8_t *frame, size_t len)
+{
+    client_t *client = data;
+    ws_msg *msg = ws_msg_new(len);
+    if (msg)
+    {
+        memcpy(msg->data, frame, len);
+        client_send(client, msg);
+        ws_msg_unref(msg);
+    }
+    return client->fd == -1;
+}
+
+/*------------------------------------------------------------------------------
+ * client_send: Queue a message for a viewer and write out as much of its
+ * queue as the socket takes; the rest goes out on EPOLLOUT.
+ *------------------------------------------------------------------------------*/
+static void client_send(client_t *client, ws_msg *msg)
+{
+    ws_viewer_queue(&client->viewer, &client->outq, msg, &g_lag_limits, client->fd);
+    if (ws_queue_flush(&client->outq, client->fd) < 0)
+        close_client(client, "Send error");
 }
 
 /*------------------------------------------------------------------------------
  * close_client: Safely close a client connection.
  *------------------------------------------------------------------------------*/
-static void close_client(client_t *client, const char *reason, int epoll_fd)
+static void close_client(client_t *client, const char *reason)
 {
-    printf("Closing client FD %d: %s\n", client->fd, reason);
+    ws_log_info("Closing client FD %d: %s (%llu frames sent, %llu dropped, %u skips to a keyframe, "
+                "peak lag %u frames, rtt %u us)", client->fd, reason,
+                (unsigned long long)client->outq.sent_msgs, (unsigned long long)client->viewer.dropped,
+                client->viewer.skips, client->viewer.peak_lag, client->keepalive.rtt_us);
+    ws_wheel_cancel(&client->owner->wheel, &client->deadline);
     if (client->fd != -1)
     {
-        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+        ws_reactor_del(&client->owner->loop, client->fd);
+        ws_tls_close(&client->tls);
         close(client->fd);
     }
-    client->fd = -1;
-    client->handshake_done = false;
-    client->buffer_len = 0;
+    ws_queue_free(&client->outq);
+    release_client(client);
 }
 
+#ifdef WS_IO_URING
 /*------------------------------------------------------------------------------
- * broadcast_frame: Broadcast a WebSocket binary frame to all connected clients.
+ * uring_flush: Submit the queued frame sends in one io_uring_enter() and
+ * advance each viewer's queue by what went out. The rest of a short send
+ * stays queued for the next flush.
  *------------------------------------------------------------------------------*/
-static void broadcast_frame(uint8_t *wsbuf, size_t wslen)
+static void uring_flush(io_thread_t *io)
 {
-    pthread_mutex_lock(&g_clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    if (ws_uring_submit_wait(&io->uring) < 0)
+        ws_log_perror("io_uring_enter() broadcast");
+    void *data;
+    int res;
+    while (ws_uring_next_cqe(&io->uring, &data, &res))
     {
-        if (g_clients[i].fd != -1 && g_clients[i].handshake_done)
+        client_t *client = data;
+        if (res >= 0)
         {
-            if (send(g_clients[i].fd, wsbuf, wslen, 0) < 0)
-            {
-                perror("send() broadcast");
-                // Optionally, you can close the client on error
-            }
+            ws_queue_consume(&client->outq, (size_t)res);
+        }
+        else if (res != -EAGAIN && client->fd != -1)
+        {
+            errno = -res;
+            ws_log_perror("send() broadcast");
+            close_client(client, "Send error");
         }
     }
-    pthread_mutex_unlock(&g_clients_mutex);
 }
+#endif
 
 /*------------------------------------------------------------------------------
- * server_thread_func: Main loop for the server thread handling I/O events.
+ * on_handshake_timeout: Drop a connection that did not upgrade in time.
  *------------------------------------------------------------------------------*/
-static void *server_thread_func(void *arg)
+static void on_handshake_timeout(void *data)
 {
-    (void)arg;
-    struct epoll_event events[64];
-    while (!shutdown_flag)
+    close_client(data, "Handshake timeout");
+}
+
+/*------------------------------------------------------------------------------
+ * monotonic_us: Microseconds on CLOCK_MONOTONIC, for ping round trips.
+ *------------------------------------------------------------------------------*/
+static uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/*------------------------------------------------------------------------------
+ * on_keepalive: Ping an upgraded viewer, or drop it once it stops answering.
+ * The ping is queued like a video frame so it never splits one.
+ *------------------------------------------------------------------------------*/
+static void on_keepalive(void *data)
+{
+    client_t *client = data;
+    uint8_t ping[WS_PING_FRAME_LEN];
+    if (ws_keepalive_ping(&client->keepalive, monotonic_us(), KEEPALIVE_MAX_MISSED, ping) < 0)
+    {
+        close_client(client, "Missed keepalive pongs");
+        return;
+    }
+    client_reply(client, ping, sizeof(ping));
+    if (client->fd != -1)
+        ws_wheel_schedule(&client->owner->wheel, &client->deadline, KEEPALIVE_INTERVAL_MS);
+}
+
+/*------------------------------------------------------------------------------
+ * make_frame: Encode a small payload (the codec configuration) as a binary
+ * frame message, copying it.
+ *------------------------------------------------------------------------------*/
+static ws_msg *make_frame(const uint8_t *payload, size_t len)
+{
+    ws_msg *msg = ws_msg_new(WS_MAX_HEADER_LEN + len);
+    if (!msg)
+        return NULL;
+    msg->len = ws_frame_header(WS_BINARY_FRAME, 0, len, msg->data);
+    memcpy(msg->data + msg->len, payload, len);
+    msg->len += len;
+    return msg;
+}
+
+static void release_packet(void *owner)
+{
+    AVPacket *packet = owner;
+    av_packet_free(&packet);
+}
+
+/*------------------------------------------------------------------------------
+ * broadcast_packet: Broadcast a camera's video packet without copying it. The
+ * message holds a new reference to the packet's buffer plus the frame header,
+ * and is shared by every viewer queue until the last one has sent it. Its
+ * flags let lagging viewers shed whole frames.
+ *------------------------------------------------------------------------------*/
+static void broadcast_packet(const camera_t *cam, enum AVCodecID codec, const AVPacket *packet)
+{
+    AVPacket *ref = av_packet_clone(packet);
+    if (!ref)
+    {
+        ws_log_error("av_packet_clone() failed, dropping a frame");
+        return;
+    }
+    uint8_t header[WS_MAX_HEADER_LEN];
+    size_t header_len = ws_frame_header(WS_BINARY_FRAME, 0, ref->size, header);
+    ws_msg *msg = ws_msg_wrap(header, header_len, ref->data, ref->size, release_packet, ref);
+    if (!msg)
+    {
+        release_packet(ref);
+        return;
+    }
+    ws_codec wc = codec == AV_CODEC_ID_H264 ? WS_CODEC_H264 :
+                  codec == AV_CODEC_ID_HEVC ? WS_CODEC_HEVC : WS_CODEC_OTHER;
+    msg->flags = ws_frame_flags(wc, ref->flags & AV_PKT_FLAG_KEY, ref->flags & AV_PKT_FLAG_DISPOSABLE,
+                                ref->data, ref->size);
+    post_frame(cam->index, msg);
+    ws_msg_unref(msg);
+}
+
+/*------------------------------------------------------------------------------
+ * post_frame: Hand a camera's frame to every I/O thread. Called from the
+ * camera's stream thread; an I/O thread is woken when its inbox stops being
+ * empty.
+ *------------------------------------------------------------------------------*/
+static void post_frame(int camera, ws_msg *msg)
+{
+    for (int i = 0; i < g_io_count; i++)
     {
-        int nfds = epoll_wait(g_epoll_fd, events, 64, 1000);
-        if (nfds < 0)
+        io_thread_t *io = &g_io[i];
+        bool full = false, wake = false;
+        pthread_mutex_lock(&io->inbox_mutex);
+        if (!io->closed && io->inbox_count < INBOX_SIZE)
+        {
+            io->inbox[io->inbox_count].camera = camera;
+            io->inbox[io->inbox_count++].msg = ws_msg_ref(msg);
+            wake = io->inbox_count == 1;
+        }
+        else
+        {
+            full = !io->closed;
+        }
+        pthread_mutex_unlock(&io->inbox_mutex);
+        if (wake)
+            ws_reactor_wake(&io->loop);
+        if (full)
+            ws_log_warn("I/O thread %d fell behind, dropping a frame from camera %s",
+                        io->id, g_cameras[camera].path);
+    }
+}
+
+/*------------------------------------------------------------------------------
+ * drain_inbox: Queue every waiting frame for each upgraded viewer of its
+ * camera, then write each of those viewers out once. Runs on an I/O thread
+ * after a wakeup. With io_uring, viewers whose queue holds only a single new
+ * frame are written in one batch; the others are flushed with sendmsg().
+ *------------------------------------------------------------------------------*/
+static void drain_inbox(void *data)
+{
+    io_thread_t *io = data;
+    inbox_entry_t frames[INBOX_SIZE];
+    pthread_mutex_lock(&io->inbox_mutex);
+    int count = io->inbox_count;
+    memcpy(frames, io->inbox, count * sizeof(frames[0]));
+    io->inbox_count = 0;
+    pthread_mutex_unlock(&io->inbox_mutex);
+    for (int f = 0; f < count; f++)
+        ws_gop_cache_add(&io->caches[frames[f].camera], frames[f].msg);
+
+#ifdef WS_IO_URING
+    /* Single-frame wakeups are the common case; their sends share one
+     * msghdr, which lives until uring_flush() has reaped them all */
+    struct iovec iov[2];
+    struct msghdr mh = {.msg_iov = iov};
+    if (count == 1)
+        mh.msg_iovlen = ws_msg_iov(frames[0].msg, 0, iov);
+#endif
+    /* From the end: release_client() moves the last viewer into a freed spot */
+    for (int i = io->active_count - 1; i >= 0; i--)
+    {
+        client_t *client = io->active[i];
+        if (!client->handshake_done)
+            continue;
+#ifdef WS_IO_URING
+        uint32_t backlog = client->outq.count; /* Only an idle queue can share mh */
+#endif
+        int queued = 0;
+        for (int f = 0; f < count; f++)
         {
-            if (errno == EINTR)
+            if (frames[f].camera != client->camera)
                 continue;
-            perror("epoll_wait()");
-            break;
+            ws_viewer_queue(&client->viewer, &client->outq, frames[f].msg, &g_lag_limits, client->fd);
+            queued++;
         }
-        for (int i = 0; i < nfds; i++)
+        if (queued == 0)
+            continue;
+#ifdef WS_IO_URING
+        if (io->uring.fd >= 0 && count == 1 && backlog == 0 && client->outq.count == 1)
         {
-            // If data.ptr is NULL, this is the server listening socket.
-            if (events[i].data.ptr == NULL)
-            {
-                handle_new_connection(g_epoll_fd);
-            }
-            else
-            {
-                client_t *client = (client_t *)events[i].data.ptr;
-                if (client)
-                    handle_client_read(client, g_epoll_fd);
-            }
+            if (ws_uring_prep_sendmsg(&io->uring, client->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL, client) == 0)
+                continue;
+            uring_flush(io);
+            if (ws_uring_prep_sendmsg(&io->uring, client->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL, client) == 0)
+                continue;
         }
+#endif
+        if (ws_queue_flush(&client->outq, client->fd) < 0)
+            close_client(client, "Send error");
     }
-    return NULL;
+#ifdef WS_IO_URING
+    if (io->uring.fd >= 0)
+        uring_flush(io);
+#endif
+    for (int f = 0; f < count; f++)
+        ws_msg_unref(frames[f].msg);
 }
 
 /*------------------------------------------------------------------------------
- * stream_loop: Process the RTSP stream and broadcast video frames.
+ * send_join_burst: Bring a new viewer up in one write from its camera's
+ * cache on this I/O thread, as much of it as WS_GOP_BURST asks for.
  *------------------------------------------------------------------------------*/
-static void stream_loop(void)
+static void send_join_burst(client_t *client)
 {
-    #ifdef DEBUG
-    fp = fopen("output.h264", "wb");
-    if (!fp) {
-        perror("fopen()");
-        exit(EXIT_FAILURE);
+    ws_gop_cache *cache = &client->owner->caches[client->camera];
+    int frames = ws_viewer_join(&client->viewer, &client->outq, cache, g_gop_burst);
+    if (ws_queue_flush(&client->outq, client->fd) < 0)
+    {
+        close_client(client, "Send error");
+        return;
     }
-    #endif
+    if (cache->config || frames > 0)
+        ws_log_info("Sent %s%d cached frames to new client FD %d",
+                    cache->config ? "configuration and " : "", frames, client->fd);
+}
+
+/*------------------------------------------------------------------------------
+ * io_thread_main: Main loop for an I/O thread, until ws_reactor_stop().
+ *------------------------------------------------------------------------------*/
+static void *io_thread_main(void *arg)
+{
+    io_thread_t *io = arg;
+    ws_reactor_run(&io->loop);
+    return NULL;
+}
+
+static void *stream_thread_main(void *arg)
+{
+    stream_loop(arg);
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+ * stream_interrupted: FFmpeg interrupt callback, so a blocked open or read
+ * returns as soon as the server shuts down.
+ *------------------------------------------------------------------------------*/
+static int stream_interrupted(void *opaque)
+{
+    (void)opaque;
+    return shutdown_flag;
+}
+
+/*------------------------------------------------------------------------------
+ * retry_wait: Wait a second before reconnecting, or less if shutting down.
+ *------------------------------------------------------------------------------*/
+static void retry_wait(void)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    pthread_mutex_lock(&g_shutdown_mutex);
+    while (!shutdown_flag &&
+           pthread_cond_timedwait(&g_shutdown_cond, &g_shutdown_mutex, &deadline) != ETIMEDOUT)
+        ;
+    pthread_mutex_unlock(&g_shutdown_mutex);
+}
+
+/*------------------------------------------------------------------------------
+ * stream_loop: Process a camera's RTSP stream and broadcast its video frames,
+ * reconnecting whenever it fails.
+ *------------------------------------------------------------------------------*/
+static void stream_loop(camera_t *cam)
+{
+    AVFormatContext *fmt = NULL;
+    AVCodecContext *ctx = NULL;
+    AVPacket *pkt = NULL;
+    AVDictionary *opts = NULL;
     int ret, vid_idx, sent_sps = 0;
-    uint8_t wsbuf[10 + MAX_PKT];
-    size_t wslen;
 
-    for (;;)
+    while (!shutdown_flag)
     {
-        printf("[DEBUG] Opening RTSP stream: %s\n", rtsp_url);
+        ws_log_debug("Camera %s: opening RTSP stream %s", cam->path, cam->url);
         av_dict_set(&opts, "rtsp_transport", "tcp", 0);
         av_dict_set(&opts, "max_delay", "500000", 0); // 500ms delay
-        if ((ret = avformat_open_input(&fmt, rtsp_url, NULL, &opts)) < 0)
+        fmt = avformat_alloc_context();
+        if (!fmt)
+        {
+            ws_log_error("Camera %s: avformat_alloc_context failed. Retrying in 1s…", cam->path);
+            av_dict_free(&opts);
+            retry_wait();
+            continue;
+        }
+        fmt->interrupt_callback.callback = stream_interrupted;
+        // Frees fmt on failure
+        if ((ret = avformat_open_input(&fmt, cam->url, NULL, &opts)) < 0)
         {
-            fprintf(stderr, "[ERROR] avformat_open_input failed (%d). Retrying in 1s…\n", ret);
+            ws_log_error("Camera %s: avformat_open_input failed (%d). Retrying in 1s…", cam->path, ret);
             av_dict_free(&opts);
-            sleep(1);
+            retry_wait();
             continue;
         }
         av_dict_free(&opts);
         if ((ret = avformat_find_stream_info(fmt, NULL)) < 0)
         {
-            fprintf(stderr, "[ERROR] avformat_find_stream_info failed (%d). Retrying in 1s…\n", ret);
+            ws_log_error("Camera %s: avformat_find_stream_info failed (%d). Retrying in 1s…", cam->path, ret);
             avformat_close_input(&fmt);
-            sleep(1);
+            retry_wait();
             continue;
         }
         if ((vid_idx = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0)
         {
-            fprintf(stderr, "[ERROR] No video stream found. Retrying in 1s…\n");
+            ws_log_error("Camera %s: no video stream found. Retrying in 1s…", cam->path);
             avformat_close_input(&fmt);
-            sleep(1);
+            retry_wait();
             continue;
         }
         AVCodecParameters *cp = fmt->streams[vid_idx]->codecpar;
         const AVCodec *dec = avcodec_find_decoder(cp->codec_id);
         if (!dec)
         {
-            fprintf(stderr, "[ERROR] Unsupported codec (%d). Retrying in 1s…\n", cp->codec_id);
+            ws_log_error("Camera %s: unsupported codec (%d). Retrying in 1s…", cam->path, cp->codec_id);
             avformat_close_input(&fmt);
-            sleep(1);
+            retry_wait();
             continue;
         }
         ctx = avcodec_alloc_context3(dec);
@@ -462,133 +1296,109 @@ static void stream_loop(void)
             avcodec_parameters_to_context(ctx, cp) < 0 ||
             avcodec_open2(ctx, dec, NULL) < 0)
         {
-            fprintf(stderr, "[ERROR] Decoder init failed. Retrying in 1s…\n");
+            ws_log_error("Camera %s: decoder init failed. Retrying in 1s…", cam->path);
             if (ctx)
                 avcodec_free_context(&ctx);
             avformat_close_input(&fmt);
-            sleep(1);
+            retry_wait();
             continue;
         }
         pkt = av_packet_alloc();
         if (!pkt)
         {
-            fprintf(stderr, "[ERROR] av_packet_alloc failed. Retrying in 1s…\n");
+            ws_log_error("Camera %s: av_packet_alloc failed. Retrying in 1s…", cam->path);
             avcodec_free_context(&ctx);
             avformat_close_input(&fmt);
-            sleep(1);
+            retry_wait();
             continue;
         }
         sent_sps = 0;
         while ((ret = av_read_frame(fmt, pkt)) >= 0 && !shutdown_flag)
         {
             #ifdef DEBUG
-            printf("Read frame, stream_index: %d, size: %d, key: %s\n",
-                pkt->stream_index, pkt->size, (pkt->flags & AV_PKT_FLAG_KEY) ? "yes" : "no");
+            ws_log_debug("Camera %s: read frame, stream_index: %d, size: %d, key: %s", cam->path,
+                         pkt->stream_index, pkt->size, (pkt->flags & AV_PKT_FLAG_KEY) ? "yes" : "no");
             #endif
 
             if (pkt->stream_index == vid_idx)
             {
-                /* Before sending the first key frame, send SPS/PPS if available */
+                /* Before sending the first key frame, send SPS/PPS if available;
+                 * the I/O threads also keep it for new viewers */
                 if (!sent_sps && (pkt->flags & AV_PKT_FLAG_KEY) && ctx->extradata)
                 {
-                    ws_create_binary_frame(ctx->extradata, ctx->extradata_size, wsbuf, &wslen);
-                    broadcast_frame(wsbuf, wslen);
-                    /* Store configuration for new clients if not already stored */
-                    if (g_config_data == NULL)
+                    ws_msg *config = make_frame(ctx->extradata, ctx->extradata_size);
+                    if (config)
                     {
-                        g_config_data = malloc(wslen);
-                        if (g_config_data)
-                        {
-                            memcpy(g_config_data, wsbuf, wslen);
-                            g_config_size = wslen;
-                        }
+                        post_frame(cam->index, config);
+                        ws_msg_unref(config);
                     }
                     sent_sps = 1;
                 }
-                ws_create_binary_frame(pkt->data, pkt->size, wsbuf, &wslen);
                 #ifdef DEBUG
-                {
-                    ws_frame test_frame;
-                    memset(&test_frame, 0, sizeof(test_frame));
-                    ws_parse_frame(&test_frame, wsbuf, wslen);
-                    if (fp) {
-                        fwrite(test_frame.payload, 1, test_frame.payload_length, fp);
-                        fflush(fp);
-                        printf("Parsed frame: payload length = %zu\n", test_frame.payload_length);
-                    }
+                if (fp && cam->index == 0) {
+                    fwrite(pkt->data, 1, pkt->size, fp);
+                    fflush(fp);
+                    ws_log_debug("Frame payload length = %d", pkt->size);
                 }
                 #endif
-                broadcast_frame(wsbuf, wslen);
+                broadcast_packet(cam, cp->codec_id, pkt);
             }
             av_packet_unref(pkt);
         }
-        if (ret != AVERROR_EOF)
+        if (ret < 0 && ret != AVERROR_EOF && !shutdown_flag)
         {
-            fprintf(stderr, "[ERROR] av_read_frame failed (%d). Retrying in 1s…\n", ret);
+            ws_log_error("Camera %s: av_read_frame failed (%d). Retrying in 1s…", cam->path, ret);
         }
         av_packet_free(&pkt);
         avcodec_free_context(&ctx);
         avformat_close_input(&fmt);
-        sleep(1);
+        retry_wait();
     }
 }
 
 /*------------------------------------------------------------------------------
- * Shutdown: Cleanup resources and shut down the server gracefully.
+ * Shutdown: Cleanup resources and shut down the server gracefully. The camera
+ * threads are woken from any blocking read or retry wait and joined first, so
+ * nothing posts frames once the I/O threads are stopped, joined and freed.
  *------------------------------------------------------------------------------*/
 static void Shutdown(void)
 {
+    pthread_mutex_lock(&g_shutdown_mutex);
     shutdown_flag = 1;
-    uint8_t wsbuf[128];
-    size_t wslen = sizeof(wsbuf);
-    ws_create_closing_frame(wsbuf, &wslen);
+    pthread_cond_broadcast(&g_shutdown_cond);
+    pthread_mutex_unlock(&g_shutdown_mutex);
+    for (int i = 0; i < g_camera_count; i++)
+        pthread_join(g_cameras[i].thread, NULL);
 
-    pthread_mutex_lock(&g_clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    for (int i = 0; i < g_io_count; i++)
+        ws_reactor_stop(&g_io[i].loop);
+    for (int i = 0; i < g_io_count; i++)
     {
-        if (g_clients[i].fd != -1)
-        {
-            send(g_clients[i].fd, wsbuf, wslen, 0);
-            close(g_clients[i].fd);
-            g_clients[i].fd = -1;
-        }
-    }
-    pthread_mutex_unlock(&g_clients_mutex);
-
-    if (g_config_data)
-    {
-        free(g_config_data);
-        g_config_data = NULL;
-        g_config_size = 0;
+        pthread_join(g_io[i].thread, NULL);
+        io_thread_close(&g_io[i]);
     }
-    if (pkt)
-        av_packet_free(&pkt);
-    if (ctx)
-        avcodec_free_context(&ctx);
-    if (fmt)
-        avformat_close_input(&fmt);
-    if (opts)
-        av_dict_free(&opts);
+    free(g_io);
+    g_io = NULL;
+    g_io_count = 0;
 
-    if (g_server_fd >= 0)
-        close(g_server_fd);
-    if (g_epoll_fd >= 0)
-        close(g_epoll_fd);
-    if (g_clients)
-        free(g_clients);
+    ws_signals_stop(&g_loop, &g_signals);
+    ws_reactor_free(&g_loop);
+    ws_tls_ctx_free(g_tls_ctx);
+    avformat_network_deinit();
 
     #ifdef DEBUG
     fclose(fp);
     #endif
-    exit(EXIT_SUCCESS);
 }
 
 /*------------------------------------------------------------------------------
- * sigint_handler: Handle SIGINT for graceful shutdown.
+ * on_signal: SIGINT, delivered on the main thread's loop; stop it so main()
+ * shuts down once ws_reactor_run() returns.
  *------------------------------------------------------------------------------*/
-static void sigint_handler(int signum)
+static void on_signal(void *data, int signo)
 {
-    (void)signum;
-    printf("[INFO] SIGINT received, shutting down...\n");
-    Shutdown();
+    (void)data;
+    (void)signo;
+    ws_log_info("SIGINT received, shutting down...");
+    ws_reactor_stop(&g_loop);
 }